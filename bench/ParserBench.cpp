@@ -0,0 +1,226 @@
+// HTTP parser micro-benchmark: incremental HttpParser vs. the previous
+// receiveRequest (re-scan per recv, istringstream lines, substr copies).
+// Build with -DLUMENITE_BUILD_BENCHMARKS=ON and run ./parser_bench
+
+#include "../src/HttpParser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static constexpr size_t RECV_SIZE = 4096;
+
+// The pre-parser request type and receiveRequest, with recv() replaced by
+// handing out the next chunk; kept here as the baseline.
+struct LegacyRequest
+{
+    std::string method;
+    std::string path;
+    std::unordered_map<std::string, std::string> headers;
+    std::unordered_map<std::string, std::vector<std::string> > query;
+    std::unordered_map<std::string, std::vector<std::string> > form;
+    std::string body;
+    std::string remote_ip;
+};
+
+static std::string urlDecode(const std::string &value)
+{
+    std::ostringstream result;
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '+') {
+            result << ' ';
+        } else if (value[i] == '%' && i + 2 < value.size()) {
+            int hex = 0;
+            std::istringstream(value.substr(i + 1, 2)) >> std::hex >> hex;
+            result << static_cast<char>(hex);
+            i += 2;
+        } else {
+            result << value[i];
+        }
+    }
+    return result.str();
+}
+
+static bool legacyReceive(const std::string &wire, const std::string &clientIp, LegacyRequest &req)
+{
+    size_t fed = 0;
+    auto recvChunk = [&](std::string &into)
+    {
+        size_t n = std::min(RECV_SIZE, wire.size() - fed);
+        into.append(wire, fed, n);
+        fed += n;
+        return n;
+    };
+
+    std::string raw;
+    while (raw.find("\r\n\r\n") == std::string::npos) {
+        if (recvChunk(raw) == 0) return false;
+    }
+
+    auto hdrEnd = raw.find("\r\n\r\n");
+    std::string hdrs = raw.substr(0, hdrEnd);
+    std::string body = raw.substr(hdrEnd + 4);
+
+    std::istringstream ss(hdrs);
+    std::string line;
+    std::getline(ss, line);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    {
+        std::istringstream ls(line);
+        std::string httpVer;
+        ls >> req.method >> req.path >> httpVer;
+    }
+
+    while (std::getline(ss, line) && !line.empty()) {
+        if (line.back() == '\r') line.pop_back();
+        auto c = line.find(':');
+        if (c != std::string::npos) {
+            std::string k = line.substr(0, c);
+            std::string v = line.substr(c + 1);
+            if (!v.empty() && v.front() == ' ') v.erase(0, 1);
+            req.headers[k] = v;
+        }
+    }
+
+    if (auto qm = req.path.find('?'); qm != std::string::npos) {
+        std::string qs = req.path.substr(qm + 1);
+        req.path.resize(qm);
+        for (size_t p = 0; p < qs.size();) {
+            auto amp = qs.find('&', p);
+            std::string kv = qs.substr(p, amp - p);
+            auto eq = kv.find('=');
+            std::string k = urlDecode(kv.substr(0, eq));
+            std::string v = eq != std::string::npos ? urlDecode(kv.substr(eq + 1)) : "";
+            req.query[k].push_back(v);
+            if (amp == std::string::npos) break;
+            p = amp + 1;
+        }
+    }
+
+    size_t contentLen = 0;
+    if (auto it = req.headers.find("Content-Length"); it != req.headers.end()) {
+        contentLen = std::stoul(it->second);
+    }
+    while (body.size() < contentLen) {
+        if (recvChunk(body) == 0) break;
+    }
+    req.body = body;
+
+    if (req.headers["Content-Type"] == "application/x-www-form-urlencoded") {
+        for (size_t p = 0; p < body.size();) {
+            auto amp = body.find('&', p);
+            std::string pr = body.substr(p, amp - p);
+            auto eq = pr.find('=');
+            std::string k = urlDecode(pr.substr(0, eq));
+            std::string v = eq != std::string::npos ? urlDecode(pr.substr(eq + 1)) : "";
+            req.form[k].push_back(v);
+            if (amp == std::string::npos) break;
+            p = amp + 1;
+        }
+    }
+
+    req.remote_ip = clientIp;
+    return true;
+}
+
+// Same delivery pattern for the new parser: append a chunk, feed, repeat.
+static bool incrementalReceive(const std::string &wire, const std::string &clientIp,
+                               std::string &buffer, HttpParser &parser, HttpRequest &req)
+{
+    size_t fed = 0;
+    ParseResult pr;
+    while ((pr = parser.feed(buffer)) == ParseResult::Incomplete) {
+        size_t n = std::min(RECV_SIZE, wire.size() - fed);
+        if (n == 0) return false;
+        buffer.append(wire, fed, n);
+        fed += n;
+    }
+    if (pr != ParseResult::Complete) return false;
+    parser.take(buffer, clientIp, req);
+    return true;
+}
+
+static std::string browserHeaders(size_t cookieBytes)
+{
+    std::string h =
+            "Host: localhost:8080\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+            "Accept-Language: en-US,en;q=0.9\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "Connection: keep-alive\r\n";
+    if (cookieBytes) h += "Cookie: LUMENITE_SESSION=0123456789abcdef; tracking=" + std::string(cookieBytes, 'x') + "\r\n";
+    return h;
+}
+
+struct Workload
+{
+    const char *name;
+    std::string wire;
+};
+
+template<typename Fn>
+static double nsPerOp(size_t iterations, Fn &&fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) fn(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(iterations);
+}
+
+int main()
+{
+    const std::string form = "name=J%C3%BCrgen+Doe&email=jd%40example.com&tags=a&tags=b&note=" + std::string(200, 'n');
+    std::vector<Workload> workloads = {
+        {"small GET", "GET /index.html HTTP/1.1\r\n" + browserHeaders(0) + "\r\n"},
+        {"GET + query", "GET /search?q=hello+world&page=2&sort=desc&f=%2Fa%2Fb HTTP/1.1\r\n" + browserHeaders(0) + "\r\n"},
+        {"form POST", "POST /submit HTTP/1.1\r\n" + browserHeaders(0) +
+                      "Content-Type: application/x-www-form-urlencoded\r\n"
+                      "Content-Length: " + std::to_string(form.size()) + "\r\n\r\n" + form},
+        {"16 KB headers", "GET /dashboard HTTP/1.1\r\n" + browserHeaders(16 * 1024) + "\r\n"},
+        {"60 KB headers", "GET /dashboard HTTP/1.1\r\n" + browserHeaders(60 * 1024) + "\r\n"},
+    };
+
+    volatile size_t sink = 0;
+    std::string buffer;
+    HttpParser parser;
+
+    std::printf("%-14s  %10s  %15s  %15s\n", "request", "bytes", "parser ns/req", "legacy ns/req");
+    for (const auto &w: workloads) {
+        LegacyRequest legacy;
+        HttpRequest req;
+        bool same = legacyReceive(w.wire, "127.0.0.1", legacy) &&
+                    incrementalReceive(w.wire, "127.0.0.1", buffer, parser, req) &&
+                    legacy.method == req.method && legacy.path == req.path && legacy.body == req.body;
+        for (const auto &[k, v]: req.headers)
+            same = same && legacy.headers[std::string(k)] == v;
+        for (const auto &[k, v]: req.query)
+            same = same && !legacy.query[std::string(k)].empty();
+        for (const auto &[k, v]: req.form)
+            same = same && !legacy.form[std::string(k)].empty();
+        if (!same) {
+            std::printf("mismatch on %s\n", w.name);
+            return 1;
+        }
+
+        size_t iters = std::max<size_t>(2000, 20000000 / w.wire.size());
+        double fresh = nsPerOp(iters, [&](size_t)
+        {
+            HttpRequest r;
+            incrementalReceive(w.wire, "127.0.0.1", buffer, parser, r);
+            sink = sink + r.headers.size();
+        });
+        double old = nsPerOp(iters, [&](size_t)
+        {
+            LegacyRequest r;
+            legacyReceive(w.wire, "127.0.0.1", r);
+            sink = sink + r.headers.size();
+        });
+
+        std::printf("%-14s  %10zu  %15.1f  %15.1f\n", w.name, w.wire.size(), fresh, old);
+    }
+    return sink == 42 ? 1 : 0;
+}
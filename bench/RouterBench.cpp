@@ -0,0 +1,132 @@
+// Router micro-benchmark: radix trie vs. the previous linear std::regex scan.
+// Build with -DLUMENITE_BUILD_BENCHMARKS=ON and run ./router_bench
+
+#include "../src/Router.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+// The pre-trie Router::match, kept here as the baseline.
+struct LinearRegexRouter
+{
+    struct Route
+    {
+        std::string method;
+        std::regex compiled;
+        int id;
+    };
+
+    std::vector<Route> routes;
+
+    void add(const std::string &method, const std::string &pattern, int id)
+    {
+        std::string pat = "^";
+        for (size_t i = 0; i < pattern.size();) {
+            if (pattern[i] == '<') {
+                while (i < pattern.size() && pattern[i] != '>') ++i;
+                ++i;
+                pat += R"(([^/]+))";
+            } else {
+                if (std::ispunct(static_cast<unsigned char>(pattern[i]))) pat += '\\';
+                pat += pattern[i++];
+            }
+        }
+        pat += '$';
+        routes.push_back({method, std::regex(pat), id});
+    }
+
+    int match(const std::string &method, const std::string &path, std::vector<std::string> &args) const
+    {
+        for (const auto &R: routes) {
+            if (R.method != method) continue;
+            std::smatch m;
+            if (std::regex_match(path, m, R.compiled)) {
+                args.clear();
+                for (size_t j = 1; j < m.size(); ++j) args.emplace_back(m[j].str());
+                return R.id;
+            }
+        }
+        return 0;
+    }
+};
+
+// Route shapes seen in real apps: literals, one param, two params.
+static std::string patternFor(size_t i)
+{
+    switch (i % 3) {
+        case 0: return "/api/v1/resource" + std::to_string(i) + "/<id>";
+        case 1: return "/pages/section" + std::to_string(i) + "/about";
+        default: return "/users/<uid>/collection" + std::to_string(i) + "/<item>";
+    }
+}
+
+static std::string pathFor(size_t i)
+{
+    switch (i % 3) {
+        case 0: return "/api/v1/resource" + std::to_string(i) + "/42";
+        case 1: return "/pages/section" + std::to_string(i) + "/about";
+        default: return "/users/alice/collection" + std::to_string(i) + "/7";
+    }
+}
+
+template<typename Fn>
+static double nsPerOp(size_t iterations, Fn &&fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) fn(i);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(iterations);
+}
+
+int main()
+{
+    const size_t sizes[] = {10, 50, 100, 300, 1000, 3000};
+    Router::Table trie;
+    LinearRegexRouter linear;
+    size_t registered = 0;
+
+    std::mt19937 rng(7);
+    volatile int sink = 0;
+
+    std::printf("%8s  %14s  %14s\n", "routes", "radix ns/match", "regex ns/match");
+    for (size_t n: sizes) {
+        for (; registered < n; ++registered) {
+            int id = trie.add("GET", patternFor(registered));
+            linear.add("GET", patternFor(registered), id);
+        }
+
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < 1024; ++i) paths.push_back(pathFor(rng() % n));
+
+        std::vector<std::string_view> views;
+        std::vector<std::string> strings;
+        for (const auto &p: paths) {
+            int id = 0;
+            trie.match("GET", p, id, views);
+            if (id != linear.match("GET", p, strings) || views.size() != strings.size()) {
+                std::printf("mismatch on %s\n", p.c_str());
+                return 1;
+            }
+        }
+
+        double radix = nsPerOp(200000, [&](size_t i)
+        {
+            int id = 0;
+            trie.match("GET", paths[i & 1023], id, views);
+            sink = sink + id;
+        });
+
+        size_t regexIters = std::max<size_t>(200, 200000 / n);
+        double regex = nsPerOp(regexIters, [&](size_t i)
+        {
+            sink = sink + linear.match("GET", paths[i & 1023], strings);
+        });
+
+        std::printf("%8zu  %14.1f  %14.1f\n", n, radix, regex);
+    }
+    return sink == 42 ? 1 : 0;
+}
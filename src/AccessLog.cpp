@@ -0,0 +1,408 @@
+#include "AccessLog.h"
+#include "ErrorHandler.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+
+std::mutex AccessLog::mutex;
+AccessLog::Config AccessLog::config;
+std::vector<std::shared_ptr<AccessLog::Ring> > AccessLog::rings;
+std::FILE *AccessLog::sink = nullptr;
+uint64_t AccessLog::sinkBytes = 0;
+AccessLog::SystemClock::time_point AccessLog::sinkOpened;
+
+std::once_flag AccessLog::started;
+std::condition_variable AccessLog::wake;
+std::atomic<uint64_t> AccessLog::flushRequests{0};
+std::atomic<uint64_t> AccessLog::flushesDone{0};
+std::atomic<uint64_t> AccessLog::written{0};
+std::atomic<uint64_t> AccessLog::droppedTotal{0};
+std::atomic<uint64_t> AccessLog::rotations{0};
+
+static std::condition_variable flushed;
+
+
+static const char *colorForStatus(int code)
+{
+    if (code >= 100 && code < 200) return MAGENTA; // Informational
+    if (code >= 200 && code < 300) return GREEN; // Success
+    if (code >= 300 && code < 400) return CYAN; // Redirection
+    if (code == 400) return BOLD YELLOW; // Bad Request
+    if (code == 401 || code == 403) return BOLD MAGENTA; // Unauthorized / Forbidden
+    if (code == 404) return BOLD BLUE; // Not Found
+    if (code >= 400 && code < 500) return YELLOW; // Other Client Errors
+    if (code == 500) return BOLD RED; // Internal Server Error
+    if (code >= 500 && code < 600) return RED; // Other Server Errors
+    return RESET; // Unknown or custom
+}
+
+static const char *colorForMethod(std::string_view method)
+{
+    if (method == "GET") return CYAN;
+    if (method == "POST") return MAGENTA;
+    if (method == "DELETE") return RED;
+    return WHITE;
+}
+
+static void appendJsonString(std::string &out, std::string_view s)
+{
+    static constexpr char hex[] = "0123456789abcdef";
+    out += '"';
+    for (unsigned char c: s) {
+        switch (c) {
+            case '"': out += "\\\"";
+                break;
+            case '\\': out += "\\\\";
+                break;
+            case '\n': out += "\\n";
+                break;
+            case '\r': out += "\\r";
+                break;
+            case '\t': out += "\\t";
+                break;
+            default:
+                if (c < 0x20) {
+                    out += "\\u00";
+                    out += hex[c >> 4];
+                    out += hex[c & 0xF];
+                } else {
+                    out += static_cast<char>(c);
+                }
+        }
+    }
+    out += '"';
+}
+
+static void appendPadded(std::string &out, std::string_view s, size_t width)
+{
+    out += s;
+    if (s.size() < width) out.append(width - s.size(), ' ');
+}
+
+// localtime/strftime once per second instead of once per line; only the
+// writer thread formats, so the cache needs no locking.
+struct Timestamp
+{
+    std::time_t second = -1;
+    char day[16] = {};
+    char clock[16] = {};
+    char iso[32] = {};
+
+    void update(std::chrono::system_clock::time_point t)
+    {
+        std::time_t s = std::chrono::system_clock::to_time_t(t);
+        if (s == second) return;
+        second = s;
+        std::tm lt = *std::localtime(&s);
+        std::strftime(day, sizeof(day), "%d/%b/%Y", &lt);
+        std::strftime(clock, sizeof(clock), "%H:%M:%S", &lt);
+        std::strftime(iso, sizeof(iso), "%Y-%m-%dT%H:%M:%S%z", &lt);
+    }
+};
+
+
+AccessLog::Ring::Ring(size_t capacity)
+{
+    size_t n = 64;
+    while (n < capacity) n <<= 1;
+    slots.resize(n);
+    mask = n - 1;
+}
+
+// —————————————————————————————————————————————
+// Producers (request threads)
+// —————————————————————————————————————————————
+
+AccessLog::Ring &AccessLog::localRing()
+{
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ring = std::make_shared<Ring>(config.ringCapacity);
+        rings.push_back(ring);
+        std::call_once(started, []
+        {
+            std::thread(writerLoop).detach();
+            std::atexit(flush);
+        });
+    }
+    return *ring;
+}
+
+template<typename Fill>
+void AccessLog::push(Kind kind, Fill &&fill)
+{
+    Ring &ring = localRing();
+    size_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - ring.head.load(std::memory_order_acquire) > ring.mask) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record &r = ring.slots[tail & ring.mask];
+    r.kind = kind;
+    r.time = SystemClock::now();
+    fill(r);
+    ring.tail.store(tail + 1, std::memory_order_release);
+}
+
+void AccessLog::request(int status, std::string_view method, std::string_view path, std::string_view remoteIp)
+{
+    push(Kind::Request, [&](Record &r)
+    {
+        r.status = status;
+        r.method.assign(method);
+        r.path.assign(path);
+        r.remoteIp.assign(remoteIp);
+    });
+}
+
+void AccessLog::abort(int status, std::string_view message)
+{
+    push(Kind::Abort, [&](Record &r)
+    {
+        r.status = status;
+        r.message.assign(message);
+    });
+}
+
+void AccessLog::error(std::string_view message)
+{
+    push(Kind::Error, [&](Record &r) { r.message.assign(message); });
+}
+
+void AccessLog::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (rings.empty()) return; // nothing was ever logged; no writer to wait on
+
+    uint64_t ticket = flushRequests.fetch_add(1) + 1;
+    wake.notify_one();
+    flushed.wait(lock, [ticket] { return flushesDone.load() >= ticket; });
+}
+
+// —————————————————————————————————————————————
+// Configuration
+// —————————————————————————————————————————————
+
+void AccessLog::configure(const Config &next)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    bool reopen = next.file != config.file;
+    config = next;
+    // Every worker state replays app.lua; only a changed target reopens.
+    if (reopen && sink) {
+        if (sink != stdout) std::fclose(sink);
+        sink = nullptr;
+    }
+}
+
+AccessLog::Config AccessLog::configuration()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return config;
+}
+
+AccessLog::Stats AccessLog::stats()
+{
+    return {written.load(), droppedTotal.load(), rotations.load()};
+}
+
+// —————————————————————————————————————————————
+// Writer thread
+// —————————————————————————————————————————————
+
+void AccessLog::writerLoop()
+{
+    std::string batch;
+    while (true) {
+        uint64_t target;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, config.flushInterval, []
+            {
+                return flushRequests.load() > flushesDone.load();
+            });
+            target = flushRequests.load();
+        }
+
+        batch.clear();
+        size_t records = drain(batch);
+        if (!batch.empty()) write(batch);
+        written.fetch_add(records, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        flushesDone.store(target);
+        flushed.notify_all();
+    }
+}
+
+size_t AccessLog::drain(std::string &batch)
+{
+    std::vector<std::shared_ptr<Ring> > snapshot;
+    Config cfg;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Forget rings whose thread has exited and whose records are written.
+        std::erase_if(rings, [](const std::shared_ptr<Ring> &r)
+        {
+            return r.use_count() == 1 && r->head.load() == r->tail.load();
+        });
+        snapshot = rings;
+        cfg = config;
+    }
+
+    size_t records = 0;
+    uint64_t dropped = 0;
+    for (auto &ring: snapshot) {
+        size_t head = ring->head.load(std::memory_order_relaxed);
+        size_t tail = ring->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head, ++records)
+            format(ring->slots[head & ring->mask], batch, cfg);
+        ring->head.store(head, std::memory_order_release);
+        dropped += ring->dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+    if (dropped) {
+        droppedTotal.fetch_add(dropped, std::memory_order_relaxed);
+        Record note;
+        note.kind = Kind::Error;
+        note.time = SystemClock::now();
+        note.message = "[AccessLog] dropped " + std::to_string(dropped) + " records (log buffer full)";
+        format(note, batch, cfg);
+    }
+    return records;
+}
+
+void AccessLog::format(const Record &r, std::string &out, const Config &cfg)
+{
+    static Timestamp ts;
+    ts.update(r.time);
+
+    switch (cfg.format) {
+        case Format::Json:
+            out += "{\"time\":\"";
+            out += ts.iso;
+            out += "\",\"type\":";
+            if (r.kind == Kind::Request) {
+                out += "\"request\",\"status\":" + std::to_string(r.status) + ",\"method\":";
+                appendJsonString(out, r.method);
+                out += ",\"path\":";
+                appendJsonString(out, r.path);
+                out += ",\"remote_ip\":";
+                appendJsonString(out, r.remoteIp);
+            } else {
+                out += r.kind == Kind::Abort ? "\"abort\",\"status\":" + std::to_string(r.status) : "\"error\"";
+                out += ",\"message\":";
+                appendJsonString(out, r.message);
+            }
+            out += "}\n";
+            return;
+
+        case Format::Plain:
+            out += '[';
+            out += ts.day;
+            out += ':';
+            out += ts.clock;
+            out += "] ";
+            if (r.kind == Kind::Request) {
+                appendPadded(out, r.remoteIp, 16);
+                out += ' ' + std::to_string(r.status) + ' ' + r.method + ' ' + r.path;
+            } else if (r.kind == Kind::Abort) {
+                out += "ABORT " + std::to_string(r.status) + ' ' + r.message;
+            } else {
+                out += "[Lua Error] " + r.message;
+            }
+            out += '\n';
+            return;
+
+        case Format::Ansi:
+            if (r.kind == Kind::Error) {
+                out += RED "[Lua Error]" RESET " " + r.message + "\n";
+                return;
+            }
+            out += BOLD "[\033[90m";
+            out += ts.day;
+            out += RESET WHITE ":" MAGENTA;
+            out += ts.clock;
+            out += RESET BOLD "]" RESET " ";
+            if (r.kind == Kind::Request) {
+                out += BOLD WHITE;
+                appendPadded(out, r.remoteIp, 16);
+                out += RESET " ";
+                out += colorForStatus(r.status) + std::to_string(r.status) + RESET " ";
+                out += colorForMethod(r.method) + r.method + RESET " ";
+                out += BLUE + r.path + RESET "\n";
+            } else {
+                out += BOLD RED "ABORT          " RESET;
+                std::string code = std::to_string(r.status);
+                out += colorForStatus(r.status);
+                if (code.size() < 4) out.append(4 - code.size(), ' ');
+                out += code + RESET " " BOLD RED + r.message + RESET "\n";
+            }
+            return;
+    }
+}
+
+// —————————————————————————————————————————————
+// Sink and rotation (writer thread only)
+// —————————————————————————————————————————————
+
+void AccessLog::openSink()
+{
+    sinkBytes = 0;
+    sinkOpened = SystemClock::now();
+    if (config.file.empty()) {
+        sink = stdout;
+        return;
+    }
+
+    std::error_code ec;
+    auto parent = std::filesystem::path(config.file).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+
+    sink = std::fopen(config.file.c_str(), "ab");
+    if (!sink) {
+        std::cerr << RED "[AccessLog]" RESET " cannot open " << config.file << ", logging to stdout\n";
+        sink = stdout;
+        return;
+    }
+    sinkBytes = std::filesystem::file_size(config.file, ec);
+}
+
+void AccessLog::rotate()
+{
+    std::fclose(sink);
+    sink = nullptr;
+
+    std::time_t now = SystemClock::to_time_t(SystemClock::now());
+    char stamp[32];
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", std::localtime(&now));
+
+    std::string target = config.file + "." + stamp;
+    std::error_code ec;
+    for (int n = 1; std::filesystem::exists(target, ec); ++n)
+        target = config.file + "." + stamp + "." + std::to_string(n);
+    std::filesystem::rename(config.file, target, ec);
+
+    rotations.fetch_add(1, std::memory_order_relaxed);
+    openSink();
+}
+
+void AccessLog::write(const std::string &batch)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!sink) openSink();
+
+    if (sink != stdout && sinkBytes > 0) {
+        bool full = config.maxBytes && sinkBytes + batch.size() > config.maxBytes;
+        bool old = config.rotateEvery.count() > 0 && SystemClock::now() - sinkOpened >= config.rotateEvery;
+        if (full || old) rotate();
+    }
+
+    std::fwrite(batch.data(), 1, batch.size(), sink);
+    std::fflush(sink);
+    sinkBytes += batch.size();
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+/// Asynchronous request/error log. Each logging thread owns a lock-free
+/// single-producer ring; one background writer drains every ring, formats
+/// the records and writes them in batches, rotating the file by size or age.
+/// A full ring drops the record rather than stall the request.
+class AccessLog
+{
+public:
+    enum class Format { Ansi, Plain, Json };
+
+    struct Config
+    {
+        Format format = Format::Ansi;
+        std::string file; // empty = stdout
+        uint64_t maxBytes = 0; // rotate past this size; 0 = never
+        std::chrono::seconds rotateEvery{0}; // rotate after this long; 0 = never
+        size_t ringCapacity = 8192; // records per thread, rounded up to a power of two
+        std::chrono::milliseconds flushInterval{50};
+    };
+
+    struct Stats
+    {
+        uint64_t written = 0;
+        uint64_t dropped = 0;
+        uint64_t rotations = 0;
+    };
+
+    static void configure(const Config &config);
+
+    static Config configuration();
+
+    static Stats stats();
+
+    static void request(int status, std::string_view method, std::string_view path, std::string_view remoteIp);
+
+    static void abort(int status, std::string_view message);
+
+    static void error(std::string_view message);
+
+    // Block until everything logged so far has been written.
+    static void flush();
+
+private:
+    using SystemClock = std::chrono::system_clock;
+
+    enum class Kind : uint8_t { Request, Abort, Error };
+
+    struct Record
+    {
+        Kind kind = Kind::Request;
+        int status = 0;
+        SystemClock::time_point time;
+        // Assigned in place so slot strings keep their capacity between uses.
+        std::string method;
+        std::string path;
+        std::string remoteIp;
+        std::string message;
+    };
+
+    struct Ring
+    {
+        explicit Ring(size_t capacity);
+
+        std::vector<Record> slots;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head{0}; // next slot the writer reads
+        alignas(64) std::atomic<size_t> tail{0}; // next slot the producer fills
+        std::atomic<uint64_t> dropped{0};
+    };
+
+    template<typename Fill>
+    static void push(Kind kind, Fill &&fill);
+
+    static Ring &localRing();
+
+    static void writerLoop();
+
+    static size_t drain(std::string &batch);
+
+    static void format(const Record &r, std::string &out, const Config &cfg);
+
+    static void write(const std::string &batch);
+
+    static void openSink();
+
+    static void rotate();
+
+    static std::mutex mutex; // config, ring registry and sink
+    static Config config;
+    static std::vector<std::shared_ptr<Ring> > rings;
+    static std::FILE *sink;
+    static uint64_t sinkBytes;
+    static SystemClock::time_point sinkOpened;
+
+    static std::once_flag started;
+    static std::condition_variable wake;
+    static std::atomic<uint64_t> flushRequests;
+    static std::atomic<uint64_t> flushesDone;
+    static std::atomic<uint64_t> written;
+    static std::atomic<uint64_t> droppedTotal;
+    static std::atomic<uint64_t> rotations;
+};
@@ -0,0 +1,204 @@
+#include "Async.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+extern "C"
+{
+#include "lauxlib.h"
+}
+
+// The coroutine resume() is currently running on this thread; only its own
+// frames may park. A parked operation travels back to resume() through
+// `parked`, and a finished one reaches the continuation through `completed`.
+static thread_local lua_State *running = nullptr;
+static thread_local Async::OperationPtr parked;
+static thread_local Async::Operation *completed = nullptr;
+
+
+static Async::Push runWork(const Async::Work &work)
+{
+    try {
+        return work();
+    } catch (const std::exception &e) {
+        std::string message = e.what();
+        return [message](lua_State *L) { return luaL_error(L, "%s", message.c_str()); };
+    }
+}
+
+static int continueAwait(lua_State *L, int, lua_KContext)
+{
+    Async::Operation *op = completed;
+    completed = nullptr;
+    int n = op->result ? op->result(L) : 0;
+    return op->k ? op->k(L, LUA_YIELD, op->ctx) : n;
+}
+
+int Async::await(lua_State *L, Work work, lua_KFunction k, lua_KContext ctx)
+{
+    if (L != running || !lua_isyieldable(L)) {
+        Push push = runWork(work);
+        int n = push ? push(L) : 0;
+        return k ? k(L, LUA_OK, ctx) : n;
+    }
+
+    parked = std::make_shared<Operation>();
+    parked->work = std::move(work);
+    parked->k = k;
+    parked->ctx = ctx;
+    return lua_yieldk(L, 0, 0, continueAwait);
+}
+
+int Async::sleep(lua_State *L, std::chrono::milliseconds delay)
+{
+    if (L != running || !lua_isyieldable(L)) {
+        std::this_thread::sleep_for(delay);
+        return 0;
+    }
+
+    parked = std::make_shared<Operation>();
+    parked->timer = true;
+    parked->delay = delay;
+    return lua_yieldk(L, 0, 0, continueAwait);
+}
+
+int Async::resume(lua_State *co, lua_State *from, int nargs, int *nres, OperationPtr &op)
+{
+    lua_State *outerRunning = running;
+    Operation *outerCompleted = completed;
+    running = co;
+    completed = op.get();
+
+    int status = lua_resume(co, from, nargs, nres);
+
+    running = outerRunning;
+    completed = outerCompleted;
+    op.reset();
+
+    if (status == LUA_YIELD) {
+        if (!parked) {
+            // A bare coroutine.yield() from the handler: nothing will wake it.
+            lua_pop(co, *nres);
+            lua_pushstring(co, "attempt to yield from a request handler outside an awaitable call");
+            return LUA_ERRRUN;
+        }
+        op = std::move(parked);
+    }
+    return status;
+}
+
+// —————————————————————————————————————————————
+// Blocking-work pool and timer
+// —————————————————————————————————————————————
+
+namespace
+{
+    struct IoPool
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()> > jobs;
+
+        IoPool()
+        {
+            for (size_t i = 0; i < Async::IO_THREADS; ++i)
+                std::thread([this] { run(); }).detach();
+        }
+
+        void post(std::function<void()> job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+            }
+            cv.notify_one();
+        }
+
+        [[noreturn]] void run()
+        {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return !jobs.empty(); });
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+    };
+
+    IoPool &ioPool()
+    {
+        static IoPool *pool = new IoPool(); // threads outlive static destruction
+        return *pool;
+    }
+
+    struct Timer
+    {
+        using Clock = std::chrono::steady_clock;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::multimap<Clock::time_point, std::function<void()> > due;
+
+        Timer() { std::thread([this] { run(); }).detach(); }
+
+        void after(std::chrono::milliseconds delay, std::function<void()> fn)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                due.emplace(Clock::now() + delay, std::move(fn));
+            }
+            cv.notify_one();
+        }
+
+        [[noreturn]] void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                if (due.empty()) {
+                    cv.wait(lock);
+                    continue;
+                }
+                auto first = due.begin();
+                if (first->first > Clock::now()) {
+                    cv.wait_until(lock, first->first);
+                    continue;
+                }
+                auto fn = std::move(first->second);
+                due.erase(first);
+                lock.unlock();
+                fn();
+                lock.lock();
+            }
+        }
+    };
+}
+
+void Async::start(OperationPtr op, std::function<void(OperationPtr)> ready)
+{
+    if (op->timer) {
+        static Timer *timer = new Timer(); // threads outlive static destruction
+        timer->after(op->delay, [op, ready = std::move(ready)] { ready(op); });
+        return;
+    }
+
+    ioPool().post([op, ready = std::move(ready)]
+    {
+        op->result = runWork(op->work);
+        op->work = nullptr;
+        ready(op);
+    });
+}
+
+void Async::run(std::function<void()> job)
+{
+    ioPool().post(std::move(job));
+}
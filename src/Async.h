@@ -0,0 +1,55 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+
+extern "C"
+{
+#include "lua.h"
+}
+
+
+/// Suspends the request coroutine while blocking work (outbound HTTP, DB
+/// queries, sleeps) runs on a small I/O pool or a timer, so the worker's
+/// lua_State serves other requests meanwhile. Outside a request coroutine,
+/// e.g. in hooks or at load time, the work simply runs inline.
+class Async
+{
+public:
+    // Runs on the Lua thread once the work is done; pushes the results.
+    using Push = std::function<int(lua_State *)>;
+    // Runs off the Lua thread and must not touch any lua_State.
+    using Work = std::function<Push()>;
+
+    struct Operation
+    {
+        Work work;
+        std::chrono::milliseconds delay{0}; // timer only: no work, just wait
+        bool timer = false;
+        Push result;
+        lua_KFunction k = nullptr;
+        lua_KContext ctx = 0;
+    };
+
+    using OperationPtr = std::shared_ptr<Operation>;
+
+    static constexpr size_t IO_THREADS = 16;
+
+    // Use as `return Async::await(L, ...)` from a lua_CFunction. Once the
+    // results are pushed, `k` (if any) continues with them on top.
+    static int await(lua_State *L, Work work, lua_KFunction k = nullptr, lua_KContext ctx = 0);
+
+    static int sleep(lua_State *L, std::chrono::milliseconds delay);
+
+    // Resume a request coroutine, feeding it `completed` if it was parked.
+    // LUA_YIELD means it is parked again on `completed`; anything else is final.
+    static int resume(lua_State *co, lua_State *from, int nargs, int *nres, OperationPtr &completed);
+
+    // Run a parked operation off the Lua thread; `ready` is called from the
+    // pool or timer thread and must hand it back to the owning worker.
+    static void start(OperationPtr op, std::function<void(OperationPtr)> ready);
+
+    // Run blocking `job` on the I/O pool when nothing waits for it (filling
+    // a cache off the event loop, say).
+    static void run(std::function<void()> job);
+};
@@ -0,0 +1,290 @@
+#include "Compression.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <stdexcept>
+
+std::mutex Compression::mutex;
+std::shared_ptr<const Compression::Config> Compression::config = std::make_shared<const Config>();
+std::unordered_map<std::string, Compression::Slot> Compression::entries;
+std::list<std::string> Compression::lru;
+size_t Compression::cachedBytes = 0;
+
+std::atomic<uint64_t> Compression::compressedCount{0};
+std::atomic<uint64_t> Compression::cacheHits{0};
+std::atomic<uint64_t> Compression::bytesIn{0};
+std::atomic<uint64_t> Compression::bytesOut{0};
+
+// A variant bigger than this share of the cache would only churn it.
+static constexpr size_t MAX_ENTRY_SHARE = 8;
+
+static char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+static bool iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (lower(a[i]) != lower(b[i])) return false;
+    return true;
+}
+
+static std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// qvalue = "0" ["." 0*3DIGIT] / "1" ["." 0*3"0"], in thousandths; anything
+// malformed counts as "not acceptable".
+static int parseQuality(std::string_view q)
+{
+    q = trim(q);
+    if (q.empty() || (q[0] != '0' && q[0] != '1')) return 0;
+    int value = (q[0] - '0') * 1000;
+    if (q.size() == 1) return value;
+    if (q[1] != '.' || q.size() > 5) return 0;
+    int scale = 100;
+    for (char c: q.substr(2)) {
+        if (c < '0' || c > '9') return 0;
+        value += (c - '0') * scale;
+        scale /= 10;
+    }
+    return value > 1000 ? 0 : value;
+}
+
+
+Compression::Stream::Stream(Encoding encoding, int level)
+    : z(std::make_unique<z_stream_s>())
+{
+    *z = {};
+    // 15 bits of window; +16 asks zlib for the gzip wrapper instead of its own.
+    int windowBits = encoding == Encoding::Gzip ? 15 + 16 : 15;
+    if (deflateInit2(z.get(), level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("zlib: deflateInit2 failed");
+    ++compressedCount;
+}
+
+Compression::Stream::~Stream()
+{
+    deflateEnd(z.get());
+}
+
+std::string Compression::Stream::write(std::string_view data)
+{
+    return run(data, Z_SYNC_FLUSH);
+}
+
+std::string Compression::Stream::finish(std::string_view data)
+{
+    return run(data, Z_FINISH);
+}
+
+std::string Compression::Stream::run(std::string_view data, int flush)
+{
+    bytesIn += data.size();
+    std::string out;
+    out.resize(deflateBound(z.get(), static_cast<uLong>(data.size())) + 16);
+    size_t used = 0;
+
+    // avail_in is 32 bits wide; feed very large bodies in slices.
+    constexpr size_t SLICE = size_t(1) << 30;
+    do {
+        size_t n = std::min(data.size(), SLICE);
+        z->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+        z->avail_in = static_cast<uInt>(n);
+        data.remove_prefix(n);
+        int mode = data.empty() ? flush : Z_NO_FLUSH;
+
+        int rc;
+        do {
+            if (used == out.size()) out.resize(out.size() * 2);
+            z->next_out = reinterpret_cast<Bytef *>(out.data() + used);
+            z->avail_out = static_cast<uInt>(std::min(out.size() - used, SLICE));
+            rc = deflate(z.get(), mode);
+            if (rc == Z_STREAM_ERROR) throw std::runtime_error("zlib: deflate failed");
+            used = reinterpret_cast<char *>(z->next_out) - out.data();
+        } while (z->avail_out == 0 || z->avail_in > 0 || (mode == Z_FINISH && rc != Z_STREAM_END));
+    } while (!data.empty());
+
+    out.resize(used);
+    bytesOut += used;
+    return out;
+}
+
+// —————————————————————————————————————————————
+// Configuration and negotiation
+// —————————————————————————————————————————————
+
+void Compression::configure(const Config &next)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    config = std::make_shared<const Config>(next);
+    evict(next.cacheBytes);
+}
+
+Compression::Config Compression::configuration()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return *config;
+}
+
+Compression::Stats Compression::stats()
+{
+    Stats st;
+    st.compressed = compressedCount.load();
+    st.cacheHits = cacheHits.load();
+    st.bytesIn = bytesIn.load();
+    st.bytesOut = bytesOut.load();
+    std::lock_guard<std::mutex> lock(mutex);
+    st.cachedBytes = cachedBytes;
+    return st;
+}
+
+int Compression::level()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return config->level;
+}
+
+bool Compression::keeps(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return bytes <= config->cacheBytes / MAX_ENTRY_SHARE;
+}
+
+bool Compression::compressible(std::string_view contentType, uint64_t size)
+{
+    std::shared_ptr<const Config> cfg;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cfg = config;
+    }
+    if (!cfg->enabled || (size != UINT64_MAX && size < cfg->minSize)) return false;
+
+    contentType = trim(contentType.substr(0, contentType.find(';')));
+    for (const std::string &type: cfg->types) {
+        if (contentType.size() >= type.size() && iequals(contentType.substr(0, type.size()), type)) return true;
+    }
+    return false;
+}
+
+// gzip wins a tie: every client that takes deflate takes it too, and some
+// historically mishandled deflate's zlib framing.
+Compression::Encoding Compression::negotiate(std::string_view header)
+{
+    int gzip = -1, deflate = -1, any = -1;
+    while (!header.empty()) {
+        size_t comma = header.find(',');
+        std::string_view item = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+
+        size_t semi = item.find(';');
+        std::string_view coding = trim(item.substr(0, semi));
+        int q = 1000;
+        while (semi != std::string_view::npos) {
+            item.remove_prefix(semi + 1);
+            semi = item.find(';');
+            std::string_view param = trim(item.substr(0, semi));
+            if (param.size() >= 2 && lower(param[0]) == 'q' && param[1] == '=') q = parseQuality(param.substr(2));
+        }
+
+        if (iequals(coding, "gzip") || iequals(coding, "x-gzip")) gzip = std::max(gzip, q);
+        else if (iequals(coding, "deflate")) deflate = std::max(deflate, q);
+        else if (coding == "*") any = q;
+    }
+    if (gzip < 0) gzip = any;
+    if (deflate < 0) deflate = any;
+
+    if (gzip > 0 && gzip >= deflate) return Encoding::Gzip;
+    if (deflate > 0) return Encoding::Deflate;
+    return Encoding::Identity;
+}
+
+const char *Compression::name(Encoding encoding)
+{
+    switch (encoding) {
+        case Encoding::Gzip: return "gzip";
+        case Encoding::Deflate: return "deflate";
+        default: return "identity";
+    }
+}
+
+// —————————————————————————————————————————————
+// Compressing, and the variant cache
+// —————————————————————————————————————————————
+
+std::string Compression::compress(std::string_view data, Encoding encoding)
+{
+    Stream stream(encoding, level());
+    return stream.finish(data);
+}
+
+static std::string slotKey(const std::string &key, Compression::Encoding encoding)
+{
+    std::string slot = key;
+    slot += '\n';
+    slot += Compression::name(encoding);
+    return slot;
+}
+
+std::shared_ptr<const std::string> Compression::find(const std::string &key, std::string_view version,
+                                                     Encoding encoding)
+{
+    std::string slot = slotKey(key, encoding);
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(slot);
+    if (it == entries.end() || it->second.version != version) return nullptr;
+    lru.splice(lru.begin(), lru, it->second.lru);
+    ++compressedCount;
+    ++cacheHits;
+    return it->second.data;
+}
+
+std::shared_ptr<const std::string> Compression::cached(const std::string &key, std::string_view version,
+                                                       Encoding encoding, std::string_view data)
+{
+    if (auto hit = find(key, version, encoding)) return hit;
+    std::string slot = slotKey(key, encoding);
+
+    // Two threads missing at once both compress; the later one is kept.
+    auto out = std::make_shared<const std::string>(compress(data, encoding));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto it = entries.find(slot); it != entries.end()) {
+        cachedBytes -= it->second.data->size();
+        lru.erase(it->second.lru);
+        entries.erase(it);
+    }
+    if (out->size() <= config->cacheBytes / MAX_ENTRY_SHARE) {
+        lru.push_front(slot);
+        entries.emplace(std::move(slot), Slot{std::string(version), out, lru.begin()});
+        cachedBytes += out->size();
+        evict(config->cacheBytes);
+    }
+    return out;
+}
+
+std::string Compression::contentVersion(std::string_view data)
+{
+    char tag[40];
+    std::snprintf(tag, sizeof(tag), "%zx-%zx", data.size(), std::hash<std::string_view>{}(data));
+    return tag;
+}
+
+// Called with the lock held.
+void Compression::evict(size_t limit)
+{
+    while (cachedBytes > limit && !lru.empty()) {
+        auto it = entries.find(lru.back());
+        cachedBytes -= it->second.data->size();
+        entries.erase(it);
+        lru.pop_back();
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct z_stream_s;
+
+
+/// Content-Encoding for responses: Accept-Encoding negotiation, zlib
+/// deflate in gzip or zlib framing, and a size-bounded LRU of compressed
+/// variants so hot static files and cacheable responses are compressed
+/// once rather than per request. Configured from app.compression_config.
+class Compression
+{
+public:
+    enum class Encoding { Identity, Gzip, Deflate };
+
+    struct Config
+    {
+        bool enabled = true;
+        size_t minSize = 1024; // smaller bodies go out as they are
+        int level = 6; // zlib level: 1 is fastest, 9 smallest
+        std::vector<std::string> types{
+            "text/", "application/json", "application/javascript", "application/xml",
+            "application/xhtml+xml", "image/svg+xml", "application/wasm"
+        }; // Content-Type prefixes worth compressing
+        size_t cacheBytes = 32 * 1024 * 1024; // compressed variants kept; 0 = no cache
+    };
+
+    struct Stats
+    {
+        uint64_t compressed = 0; // responses sent compressed
+        uint64_t cacheHits = 0;
+        uint64_t bytesIn = 0; // before compression, cache hits excluded
+        uint64_t bytesOut = 0;
+        size_t cachedBytes = 0;
+    };
+
+    /// One compressed body produced piece by piece. Every write() is flushed
+    /// to a byte boundary, so what it returns can be sent right away.
+    class Stream
+    {
+    public:
+        Stream(Encoding encoding, int level);
+
+        ~Stream();
+
+        Stream(const Stream &) = delete;
+
+        Stream &operator=(const Stream &) = delete;
+
+        std::string write(std::string_view data);
+
+        // The last of the data and the end of the stream (the gzip trailer,
+        // say); nothing may follow.
+        std::string finish(std::string_view data = {});
+
+    private:
+        std::string run(std::string_view data, int flush);
+
+        std::unique_ptr<z_stream_s> z;
+    };
+
+    static void configure(const Config &config);
+
+    static Config configuration();
+
+    static Stats stats();
+
+    // Whether `contentType` is on the allowlist and `size` is worth it
+    // (an unknown size, for a streamed body, always is).
+    static bool compressible(std::string_view contentType, uint64_t size = UINT64_MAX);
+
+    // The client's preferred encoding we can produce; Identity if none.
+    static Encoding negotiate(std::string_view acceptEncoding);
+
+    // The value for Content-Encoding.
+    static const char *name(Encoding encoding);
+
+    static int level();
+
+    // Whether a variant of `bytes` would be kept by cached().
+    static bool keeps(size_t bytes);
+
+    // `data` compressed in one go.
+    static std::string compress(std::string_view data, Encoding encoding);
+
+    // The variant cached for `key` at `version`, if there is one.
+    static std::shared_ptr<const std::string> find(const std::string &key, std::string_view version,
+                                                   Encoding encoding);
+
+    // `data` compressed, from the cache when `key` was last compressed at
+    // the same `version`; the variant is kept if it fits.
+    static std::shared_ptr<const std::string> cached(const std::string &key, std::string_view version,
+                                                     Encoding encoding, std::string_view data);
+
+    // Cache key version for a body that has no validator of its own.
+    static std::string contentVersion(std::string_view data);
+
+private:
+    struct Slot
+    {
+        std::string version;
+        std::shared_ptr<const std::string> data;
+        std::list<std::string>::iterator lru;
+    };
+
+    static void evict(size_t limit);
+
+    static std::mutex mutex;
+    static std::shared_ptr<const Config> config;
+    static std::unordered_map<std::string, Slot> entries;
+    static std::list<std::string> lru; // most recently used first
+    static size_t cachedBytes;
+
+    static std::atomic<uint64_t> compressedCount;
+    static std::atomic<uint64_t> cacheHits;
+    static std::atomic<uint64_t> bytesIn;
+    static std::atomic<uint64_t> bytesOut;
+};
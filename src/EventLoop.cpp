@@ -0,0 +1,1236 @@
+#include "EventLoop.h"
+#include "Server.h"
+#include "Tls.h"
+
+#include <atomic>
+
+struct EventLoop::Counters
+{
+    std::atomic<uint64_t> open{0};
+    std::atomic<uint64_t> handshake{0}, header{0}, body{0}, idle{0}, write{0};
+    std::atomic<uint64_t> tooLarge{0};
+    std::atomic<uint64_t> requestLimit{0};
+};
+
+EventLoop::Counters EventLoop::counters;
+
+EventLoop::Stats EventLoop::stats()
+{
+    Stats st;
+    st.open = counters.open.load();
+    st.handshakeTimeouts = counters.handshake.load();
+    st.headerTimeouts = counters.header.load();
+    st.bodyTimeouts = counters.body.load();
+    st.idleTimeouts = counters.idle.load();
+    st.writeTimeouts = counters.write.load();
+    st.headersTooLarge = counters.tooLarge.load();
+    st.requestLimit = counters.requestLimit.load();
+    return st;
+}
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef LUMENITE_IO_URING
+#include "IoUring.h"
+#include <poll.h>
+#endif
+
+static constexpr int MAX_EVENTS = 256;
+static constexpr size_t READ_CHUNK = 16 * 1024;
+// Cap per sendfile() call so one large download cannot monopolise the loop.
+static constexpr size_t SENDFILE_CHUNK = 1024 * 1024;
+// Byte segments gathered into one sendmsg(); well under IOV_MAX.
+static constexpr size_t MAX_IOV = 64;
+// Framed-ahead requests per connection; the rest wait unparsed in `in`.
+static constexpr size_t MAX_PIPELINE = 32;
+// Responses to a pipeline are held for one write up to this many bytes.
+static constexpr size_t COALESCE_LIMIT = 64 * 1024;
+// Completion batches taken per wakeup before the loop goes back to its sockets.
+static constexpr int DRAIN_ROUNDS = 4;
+// TLS output staged per SSL_write: four full records.
+static constexpr size_t STAGE_LIMIT = 64 * 1024;
+
+static constexpr auto BAD_REQUEST_RESPONSE =
+        "HTTP/1.1 400 Bad Request\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: 24\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "<h1>400 Bad Request</h1>";
+
+static constexpr auto HEAD_TOO_LARGE_RESPONSE =
+        "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: 46\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "<h1>431 Request Header Fields Too Large</h1>";
+
+
+// io_uring backend
+static constexpr unsigned RING_ENTRIES = 1024;
+static constexpr unsigned RING_COMPLETIONS = 16384; // multishot receives post many per submission
+static constexpr unsigned RECV_BUFFERS = 512; // shared by the loop's connections; a power of two
+static constexpr uint16_t RECV_GROUP = 0;
+
+#ifdef LUMENITE_IO_URING
+
+// user_data: a RingIo pointer with the operation in its low bits, or one
+// of the loop-wide operations on its own.
+enum : uint64_t { OP_RECV = 1, OP_SEND, OP_POLL_OUT, OP_CLOSE, OP_CANCEL, OP_MASK = 7 };
+static constexpr uint64_t ACCEPT_DATA = 1;
+static constexpr uint64_t WAKE_DATA = 2;
+static constexpr uint64_t TICK_DATA = 3;
+
+// A connection's side of the ring. It keeps the connection, and whatever a
+// send still points into, alive until the last of its operations completes.
+struct alignas(8) RingIo
+{
+    ConnectionPtr conn;
+    unsigned ops = 0; // submitted and not yet completed for the last time
+    bool receiving = false;
+    bool sending = false; // one send at a time, described by `msg`
+    bool pollingOut = false; // a file hit a full socket; sendfile() resumes on POLLOUT
+    bool closeQueued = false; // the close is submitted, linked behind a send or a cancel
+    bool fdClosed = false;
+    std::deque<OutSegment> held; // the in-flight send's buffers, once the connection is closed
+    msghdr msg{};
+    iovec iov[MAX_IOV];
+
+    uint64_t data(uint64_t op) { return reinterpret_cast<uint64_t>(this) | op; }
+};
+
+struct EventLoop::Ring
+{
+    IoUring uring{RING_ENTRIES, RING_COMPLETIONS};
+    std::unordered_map<Connection *, std::unique_ptr<RingIo> > io;
+};
+
+#else
+
+struct EventLoop::Ring
+{
+};
+
+#endif
+
+
+EventLoop::EventLoop(int listenFd, Dispatch dispatch, Backend backend, ConnectionLimits limits)
+    : listenFd_(listenFd), dispatch_(std::move(dispatch)), limits_(limits)
+{
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    // Deadlines are checked once a tick, whichever backend waits.
+    tickFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec every{};
+    every.it_interval.tv_sec = every.it_value.tv_sec = TICK.count();
+    timerfd_settime(tickFd_, 0, &every, nullptr);
+
+    static std::once_flag warned;
+    if (backend == Backend::IoUring) {
+#ifdef LUMENITE_IO_URING
+        try {
+            ring_ = std::make_unique<Ring>();
+            return;
+        } catch (const std::exception &e) {
+            std::string reason = e.what();
+            std::call_once(warned, [&]
+            {
+                std::cerr << "\033[33m[Server]\033[0m io_uring unavailable (" << reason << "), using epoll\n";
+            });
+        }
+#else
+        std::call_once(warned, []
+        {
+            std::cerr << "\033[33m[Server]\033[0m built without io_uring support, using epoll\n";
+        });
+#endif
+    }
+    watch();
+}
+
+void EventLoop::watch()
+{
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = wakeFd_;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, wakeFd_, &ev);
+    ev.data.fd = tickFd_;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, tickFd_, &ev);
+
+    // Every loop watches the shared listener; EPOLLEXCLUSIVE wakes only one
+    // of them per incoming connection instead of the whole herd.
+    ev.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+    ev.data.fd = listenFd_;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, listenFd_, &ev);
+}
+
+EventLoop::~EventLoop()
+{
+    for (auto &[fd, conn]: conns_) close(fd);
+    if (wakeFd_ >= 0) close(wakeFd_);
+    if (tickFd_ >= 0) close(tickFd_);
+    if (epfd_ >= 0) close(epfd_);
+}
+
+void EventLoop::run()
+{
+    if (ring_) runRing();
+
+    epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        int n = epoll_wait(epfd_, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "\033[31m[Server]\033[0m epoll_wait failed: " << std::strerror(errno) << "\n";
+            continue;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t what = events[i].events;
+
+            if (fd == listenFd_) {
+                acceptAll();
+                continue;
+            }
+            if (fd == wakeFd_) {
+                uint64_t v;
+                while (read(wakeFd_, &v, sizeof(v)) > 0) {
+                }
+                drainCompletions();
+                continue;
+            }
+            if (fd == tickFd_) {
+                uint64_t v;
+                while (read(tickFd_, &v, sizeof(v)) > 0) {
+                }
+                expire();
+                continue;
+            }
+
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) continue;
+            ConnectionPtr conn = it->second;
+
+            if (what & (EPOLLERR | EPOLLHUP)) {
+                closeConnection(conn);
+                continue;
+            }
+            // Either readiness may be what the handshake was waiting for.
+            if (conn->handshaking) {
+                if (handshake(conn)) onReadable(conn);
+            } else {
+                bool open = true;
+                if (what & EPOLLOUT) {
+                    open = flush(conn);
+                    if (conn->readWantsWrite) what |= EPOLLIN;
+                }
+                if (open && (what & EPOLLIN)) onReadable(conn);
+            }
+            arm(conn);
+        }
+    }
+}
+
+void EventLoop::acceptAll()
+{
+    while (true) {
+        sockaddr_in ca{};
+        socklen_t len = sizeof(ca);
+        int fd = accept4(listenFd_, (sockaddr *) &ca, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return; // EAGAIN, or out of descriptors until someone closes
+        }
+
+        char ipb[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &ca.sin_addr, ipb, sizeof(ipb));
+        ConnectionPtr conn = adopt(fd, ipb);
+        if (!conn) continue;
+
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        conns_[fd] = conn;
+        ++counters.open;
+        arm(conn);
+    }
+}
+
+// A new connection's state; null (and `fd` closed) if TLS cannot start.
+ConnectionPtr EventLoop::adopt(int fd, std::string remoteIp)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    auto conn = std::make_shared<Connection>();
+    conn->fd = fd;
+    conn->loop = this;
+    conn->remoteIp = std::move(remoteIp);
+    conn->parser = HttpParser(limits_.maxHeaderBytes);
+    if (Tls::context()) {
+        conn->ssl = Tls::accept(fd);
+        if (!conn->ssl) {
+            close(fd);
+            return nullptr;
+        }
+        conn->handshaking = true;
+    }
+    return conn;
+}
+
+// Move the handshake along; true once it is done. The client's first
+// request may already sit decrypted in the session by then, with no edge
+// left to announce it, so the caller reads straight away.
+bool EventLoop::handshake(const ConnectionPtr &conn)
+{
+    int rc = SSL_do_handshake(conn->ssl);
+    if (rc == 1) {
+        conn->handshaking = false;
+        return true;
+    }
+    int err = SSL_get_error(conn->ssl, rc);
+    if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+        ERR_clear_error();
+        conn->tlsFailed = true;
+        closeConnection(conn);
+    }
+    return false;
+}
+
+// recv() semantics over either transport: bytes, 0 at the end of the
+// stream, or -1 with errno (EAGAIN when it would block).
+long EventLoop::receive(const ConnectionPtr &conn, char *buf, size_t len)
+{
+    if (!conn->ssl) return recv(conn->fd, buf, len, 0);
+
+    conn->readWantsWrite = false;
+    int n = SSL_read(conn->ssl, buf, static_cast<int>(std::min<size_t>(len, INT_MAX)));
+    if (n > 0) return n;
+    switch (SSL_get_error(conn->ssl, n)) {
+        case SSL_ERROR_WANT_WRITE:
+            conn->readWantsWrite = true;
+            [[fallthrough]];
+        case SSL_ERROR_WANT_READ:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        default:
+            ERR_clear_error();
+            conn->tlsFailed = true;
+            errno = ECONNRESET;
+            return -1;
+    }
+}
+
+void EventLoop::onReadable(const ConnectionPtr &conn)
+{
+    bool peerClosed = false;
+
+    // Edge-triggered: drain the socket completely or we never hear of it again.
+    while (true) {
+        size_t old = conn->in.size();
+        conn->in.resize(old + READ_CHUNK);
+        long n = receive(conn, conn->in.data() + old, READ_CHUNK);
+        if (n > 0) {
+            conn->in.resize(old + (size_t) n);
+            continue;
+        }
+        conn->in.resize(old);
+        if (n == 0) {
+            peerClosed = true;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) peerClosed = true;
+        break;
+    }
+    received(conn, peerClosed);
+}
+
+// New bytes are in `in`, or the peer is done sending.
+void EventLoop::received(const ConnectionPtr &conn, bool peerClosed)
+{
+    if (conn->upgrade) {
+        conn->upgrade->receive(conn->in);
+        if (peerClosed) closeConnection(conn);
+        return;
+    }
+
+    // A half-closed peer may still be owed a response for what it already sent.
+    if (peerClosed) conn->closeAfterWrite = true;
+
+    tryDispatch(conn);
+
+    if (peerClosed && !conn->busy && conn->out.empty() && conn->staged.empty()) closeConnection(conn);
+}
+
+void EventLoop::parsePipeline(const ConnectionPtr &conn)
+{
+    while (conn->reject == Connection::Reject::None && conn->pipeline.size() < MAX_PIPELINE && !conn->in.empty()) {
+        switch (conn->parser.feed(conn->in)) {
+            case ParseResult::Incomplete:
+                return;
+            case ParseResult::TooLarge:
+                conn->headTooLarge = true;
+                ++counters.tooLarge;
+                [[fallthrough]];
+            case ParseResult::Invalid:
+                conn->in.clear();
+                conn->parser.reset();
+                conn->reject = Connection::Reject::Pending;
+                return;
+            case ParseResult::Complete:
+                break;
+        }
+        HttpRequest &req = conn->pipeline.emplace_back();
+        conn->parser.take(conn->in, conn->remoteIp, req);
+        if (limits_.maxRequests && ++conn->requests >= limits_.maxRequests) {
+            // Its response closes the connection, so nothing after it is framed.
+            req.lastOnConnection = true;
+            conn->reject = Connection::Reject::Sent;
+            ++counters.requestLimit;
+            return;
+        }
+        // What follows an upgrade request is not HTTP, if it is accepted.
+        if (!req.header("Upgrade").empty()) return;
+    }
+}
+
+void EventLoop::tryDispatch(const ConnectionPtr &conn)
+{
+    if (conn->busy || conn->closed) return;
+
+    parsePipeline(conn);
+
+    if (!conn->pipeline.empty()) {
+        HttpRequest req = std::move(conn->pipeline.front());
+        conn->pipeline.pop_front();
+        conn->busy = true;
+        dispatch_(conn, std::move(req));
+        return;
+    }
+
+    if (conn->reject == Connection::Reject::Pending) {
+        conn->reject = Connection::Reject::Sent;
+        conn->out.push_back({conn->headTooLarge ? HEAD_TOO_LARGE_RESPONSE : BAD_REQUEST_RESPONSE});
+        conn->closeAfterWrite = true;
+        flush(conn);
+    }
+}
+
+static size_t pendingBytes(const Connection &conn)
+{
+    size_t n = conn.staged.size() - conn.stagedOff;
+    for (auto &s: conn.out) {
+        if (s.file) return COALESCE_LIMIT; // never hold a file back
+        n += s.data().size() - s.offset;
+    }
+    return n;
+}
+
+bool EventLoop::flush(const ConnectionPtr &conn)
+{
+    if (ring_) return flushRing(conn);
+    if (conn->ssl) return flushTls(conn);
+
+    while (!conn->out.empty()) {
+        OutSegment &seg = conn->out.front();
+        if (seg.done()) {
+            conn->out.pop_front();
+            continue;
+        }
+
+        ssize_t n;
+        if (seg.file) {
+            auto off = static_cast<off_t>(seg.offset);
+            n = sendfile(conn->fd, seg.file->fd, &off, std::min<uint64_t>(seg.end - seg.offset, SENDFILE_CHUNK));
+            if (n == 0) {
+                // The file shrank under us; the promised length can no longer be met.
+                closeConnection(conn);
+                return false;
+            }
+            if (n > 0) {
+                seg.offset += (uint64_t) n;
+                conn->sent += (uint64_t) n;
+                continue;
+            }
+        } else {
+            // Gather the run of byte segments (head, body, next response...)
+            // into one call; hold the packet open if file data follows.
+            iovec iov[MAX_IOV];
+            size_t count = 0;
+            bool fileNext = false;
+            for (auto &s: conn->out) {
+                if (s.file) {
+                    fileNext = true;
+                    break;
+                }
+                if (count == MAX_IOV) break;
+                if (s.done()) continue;
+                std::string_view bytes = s.data();
+                iov[count].iov_base = const_cast<char *>(bytes.data()) + s.offset;
+                iov[count].iov_len = bytes.size() - s.offset;
+                ++count;
+            }
+
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | (fileNext ? MSG_MORE : 0));
+            if (n > 0) {
+                // Retire what was written; the last segment may be partial.
+                conn->sent += (uint64_t) n;
+                size_t left = (size_t) n;
+                for (auto it = conn->out.begin(); left > 0; ++it) {
+                    size_t used = std::min<size_t>(it->data().size() - it->offset, left);
+                    it->offset += used;
+                    left -= used;
+                }
+                continue;
+            }
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true; // wait for EPOLLOUT
+        closeConnection(conn);
+        return false;
+    }
+
+    if (conn->closeAfterWrite && !conn->busy) {
+        closeConnection(conn);
+        return false;
+    }
+    pullPiece(conn);
+    return true;
+}
+
+// TLS has no gathered write. Consecutive segments are copied into one
+// staging buffer instead, so each SSL_write() fills whole records, and a
+// write that has to be retried is handed the very same bytes. With kernel
+// TLS a file still goes out by sendfile(); otherwise it is read in here.
+bool EventLoop::flushTls(const ConnectionPtr &conn)
+{
+    while (true) {
+        if (conn->staged.empty()) {
+            while (!conn->out.empty() && conn->out.front().done()) conn->out.pop_front();
+            if (conn->out.empty()) break;
+
+            OutSegment &seg = conn->out.front();
+            if (seg.file && Tls::kernelSend(conn->ssl)) {
+                ossl_ssize_t n = SSL_sendfile(conn->ssl, seg.file->fd, static_cast<off_t>(seg.offset),
+                                              std::min<uint64_t>(seg.end - seg.offset, SENDFILE_CHUNK), 0);
+                if (n > 0) {
+                    seg.offset += static_cast<uint64_t>(n);
+                    conn->sent += static_cast<uint64_t>(n);
+                    continue;
+                }
+                int err = SSL_get_error(conn->ssl, static_cast<int>(n));
+                if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) return true;
+                ERR_clear_error();
+                conn->tlsFailed = true;
+                closeConnection(conn);
+                return false;
+            }
+            if (!stage(conn)) return false;
+        }
+
+        int n = SSL_write(conn->ssl, conn->staged.data() + conn->stagedOff,
+                          static_cast<int>(conn->staged.size() - conn->stagedOff));
+        if (n > 0) {
+            conn->stagedOff += static_cast<size_t>(n);
+            conn->sent += static_cast<uint64_t>(n);
+            if (conn->stagedOff == conn->staged.size()) {
+                conn->staged.clear();
+                conn->stagedOff = 0;
+            }
+            continue;
+        }
+        int err = SSL_get_error(conn->ssl, n);
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) return true; // wait for EPOLLOUT
+        ERR_clear_error();
+        conn->tlsFailed = true;
+        closeConnection(conn);
+        return false;
+    }
+
+    if (conn->closeAfterWrite && !conn->busy) {
+        closeConnection(conn);
+        return false;
+    }
+    pullPiece(conn);
+    return true;
+}
+
+// Move up to STAGE_LIMIT bytes from the front of `out` into `staged`.
+bool EventLoop::stage(const ConnectionPtr &conn)
+{
+    while (!conn->out.empty() && conn->staged.size() < STAGE_LIMIT) {
+        OutSegment &seg = conn->out.front();
+        size_t room = STAGE_LIMIT - conn->staged.size();
+        if (seg.file && Tls::kernelSend(conn->ssl)) break; // SSL_sendfile() takes it from here
+        if (seg.file) {
+            size_t want = std::min<uint64_t>(seg.end - seg.offset, room);
+            size_t old = conn->staged.size();
+            conn->staged.resize(old + want);
+            long n = FileCache::readAt(*seg.file, conn->staged.data() + old, want, seg.offset);
+            if (n <= 0) {
+                // The file shrank under us; the promised length can no longer be met.
+                closeConnection(conn);
+                return false;
+            }
+            conn->staged.resize(old + static_cast<size_t>(n));
+            seg.offset += static_cast<uint64_t>(n);
+        } else if (!seg.shared && seg.offset == 0 && seg.bytes.size() <= room && conn->staged.empty()) {
+            conn->staged = std::move(seg.bytes);
+            seg.bytes.clear();
+        } else {
+            std::string_view bytes = seg.data();
+            size_t take = std::min<size_t>(bytes.size() - seg.offset, room);
+            conn->staged.append(bytes.substr(seg.offset, take));
+            seg.offset += take;
+        }
+        if (seg.done()) conn->out.pop_front();
+    }
+    return true;
+}
+
+// Ask for the next piece of a streamed body once the socket has room for it,
+// so a long body never piles up in `out`.
+void EventLoop::pullPiece(const ConnectionPtr &conn)
+{
+    if (!conn->stream || conn->pulling || pendingBytes(*conn) >= COALESCE_LIMIT) return;
+    conn->pulling = true;
+    conn->stream->next([conn](std::string &&piece, bool last)
+    {
+        EventLoop *loop = conn->loop;
+        {
+            std::lock_guard<std::mutex> lock(loop->completionMutex_);
+            WireResponse response;
+            response.body = std::move(piece);
+            loop->completions_.push_back({conn, std::move(response), true, false, last});
+        }
+        loop->wake();
+    });
+}
+
+// The response on the wire is complete: move on to the next request.
+void EventLoop::finishResponse(const ConnectionPtr &conn, bool keepAlive)
+{
+    conn->busy = false;
+    if (!keepAlive) {
+        // Nothing after a closing response is answered.
+        conn->closeAfterWrite = true;
+        conn->pipeline.clear();
+        conn->reject = Connection::Reject::Sent;
+    }
+
+    // Start the next pipelined request first. If it is answered before
+    // this turn of the loop ends, both responses go out in one write, up
+    // to COALESCE_LIMIT; drainCompletions flushes whatever is held.
+    tryDispatch(conn);
+    if (conn->closed) return;
+    if (conn->busy && pendingBytes(*conn) < COALESCE_LIMIT) {
+        held_.push_back(conn);
+        return;
+    }
+    flush(conn);
+}
+
+void EventLoop::closeConnection(const ConnectionPtr &conn)
+{
+    if (conn->closed) return;
+    conn->closed = true;
+    --counters.open;
+    timers_.cancel(conn);
+    conn->deadline = Connection::Deadline::None;
+#ifdef LUMENITE_IO_URING
+    // The kernel may still be reading what the send in flight points at.
+    if (conn->ringIo && conn->ringIo->sending) conn->ringIo->held.swap(conn->out);
+#endif
+    conn->out.clear(); // release any file still being streamed
+    if (conn->ssl) {
+        // Best effort: a close_notify only if the socket takes it now.
+        if (!conn->tlsFailed && !conn->handshaking) SSL_shutdown(conn->ssl);
+        ERR_clear_error();
+        SSL_free(conn->ssl);
+        conn->ssl = nullptr;
+    }
+    // A piece on its way is stopped when it arrives; otherwise stop now.
+    if (conn->stream && !conn->pulling) {
+        conn->stream->stop();
+        conn->stream.reset();
+    }
+    if (conn->upgrade) {
+        auto upgrade = std::move(conn->upgrade);
+        upgrade->closed();
+    }
+#ifdef LUMENITE_IO_URING
+    if (RingIo *io = conn->ringIo) {
+        // The RingIo goes once its last operation has completed.
+        if (!io->fdClosed && !io->closeQueued) queueClose(*io);
+        return;
+    }
+#endif
+    epoll_ctl(epfd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    close(conn->fd);
+    conns_.erase(conn->fd);
+}
+
+void EventLoop::wake()
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto r = write(wakeFd_, &one, sizeof(one));
+}
+
+void EventLoop::complete(const ConnectionPtr &conn, WireResponse &&response)
+{
+    {
+        std::lock_guard<std::mutex> lock(completionMutex_);
+        completions_.push_back({conn, std::move(response)});
+    }
+    wake();
+}
+
+void EventLoop::send(const ConnectionPtr &conn, std::string &&bytes, bool closeAfter)
+{
+    {
+        std::lock_guard<std::mutex> lock(completionMutex_);
+        Completion c{conn};
+        c.response.body = std::move(bytes);
+        c.raw = true;
+        c.last = closeAfter;
+        completions_.push_back(std::move(c));
+    }
+    wake();
+}
+
+void EventLoop::send(const std::vector<ConnectionPtr> &conns, const std::shared_ptr<const std::string> &bytes)
+{
+    std::vector<ConnectionPtr> byLoop(conns);
+    std::sort(byLoop.begin(), byLoop.end(),
+              [](const ConnectionPtr &a, const ConnectionPtr &b) { return a->loop < b->loop; });
+
+    for (size_t i = 0; i < byLoop.size();) {
+        EventLoop *loop = byLoop[i]->loop;
+        {
+            std::lock_guard<std::mutex> lock(loop->completionMutex_);
+            for (; i < byLoop.size() && byLoop[i]->loop == loop; ++i) {
+                Completion c{byLoop[i]};
+                c.raw = true;
+                c.shared = bytes;
+                loop->completions_.push_back(std::move(c));
+            }
+        }
+        loop->wake();
+    }
+}
+
+void EventLoop::drainCompletions()
+{
+    // Whatever is answered while a batch is handled (a pipelined static
+    // file, say) is taken in the same turn, so its response can share the
+    // write of the one before it.
+    std::vector<ConnectionPtr> touched;
+    for (int round = 0; round < DRAIN_ROUNDS; ++round) {
+        std::vector<Completion> ready;
+        {
+            std::lock_guard<std::mutex> lock(completionMutex_);
+            ready.swap(completions_);
+        }
+        if (ready.empty()) break;
+
+        for (auto &c: ready) {
+            touched.push_back(c.conn);
+            auto &conn = c.conn;
+            auto &res = c.response;
+
+            if (c.raw) {
+                if (conn->closed) continue;
+                if (c.shared) conn->out.push_back({{}, nullptr, 0, 0, std::move(c.shared)});
+                else if (!res.body.empty()) conn->out.push_back({std::move(res.body)});
+                if (c.last) conn->closeAfterWrite = true;
+                if (pendingBytes(*conn) > MAX_UPGRADED_BACKLOG) {
+                    closeConnection(conn); // the peer is not keeping up
+                    continue;
+                }
+                flush(conn);
+                continue;
+            }
+
+            if (c.piece) {
+                conn->pulling = false;
+                if (conn->closed) {
+                    if (!c.last) conn->stream->stop();
+                    conn->stream.reset();
+                    continue;
+                }
+                // An empty last piece means the body broke off mid-way.
+                bool brokeOff = c.last && res.body.empty();
+                if (!res.body.empty()) conn->out.push_back({std::move(res.body)});
+                if (c.last) {
+                    conn->stream.reset();
+                    finishResponse(conn, conn->streamKeepAlive && !brokeOff);
+                } else {
+                    flush(conn);
+                }
+                continue;
+            }
+
+            if (conn->closed) {
+                conn->busy = false;
+                if (res.stream) res.stream->stop();
+                if (res.upgrade) res.upgrade->closed();
+                continue;
+            }
+
+            conn->out.push_back({std::move(res.head)});
+            if (!res.body.empty()) conn->out.push_back({std::move(res.body)});
+            if (res.file && res.file->size > 0) {
+                uint64_t size = res.file->size;
+                conn->out.push_back({{}, std::move(res.file), 0, size});
+            }
+            if (res.upgrade) {
+                // Whatever arrives from here on, or already has, is the new protocol's.
+                conn->upgrade = std::move(res.upgrade);
+                conn->busy = false;
+                conn->pipeline.clear();
+                conn->parser.reset();
+                if (!res.keepAlive) conn->closeAfterWrite = true;
+                if (!flush(conn)) continue;
+                if (!conn->in.empty()) conn->upgrade->receive(conn->in);
+                continue;
+            }
+            if (res.stream) {
+                // Still busy: the body is pulled piece by piece as the socket drains.
+                conn->stream = std::move(res.stream);
+                conn->streamKeepAlive = res.keepAlive;
+                flush(conn);
+                continue;
+            }
+            finishResponse(conn, res.keepAlive);
+        }
+    }
+
+    // Nothing finished waits past this turn on a request still on a worker.
+    for (auto &conn: held_)
+        if (!conn->closed) flush(conn);
+    held_.clear();
+
+    for (auto &conn: touched) arm(conn);
+}
+
+static std::chrono::seconds limitFor(const ConnectionLimits &limits, Connection::Deadline deadline)
+{
+    switch (deadline) {
+        case Connection::Deadline::Handshake:
+            return limits.handshake;
+        case Connection::Deadline::Header:
+            return limits.header;
+        case Connection::Deadline::Body:
+            return limits.body;
+        case Connection::Deadline::Idle:
+            return limits.idle;
+        case Connection::Deadline::Write:
+            return limits.write;
+        default:
+            return std::chrono::seconds(0);
+    }
+}
+
+void EventLoop::arm(const ConnectionPtr &conn)
+{
+    using Deadline = Connection::Deadline;
+    if (conn->closed) return;
+
+    // A request on a worker, or a body the app is still producing, is not
+    // the client's wait; an upgraded connection keeps its own pace.
+    Deadline next;
+    if (conn->handshaking) next = Deadline::Handshake;
+    else if (!conn->out.empty() || conn->stagedOff < conn->staged.size()) next = Deadline::Write;
+    else if (conn->busy || conn->upgrade) next = Deadline::None;
+    else if (!conn->in.empty()) next = conn->parser.headDone() ? Deadline::Body : Deadline::Header;
+    else next = conn->requests ? Deadline::Idle : Deadline::Header;
+
+    if (next == conn->deadline && (next != Deadline::Write || conn->sent == conn->sentWhenArmed)) return;
+    conn->deadline = next;
+    conn->sentWhenArmed = conn->sent;
+    std::chrono::seconds limit = limitFor(limits_, next);
+    if (limit.count() > 0) timers_.schedule(conn, TimerWheel<ConnectionPtr>::Clock::now() + limit);
+    else timers_.cancel(conn);
+}
+
+void EventLoop::expire()
+{
+    timers_.advance(TimerWheel<ConnectionPtr>::Clock::now(), [this](const ConnectionPtr &conn)
+    {
+        switch (conn->deadline) {
+            case Connection::Deadline::Handshake:
+                ++counters.handshake;
+                break;
+            case Connection::Deadline::Header:
+                ++counters.header;
+                break;
+            case Connection::Deadline::Body:
+                ++counters.body;
+                break;
+            case Connection::Deadline::Idle:
+                ++counters.idle;
+                break;
+            case Connection::Deadline::Write:
+                ++counters.write;
+                break;
+            default:
+                break;
+        }
+        closeConnection(conn);
+    });
+}
+
+// —————————————————————————————————————————————
+// io_uring backend
+// —————————————————————————————————————————————
+
+#ifdef LUMENITE_IO_URING
+
+void EventLoop::runRing()
+{
+    // Enabled from this thread: it is the only one that will submit.
+    try {
+        ring_->uring.enable();
+        ring_->uring.provideBuffers(RECV_GROUP, RECV_BUFFERS, READ_CHUNK);
+    } catch (const std::exception &e) {
+        std::cerr << "\033[33m[Server]\033[0m io_uring unavailable (" << e.what() << "), using epoll\n";
+        ring_.reset();
+        watch();
+        return;
+    }
+    armAccept();
+    armWake();
+    armTick();
+
+    while (true) {
+        ring_->uring.submitAndWait();
+        ring_->uring.forEachCompletion([this](const io_uring_cqe &cqe) { onCompletion(cqe); });
+    }
+}
+
+void EventLoop::armAccept()
+{
+    io_uring_sqe *sqe = ring_->uring.sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenFd_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = ACCEPT_DATA;
+}
+
+void EventLoop::armWake()
+{
+    io_uring_sqe *sqe = ring_->uring.sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = wakeFd_;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = WAKE_DATA;
+}
+
+void EventLoop::armTick()
+{
+    io_uring_sqe *sqe = ring_->uring.sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = tickFd_;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = TICK_DATA;
+}
+
+// One submission keeps delivering: each completion carries a buffer taken
+// from the shared ring, which goes straight back once copied out.
+void EventLoop::armReceive(RingIo &io)
+{
+    io_uring_sqe *sqe = ring_->uring.sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = io.conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = io.data(OP_RECV);
+    io.receiving = true;
+    ++io.ops;
+}
+
+// Cancel what is still queued on the socket (the receive, a send), then
+// close it; until the receive lets go of the socket the peer sees no FIN.
+// Hard-linked: the close runs even if nothing was left to cancel.
+void EventLoop::queueClose(RingIo &io)
+{
+    io_uring_sqe *cancel = ring_->uring.sqe();
+    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+    cancel->fd = io.conn->fd;
+    cancel->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    cancel->flags = IOSQE_IO_HARDLINK;
+    cancel->user_data = io.data(OP_CANCEL);
+    io_uring_sqe *closing = ring_->uring.sqe();
+    closing->opcode = IORING_OP_CLOSE;
+    closing->fd = io.conn->fd;
+    closing->user_data = io.data(OP_CLOSE);
+    io.ops += 2;
+    io.closeQueued = true;
+}
+
+void EventLoop::onCompletion(const io_uring_cqe &cqe)
+{
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    if (cqe.user_data == ACCEPT_DATA) {
+        if (cqe.res >= 0) {
+            sockaddr_in peer{};
+            socklen_t len = sizeof(peer);
+            char ipb[INET_ADDRSTRLEN] = "";
+            if (getpeername(cqe.res, (sockaddr *) &peer, &len) == 0)
+                inet_ntop(AF_INET, &peer.sin_addr, ipb, sizeof(ipb));
+            if (ConnectionPtr conn = adopt(cqe.res, ipb)) {
+                auto io = std::make_unique<RingIo>();
+                io->conn = conn;
+                conn->ringIo = io.get();
+                armReceive(*io);
+                ring_->io.emplace(conn.get(), std::move(io));
+                ++counters.open;
+                arm(conn);
+            }
+        }
+        if (!more) armAccept();
+        return;
+    }
+    if (cqe.user_data == WAKE_DATA) {
+        uint64_t v;
+        while (read(wakeFd_, &v, sizeof(v)) > 0) {
+        }
+        drainCompletions();
+        if (!more) armWake();
+        return;
+    }
+    if (cqe.user_data == TICK_DATA) {
+        uint64_t v;
+        while (read(tickFd_, &v, sizeof(v)) > 0) {
+        }
+        expire();
+        if (!more) armTick();
+        return;
+    }
+
+    RingIo &io = *reinterpret_cast<RingIo *>(cqe.user_data & ~OP_MASK);
+    ConnectionPtr conn = io.conn;
+    switch (cqe.user_data & OP_MASK) {
+        case OP_RECV:
+            onReceived(io, cqe);
+            break;
+        case OP_SEND:
+            --io.ops;
+            io.sending = false;
+            io.held.clear();
+            onSent(io, cqe.res);
+            break;
+        case OP_POLL_OUT:
+            --io.ops;
+            io.pollingOut = false;
+            if (!conn->closed) flush(conn);
+            break;
+        case OP_CLOSE:
+            --io.ops;
+            // Cancelled when the send it was linked behind fell short.
+            io.fdClosed = cqe.res != -ECANCELED;
+            io.closeQueued = false;
+            if (!io.fdClosed && conn->closed) queueClose(io);
+            else closeConnection(conn);
+            break;
+        case OP_CANCEL:
+            --io.ops;
+            break;
+        default:
+            break;
+    }
+
+    if (conn->closed && io.ops == 0) {
+        conn->ringIo = nullptr;
+        ring_->io.erase(conn.get());
+        return;
+    }
+    arm(conn);
+}
+
+void EventLoop::onReceived(RingIo &io, const io_uring_cqe &cqe)
+{
+    const ConnectionPtr &conn = io.conn;
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        io.receiving = false;
+        --io.ops;
+    }
+    if (cqe.res > 0) {
+        auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (!conn->closed) conn->in.append(ring_->uring.buffer(id), static_cast<size_t>(cqe.res));
+        ring_->uring.recycle(id);
+    }
+    if (conn->closed) return;
+
+    if (cqe.res > 0 || cqe.res == -ENOBUFS) {
+        // ENOBUFS: every buffer was in use; they are back by now.
+        if (cqe.res > 0) received(conn, false);
+        if (!conn->closed && !io.receiving) armReceive(io);
+        return;
+    }
+    if (cqe.res == 0) {
+        received(conn, true);
+        return;
+    }
+    closeConnection(conn);
+}
+
+void EventLoop::onSent(RingIo &io, int res)
+{
+    const ConnectionPtr &conn = io.conn;
+    if (conn->closed) return;
+    if (res < 0) {
+        // With a close linked behind it, that completion closes the connection.
+        if (!io.closeQueued) closeConnection(conn);
+        return;
+    }
+    conn->sent += static_cast<uint64_t>(res);
+    size_t left = static_cast<size_t>(res);
+    for (auto it = conn->out.begin(); left > 0 && it != conn->out.end(); ++it) {
+        size_t used = std::min<size_t>(it->data().size() - it->offset, left);
+        it->offset += used;
+        left -= used;
+    }
+    if (!io.closeQueued) flush(conn);
+}
+
+// flush() on the ring: one gathered send in flight at a time, whose
+// completion calls back in here. Files still go out by sendfile() on the
+// non-blocking socket, waiting on a POLLOUT when it fills.
+bool EventLoop::flushRing(const ConnectionPtr &conn)
+{
+    RingIo &io = *conn->ringIo;
+    if (io.sending || io.pollingOut || io.closeQueued) return true;
+
+    while (!conn->out.empty()) {
+        OutSegment &seg = conn->out.front();
+        if (seg.done()) {
+            conn->out.pop_front();
+            continue;
+        }
+        if (!seg.file) break;
+
+        auto off = static_cast<off_t>(seg.offset);
+        ssize_t n = sendfile(conn->fd, seg.file->fd, &off, std::min<uint64_t>(seg.end - seg.offset, SENDFILE_CHUNK));
+        if (n > 0) {
+            seg.offset += static_cast<uint64_t>(n);
+            conn->sent += static_cast<uint64_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            io_uring_sqe *sqe = ring_->uring.sqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = conn->fd;
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = io.data(OP_POLL_OUT);
+            io.pollingOut = true;
+            ++io.ops;
+            return true;
+        }
+        // n == 0: the file shrank under us
+        closeConnection(conn);
+        return false;
+    }
+
+    if (conn->out.empty()) {
+        if (conn->closeAfterWrite && !conn->busy) {
+            closeConnection(conn);
+            return false;
+        }
+        pullPiece(conn);
+        return true;
+    }
+
+    size_t count = 0, segments = 0;
+    bool fileNext = false;
+    for (auto &s: conn->out) {
+        if (s.file) {
+            fileNext = true;
+            break;
+        }
+        if (count == MAX_IOV) break;
+        ++segments;
+        if (s.done()) continue;
+        std::string_view bytes = s.data();
+        io.iov[count].iov_base = const_cast<char *>(bytes.data()) + s.offset;
+        io.iov[count].iov_len = bytes.size() - s.offset;
+        ++count;
+    }
+    io.msg = {};
+    io.msg.msg_iov = io.iov;
+    io.msg.msg_iovlen = count;
+
+    io_uring_sqe *sqe = ring_->uring.sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&io.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | (fileNext ? MSG_MORE : 0);
+    sqe->user_data = io.data(OP_SEND);
+    io.sending = true;
+    ++io.ops;
+
+    // The last write of a closing connection takes the close with it: all
+    // leave in the same submission, and the close only runs if every byte
+    // was sent.
+    if (conn->closeAfterWrite && !conn->busy && !conn->stream && segments == conn->out.size()) {
+        sqe->msg_flags |= MSG_WAITALL;
+        sqe->flags |= IOSQE_IO_LINK;
+        queueClose(io);
+    }
+    return true;
+}
+
+#else
+
+void EventLoop::runRing()
+{
+}
+
+bool EventLoop::flushRing(const ConnectionPtr &)
+{
+    return false;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,295 @@
+#pragma once
+#include "HttpParser.h"
+#include "utils/FileCache.h"
+#include "utils/TimerWheel.h"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class EventLoop;
+struct ssl_st;
+struct RingIo;
+struct io_uring_cqe;
+
+
+/// A queued piece of output: owned bytes, bytes shared with other
+/// connections (one broadcast frame), or a range of an open file that is
+/// handed to sendfile() so it never passes through user space.
+struct OutSegment
+{
+    std::string bytes;
+    FileHandle file;
+    uint64_t offset = 0; // next byte to send, within the bytes or the file
+    uint64_t end = 0; // file ranges only
+    std::shared_ptr<const std::string> shared; // instead of `bytes`
+
+    std::string_view data() const { return shared ? std::string_view(*shared) : std::string_view(bytes); }
+
+    bool done() const { return file ? offset >= end : offset >= data().size(); }
+};
+
+
+/// Takes a connection over once the response that switched its protocol
+/// (a WebSocket 101, or the head of an event stream) is queued. `receive` consumes what it can of the bytes
+/// read so far, leaving any partial frame; `closed` runs once, on the loop,
+/// when the connection is gone.
+struct Upgrade
+{
+    std::function<void(std::string &in)> receive;
+    std::function<void()> closed;
+};
+
+
+/// A body produced piece by piece after the head has gone out. `next` asks
+/// the producer for one more piece of wire bytes, which it hands to `ready`
+/// from any thread; `last` ends the body, and an empty last piece means it
+/// broke off, so the connection is closed. `stop` is called instead once
+/// the peer is gone, so the producer can let go of its state.
+struct BodyStream
+{
+    using Ready = std::function<void(std::string &&piece, bool last)>;
+
+    std::function<void(Ready)> next;
+    std::function<void()> stop;
+};
+
+
+/// A response ready for the socket. Head and body are queued as separate
+/// segments and leave in one gathered write, never concatenated.
+struct WireResponse
+{
+    std::string head;
+    std::string body;
+    FileHandle file; // sent in full after the head instead of `body`
+    std::shared_ptr<BodyStream> stream; // pulled after the head instead of `body`
+    std::shared_ptr<Upgrade> upgrade; // owns the connection after the head
+    bool keepAlive = true;
+};
+
+
+/// What a loop allows each connection; a zero turns that limit off. Header
+/// and body deadlines run from when the wait began, so bytes trickling in
+/// do not extend them; the write deadline restarts whenever the peer takes
+/// some output.
+struct ConnectionLimits
+{
+    std::chrono::seconds handshake{10}; // TLS handshake
+    std::chrono::seconds header{10}; // first byte of a request (or the accept) to its blank line
+    std::chrono::seconds body{30}; // blank line to the last byte of the body
+    std::chrono::seconds idle{15}; // keep-alive wait for the next request
+    std::chrono::seconds write{30}; // output waiting and none of it taken
+    unsigned maxRequests = 1000; // the last is answered with Connection: close
+    size_t maxHeaderBytes = HttpParser::MAX_HEADER_BYTES; // a longer head is answered 431
+};
+
+
+/// Per-socket state owned by exactly one EventLoop.
+struct Connection
+{
+    int fd = -1;
+    std::string remoteIp;
+    EventLoop *loop = nullptr;
+
+    ssl_st *ssl = nullptr; // set when the listener terminates TLS
+    bool handshaking = false;
+    bool readWantsWrite = false; // SSL_read is waiting for the socket to drain
+    bool tlsFailed = false; // a fatal TLS error: no close_notify is owed
+    std::string staged; // TLS output handed to SSL_write and not yet fully taken
+    size_t stagedOff = 0;
+
+    std::string in; // bytes received but not yet consumed by the parser
+    HttpParser parser; // how far into `in` the current request has been framed
+    std::deque<HttpRequest> pipeline; // framed requests waiting their turn
+    std::deque<OutSegment> out; // responses waiting for the socket, in order
+
+    std::shared_ptr<BodyStream> stream; // body still being produced
+    bool pulling = false; // a piece of `stream` has been asked for
+    bool streamKeepAlive = true;
+
+    std::shared_ptr<Upgrade> upgrade; // no longer HTTP once set
+
+    // A malformed request ends the pipeline: nothing after it is framed, and
+    // its 400 goes out once, after the responses to the requests before it.
+    enum class Reject : uint8_t { None, Pending, Sent } reject = Reject::None;
+    bool headTooLarge = false; // the rejection is a 431, not a 400
+
+    // The deadline armed for what the connection is waiting on.
+    enum class Deadline : uint8_t { None, Handshake, Header, Body, Idle, Write } deadline = Deadline::None;
+    uint64_t sent = 0; // bytes the socket has taken
+    uint64_t sentWhenArmed = 0;
+    unsigned requests = 0;
+
+    bool busy = false; // a request from this connection is on a worker
+    bool closeAfterWrite = false;
+    bool closed = false;
+
+    RingIo *ringIo = nullptr; // io_uring backend: operations in flight, owned by the loop
+};
+
+using ConnectionPtr = std::shared_ptr<Connection>;
+
+
+/// Edge-triggered epoll reactor. Each loop owns accept, read, parse and
+/// write for its connections; request processing is handed to `dispatch`
+/// and the result comes back through `complete()` from any thread.
+/// Pipelined requests are framed as soon as they arrive and dispatched one
+/// at a time in order; their responses are held and leave in one write.
+/// On a TLS listener every connection handshakes without blocking first,
+/// and then reads and writes through its SSL session.
+///
+/// Built with LUMENITE_IO_URING, a loop can run on io_uring instead: one
+/// multishot accept, multishot receives into a provided-buffer ring, and
+/// gathered sends with the final one linked to the close, all submitted in
+/// one system call per turn. Framing, dispatch and completions are the same
+/// code either way. TLS listeners stay on epoll.
+class EventLoop
+{
+public:
+    using Dispatch = std::function<void(const ConnectionPtr &, HttpRequest &&)>;
+
+    enum class Backend { Epoll, IoUring };
+
+    // Process-wide, across every loop.
+    struct Stats
+    {
+        uint64_t open = 0; // connections now
+        uint64_t handshakeTimeouts = 0;
+        uint64_t headerTimeouts = 0;
+        uint64_t bodyTimeouts = 0;
+        uint64_t idleTimeouts = 0;
+        uint64_t writeTimeouts = 0;
+        uint64_t headersTooLarge = 0;
+        uint64_t requestLimit = 0; // closed after their maxRequests-th request
+    };
+
+    // Falls back to epoll, with a warning, if io_uring cannot be used.
+    EventLoop(int listenFd, Dispatch dispatch, Backend backend = Backend::Epoll, ConnectionLimits limits = {});
+
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    [[noreturn]] void run();
+
+    // Thread-safe: queue a response for `conn` and wake the loop.
+    void complete(const ConnectionPtr &conn, WireResponse &&response);
+
+    // Thread-safe, for upgraded connections: queue raw bytes, optionally
+    // closing once they are written.
+    void send(const ConnectionPtr &conn, std::string &&bytes, bool closeAfter = false);
+
+    // Thread-safe: queue the same bytes for every connection in `conns`,
+    // waking each loop involved once. The bytes are shared, not copied.
+    static void send(const std::vector<ConnectionPtr> &conns, const std::shared_ptr<const std::string> &bytes);
+
+    // Bytes an upgraded connection may have waiting before it is dropped
+    // as too slow a reader.
+    static constexpr size_t MAX_UPGRADED_BACKLOG = 8 * 1024 * 1024;
+
+    static Stats stats();
+
+private:
+    struct Ring;
+
+    static constexpr std::chrono::seconds TICK{1};
+
+    struct Counters;
+
+    static Counters counters;
+
+    struct Completion
+    {
+        ConnectionPtr conn;
+        WireResponse response;
+        bool piece = false; // the next piece of conn->stream, in `response.body`
+        bool raw = false; // bytes for an upgraded connection, in `response.body` or `shared`
+        bool last = false; // piece: the body is complete; raw: close after writing
+        std::shared_ptr<const std::string> shared;
+    };
+
+    void pullPiece(const ConnectionPtr &conn);
+
+    void finishResponse(const ConnectionPtr &conn, bool keepAlive);
+
+    void watch();
+
+    void acceptAll();
+
+    ConnectionPtr adopt(int fd, std::string remoteIp);
+
+    bool handshake(const ConnectionPtr &conn);
+
+    long receive(const ConnectionPtr &conn, char *buf, size_t len);
+
+    void onReadable(const ConnectionPtr &conn);
+
+    void received(const ConnectionPtr &conn, bool peerClosed);
+
+    void parsePipeline(const ConnectionPtr &conn);
+
+    void tryDispatch(const ConnectionPtr &conn);
+
+    bool flush(const ConnectionPtr &conn);
+
+    bool flushTls(const ConnectionPtr &conn);
+
+    bool stage(const ConnectionPtr &conn);
+
+    void closeConnection(const ConnectionPtr &conn);
+
+    void drainCompletions();
+
+    void wake();
+
+    // Arm (or move, or drop) the deadline for what `conn` waits on now.
+    void arm(const ConnectionPtr &conn);
+
+    // Close every connection whose deadline has passed.
+    void expire();
+
+    // io_uring backend
+    void runRing();
+
+    void onCompletion(const io_uring_cqe &cqe);
+
+    void armAccept();
+
+    void armWake();
+
+    void armTick();
+
+    void armReceive(RingIo &io);
+
+    void onReceived(RingIo &io, const io_uring_cqe &cqe);
+
+    void onSent(RingIo &io, int res);
+
+    void queueClose(RingIo &io);
+
+    bool flushRing(const ConnectionPtr &conn);
+
+    std::unique_ptr<Ring> ring_;
+
+    int epfd_ = -1;
+    int wakeFd_ = -1;
+    int tickFd_ = -1; // timerfd: one tick of `timers_`
+    int listenFd_ = -1;
+    Dispatch dispatch_;
+
+    std::unordered_map<int, ConnectionPtr> conns_;
+
+    ConnectionLimits limits_;
+    TimerWheel<ConnectionPtr> timers_{TICK, 512};
+
+    std::mutex completionMutex_;
+    std::vector<Completion> completions_;
+    std::vector<ConnectionPtr> held_; // responses held for this turn's coalescing
+};
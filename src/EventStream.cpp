@@ -0,0 +1,318 @@
+#include "EventStream.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+std::mutex EventStream::mutex;
+std::unordered_set<std::string> EventStream::paths;
+std::unordered_map<uint64_t, EventStream::StreamPtr> EventStream::streams;
+std::unordered_map<std::string, std::unordered_map<uint64_t, EventStream::StreamPtr> > EventStream::channels;
+std::atomic<uint64_t> EventStream::nextId{1};
+
+// Lets every request skip the lock while no route is registered.
+static std::atomic<bool> anyRoutes{false};
+
+static std::once_flag heartbeatStarted;
+
+// A comment line: ignored by EventSource, but it keeps the connection busy.
+static const auto HEARTBEAT_BYTES = std::make_shared<const std::string>(":\n\n");
+
+
+void EventStream::route(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    paths.insert(path);
+    anyRoutes = true;
+}
+
+bool EventStream::routed(std::string_view path)
+{
+    if (!anyRoutes) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    return paths.count(std::string(path)) > 0;
+}
+
+EventStream::StreamPtr EventStream::open(const ConnectionPtr &conn, const HttpRequest &req)
+{
+    auto stream = std::make_shared<Stream>();
+    stream->id = nextId++;
+    stream->conn = conn;
+    stream->path.assign(req.path);
+    stream->remoteIp = req.remote_ip;
+    return stream;
+}
+
+void EventStream::accept(const StreamPtr &stream, std::string_view fields)
+{
+    auto conn = stream->conn.lock();
+    if (!conn) return;
+    // Started here rather than at route() so it runs in the serving process.
+    std::call_once(heartbeatStarted, [] { std::thread(heartbeatLoop).detach(); });
+
+    // No length and no chunking: the body runs until the connection closes.
+    WireResponse wire;
+    wire.head = "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "Cache-Control: no-cache\r\n"
+            "X-Accel-Buffering: no\r\n";
+    wire.head += fields;
+    wire.head += "\r\n";
+
+    // Clients have nothing to say on a stream; whatever they send is dropped.
+    auto upgrade = std::make_shared<Upgrade>();
+    upgrade->receive = [](std::string &in) { in.clear(); };
+    upgrade->closed = [stream] { closed(stream); };
+    wire.upgrade = std::move(upgrade);
+
+    {
+        // Under the lock so no event can overtake the head into the loop.
+        std::lock_guard<std::mutex> lock(stream->stateMutex);
+        wire.body = std::move(stream->early);
+        wire.keepAlive = !stream->earlyClose;
+        conn->loop->complete(conn, std::move(wire));
+        stream->accepted = true;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stream->closed) return;
+    streams.emplace(stream->id, stream);
+    for (const std::string &channel: stream->channels) channels[channel].emplace(stream->id, stream);
+}
+
+// —————————————————————————————————————————————
+// Events
+// —————————————————————————————————————————————
+
+// Field values cannot span lines; anything after a line break is dropped.
+static void appendField(std::string &out, std::string_view name, std::string_view value)
+{
+    out += name;
+    out += ": ";
+    out += value.substr(0, value.find_first_of("\r\n"));
+    out += '\n';
+}
+
+std::string EventStream::format(const Event &event)
+{
+    std::string out;
+    out.reserve(event.data.size() + event.event.size() + event.id.size() + 32);
+    if (!event.event.empty()) appendField(out, "event", event.event);
+    if (!event.id.empty()) appendField(out, "id", event.id);
+    if (event.retry >= 0) appendField(out, "retry", std::to_string(event.retry));
+
+    // Each line (split on \n, \r\n or \r) becomes a data: line; the client
+    // joins them back with \n.
+    std::string_view data = event.data;
+    while (true) {
+        size_t end = data.find_first_of("\r\n");
+        appendField(out, "data", data.substr(0, end));
+        if (end == std::string_view::npos) break;
+        size_t next = end + (data[end] == '\r' && end + 1 < data.size() && data[end + 1] == '\n' ? 2 : 1);
+        data.remove_prefix(next);
+    }
+    out += '\n';
+    return out;
+}
+
+// Held back until the head is queued, straight to the loop after that.
+bool EventStream::queue(Stream &s, std::string &&bytes, bool closeAfter)
+{
+    if (!s.accepted) {
+        std::lock_guard<std::mutex> lock(s.stateMutex);
+        if (!s.accepted) {
+            s.early += bytes;
+            s.earlyClose |= closeAfter;
+            return true;
+        }
+    }
+    auto conn = s.conn.lock();
+    if (!conn) return false;
+    conn->loop->send(conn, std::move(bytes), closeAfter);
+    return true;
+}
+
+bool EventStream::send(const StreamPtr &stream, const Event &event)
+{
+    if (stream->closed) return false;
+    return queue(*stream, format(event), false);
+}
+
+void EventStream::close(const StreamPtr &stream)
+{
+    if (stream->closed) return;
+    queue(*stream, {}, true);
+}
+
+void EventStream::closed(const StreamPtr &stream)
+{
+    stream->closed = true;
+    std::lock_guard<std::mutex> lock(mutex);
+    streams.erase(stream->id);
+    for (const std::string &channel: stream->channels) {
+        auto it = channels.find(channel);
+        if (it == channels.end()) continue;
+        it->second.erase(stream->id);
+        if (it->second.empty()) channels.erase(it);
+    }
+    stream->channels.clear();
+}
+
+void EventStream::subscribe(const StreamPtr &stream, const std::string &channel)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &mine = stream->channels;
+    if (stream->closed || std::find(mine.begin(), mine.end(), channel) != mine.end()) return;
+    mine.push_back(channel);
+    if (stream->accepted) channels[channel].emplace(stream->id, stream);
+}
+
+void EventStream::unsubscribe(const StreamPtr &stream, const std::string &channel)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = channels.find(channel);
+    if (it != channels.end()) {
+        it->second.erase(stream->id);
+        if (it->second.empty()) channels.erase(it);
+    }
+    auto &mine = stream->channels;
+    mine.erase(std::remove(mine.begin(), mine.end(), channel), mine.end());
+}
+
+size_t EventStream::publish(const std::string &channel, const Event &event)
+{
+    std::vector<ConnectionPtr> conns;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = channels.find(channel);
+        if (it == channels.end()) return 0;
+        conns.reserve(it->second.size());
+        for (auto &[id, stream]: it->second) {
+            if (stream->closed) continue;
+            if (auto conn = stream->conn.lock()) conns.push_back(std::move(conn));
+        }
+    }
+    if (conns.empty()) return 0;
+    EventLoop::send(conns, std::make_shared<const std::string>(format(event)));
+    return conns.size();
+}
+
+void EventStream::heartbeatLoop()
+{
+    std::vector<ConnectionPtr> conns;
+    while (true) {
+        std::this_thread::sleep_for(HEARTBEAT);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &[id, stream]: streams)
+                if (auto conn = stream->conn.lock()) conns.push_back(std::move(conn));
+        }
+        // A dead peer shows up as a failed write and the stream is closed.
+        if (!conns.empty()) EventLoop::send(conns, HEARTBEAT_BYTES);
+        conns.clear();
+    }
+}
+
+// —————————————————————————————————————————————
+// Lua handle
+// —————————————————————————————————————————————
+
+EventStream::Event EventStream::toEvent(lua_State *L, int idx)
+{
+    Event event;
+    size_t len;
+    const char *data = luaL_checklstring(L, idx, &len);
+    event.data = {data, len};
+    if (lua_isstring(L, idx + 1)) {
+        const char *name = lua_tolstring(L, idx + 1, &len);
+        event.event = {name, len};
+    } else if (lua_istable(L, idx + 1)) {
+        // The field values stay on the stack for as long as the views.
+        if (lua_getfield(L, idx + 1, "event") == LUA_TSTRING) {
+            const char *name = lua_tolstring(L, -1, &len);
+            event.event = {name, len};
+        }
+        if (lua_getfield(L, idx + 1, "id") != LUA_TNIL) {
+            const char *id = luaL_tolstring(L, -1, &len);
+            event.id = {id, len};
+        }
+        if (lua_getfield(L, idx + 1, "retry") == LUA_TNUMBER) event.retry = static_cast<long>(lua_tointeger(L, -1));
+    } else if (!lua_isnoneornil(L, idx + 1)) {
+        luaL_typeerror(L, idx + 1, "string or table");
+    }
+    return event;
+}
+
+static EventStream::StreamPtr &check_handle(lua_State *L)
+{
+    return *static_cast<EventStream::StreamPtr *>(luaL_checkudata(L, 1, EventStream::HANDLE_METATABLE));
+}
+
+static int stream_send(lua_State *L)
+{
+    auto &stream = check_handle(L);
+    EventStream::Event event = EventStream::toEvent(L, 2);
+    lua_pushboolean(L, EventStream::send(stream, event));
+    return 1;
+}
+
+static int stream_close(lua_State *L)
+{
+    EventStream::close(check_handle(L));
+    return 0;
+}
+
+static int stream_subscribe(lua_State *L)
+{
+    auto &stream = check_handle(L);
+    EventStream::subscribe(stream, luaL_checkstring(L, 2));
+    return 0;
+}
+
+static int stream_unsubscribe(lua_State *L)
+{
+    auto &stream = check_handle(L);
+    EventStream::unsubscribe(stream, luaL_checkstring(L, 2));
+    return 0;
+}
+
+static int stream_index(lua_State *L)
+{
+    auto &stream = check_handle(L);
+    const char *key = luaL_checkstring(L, 2);
+    if (std::strcmp(key, "id") == 0) lua_pushinteger(L, static_cast<lua_Integer>(stream->id));
+    else if (std::strcmp(key, "path") == 0) lua_pushlstring(L, stream->path.data(), stream->path.size());
+    else if (std::strcmp(key, "remote_ip") == 0) lua_pushstring(L, stream->remoteIp.c_str());
+    else if (std::strcmp(key, "open") == 0) lua_pushboolean(L, !stream->closed);
+    else {
+        lua_pushvalue(L, 2);
+        lua_rawget(L, lua_upvalueindex(1));
+    }
+    return 1;
+}
+
+static int stream_gc(lua_State *L)
+{
+    check_handle(L).~shared_ptr();
+    return 0;
+}
+
+void EventStream::pushHandle(lua_State *L, const StreamPtr &stream)
+{
+    new(lua_newuserdatauv(L, sizeof(StreamPtr), 0)) StreamPtr(stream);
+    if (luaL_newmetatable(L, HANDLE_METATABLE)) {
+        static constexpr luaL_Reg methods[] = {
+            {"send", stream_send},
+            {"close", stream_close},
+            {"subscribe", stream_subscribe},
+            {"unsubscribe", stream_unsubscribe},
+            {nullptr, nullptr}
+        };
+        luaL_newlib(L, methods);
+        lua_pushcclosure(L, stream_index, 1);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, stream_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "EventLoop.h"
+#include "HttpParser.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+extern "C"
+{
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+
+/// Server-Sent Events. A stream is a response that never ends: once its
+/// head is queued the connection leaves HTTP and only takes events. Streams
+/// subscribe to named channels; publish() formats an event once and hands
+/// the same buffer to every subscriber's loop. No thread or Lua state is
+/// held per stream; one heartbeat thread keeps idle ones (and the proxies
+/// in between) from timing out.
+class EventStream
+{
+public:
+    static constexpr auto HANDLE_METATABLE = "Lumenite.EventStream";
+    static constexpr std::chrono::seconds HEARTBEAT{15};
+
+    struct Event
+    {
+        std::string_view data;
+        std::string_view event; // `event:` field; empty for the default "message"
+        std::string_view id; // `id:` field, echoed back as Last-Event-ID on reconnect
+        long retry = -1; // `retry:` reconnection delay in ms; < 0 = not sent
+    };
+
+    struct Stream
+    {
+        uint64_t id = 0;
+        std::weak_ptr<Connection> conn;
+        std::string path;
+        std::string remoteIp;
+
+        std::atomic<bool> closed{false};
+
+    private:
+        friend class EventStream;
+
+        std::mutex stateMutex;
+        std::atomic<bool> accepted{false}; // the head is queued; set under stateMutex
+        std::string early; // events sent before that, written right behind it
+        bool earlyClose = false;
+
+        std::vector<std::string> channels; // guarded by EventStream::mutex
+    };
+
+    using StreamPtr = std::shared_ptr<Stream>;
+
+    // Serve streams on `path` (exact match).
+    static void route(const std::string &path);
+
+    static bool routed(std::string_view path);
+
+    // A stream for `conn`, not yet answered: what it sends is held back and
+    // its channels only take effect once accept() has run.
+    static StreamPtr open(const ConnectionPtr &conn, const HttpRequest &req);
+
+    // Answer with the 200 head (plus `fields`, as "Name: value\r\n"...) and
+    // keep the connection for events.
+    static void accept(const StreamPtr &stream, std::string_view fields);
+
+    // Thread-safe; false once the stream is closed.
+    static bool send(const StreamPtr &stream, const Event &event);
+
+    // End the stream after what is already queued.
+    static void close(const StreamPtr &stream);
+
+    static void subscribe(const StreamPtr &stream, const std::string &channel);
+
+    static void unsubscribe(const StreamPtr &stream, const std::string &channel);
+
+    // Send `event` to every stream subscribed to `channel`; how many that was.
+    static size_t publish(const std::string &channel, const Event &event);
+
+    // The event in wire format: one `data:` line per line of data.
+    static std::string format(const Event &event);
+
+    // The Lua object for `stream`: stream:send, stream:subscribe, ...
+    static void pushHandle(lua_State *L, const StreamPtr &stream);
+
+    // Read an event from the Lua arguments at `idx` (data) and `idx + 1`
+    // (an event name, or a table with event, id and retry). The views point
+    // at strings it leaves on the Lua stack.
+    static Event toEvent(lua_State *L, int idx);
+
+private:
+    static bool queue(Stream &stream, std::string &&bytes, bool closeAfter);
+
+    static void closed(const StreamPtr &stream);
+
+    static void heartbeatLoop();
+
+    static std::mutex mutex;
+    static std::unordered_set<std::string> paths;
+    static std::unordered_map<uint64_t, StreamPtr> streams; // accepted and still open
+    static std::unordered_map<std::string, std::unordered_map<uint64_t, StreamPtr> > channels;
+    static std::atomic<uint64_t> nextId;
+};
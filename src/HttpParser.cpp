@@ -0,0 +1,307 @@
+#include "HttpParser.h"
+
+#include <cstring>
+#include <limits>
+
+static bool iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+        if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+        if (x != y) return false;
+    }
+    return true;
+}
+
+static std::string_view trimOws(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Decode %XX and '+' over the bytes themselves; the result is never longer.
+static size_t urlDecodeInPlace(char *s, size_t n)
+{
+    size_t w = 0;
+    for (size_t r = 0; r < n; ++r) {
+        if (s[r] == '+') {
+            s[w++] = ' ';
+        } else if (s[r] == '%' && r + 2 < n) {
+            int hi = hexValue(s[r + 1]);
+            int lo = hexValue(s[r + 2]);
+            if (hi < 0 || lo < 0) {
+                s[w++] = s[r];
+                continue;
+            }
+            s[w++] = static_cast<char>(hi << 4 | lo);
+            r += 2;
+        } else {
+            s[w++] = s[r];
+        }
+    }
+    return w;
+}
+
+// a=1&b=x%20y -> {a, 1}, {b, x y}
+static void parsePairs(char *p, size_t n, std::vector<HttpField> &out)
+{
+    size_t i = 0;
+    while (i < n) {
+        char *amp = static_cast<char *>(std::memchr(p + i, '&', n - i));
+        size_t end = amp ? static_cast<size_t>(amp - p) : n;
+
+        if (end > i) {
+            char *eq = static_cast<char *>(std::memchr(p + i, '=', end - i));
+            size_t keyEnd = eq ? static_cast<size_t>(eq - p) : end;
+
+            size_t keyLen = urlDecodeInPlace(p + i, keyEnd - i);
+            std::string_view value;
+            if (eq) {
+                size_t valueLen = urlDecodeInPlace(eq + 1, end - keyEnd - 1);
+                value = std::string_view(eq + 1, valueLen);
+            }
+            out.emplace_back(std::string_view(p + i, keyLen), value);
+        }
+        i = end + 1;
+    }
+}
+
+
+std::string_view HttpRequest::header(std::string_view name) const
+{
+    for (auto it = headers.rbegin(); it != headers.rend(); ++it) {
+        if (iequals(it->first, name)) return it->second;
+    }
+    return {};
+}
+
+
+void HttpParser::reset()
+{
+    scanned_ = 0;
+    bodyStart_ = 0;
+    contentLength_ = 0;
+    chunked_ = false;
+    chunkPos_ = 0;
+    messageEnd_ = 0;
+    chunks_.clear();
+    method_ = target_ = Span{};
+    headers_.clear();
+}
+
+ParseResult HttpParser::feed(const std::string &buffer)
+{
+    if (!bodyStart_) {
+        // Resume where the last call stopped, backing up in case the blank
+        // line straddles two reads.
+        std::string_view data(buffer);
+        size_t end = data.find("\r\n\r\n", scanned_ > 3 ? scanned_ - 3 : 0);
+        if (end == std::string_view::npos) {
+            scanned_ = buffer.size();
+            return buffer.size() > maxHeaderBytes_ ? ParseResult::TooLarge : ParseResult::Incomplete;
+        }
+        if (end > maxHeaderBytes_) return ParseResult::TooLarge;
+
+        bodyStart_ = end + 4;
+        if (!parseHead(buffer)) return ParseResult::Invalid;
+        chunkPos_ = bodyStart_;
+    }
+
+    if (chunked_) return feedChunks(buffer);
+    return buffer.size() - bodyStart_ >= contentLength_ ? ParseResult::Complete : ParseResult::Incomplete;
+}
+
+// chunk = size [; ext] CRLF data CRLF, ending with a zero-size chunk and
+// optional trailer fields (which are skipped).
+ParseResult HttpParser::feedChunks(const std::string &buffer)
+{
+    std::string_view data(buffer);
+    while (true) {
+        size_t eol = data.find("\r\n", chunkPos_);
+        if (eol == std::string_view::npos)
+            return data.size() - chunkPos_ > maxHeaderBytes_ ? ParseResult::Invalid : ParseResult::Incomplete;
+
+        std::string_view line = data.substr(chunkPos_, eol - chunkPos_);
+        line = trimOws(line.substr(0, line.find(';')));
+        if (line.empty()) return ParseResult::Invalid;
+        size_t size = 0;
+        for (char c: line) {
+            int v = hexValue(c);
+            if (v < 0 || size > (std::numeric_limits<uint32_t>::max() >> 4)) return ParseResult::Invalid;
+            size = size << 4 | size_t(v);
+        }
+
+        size_t start = eol + 2;
+        if (size == 0) {
+            size_t end;
+            if (data.substr(start, 2) == "\r\n") {
+                end = start + 2;
+            } else {
+                size_t blank = data.find("\r\n\r\n", start);
+                if (blank == std::string_view::npos)
+                    return data.size() - start > maxHeaderBytes_ ? ParseResult::Invalid : ParseResult::Incomplete;
+                end = blank + 4;
+            }
+            if (end > std::numeric_limits<uint32_t>::max()) return ParseResult::Invalid;
+            messageEnd_ = end;
+            return ParseResult::Complete;
+        }
+
+        if (start + size > std::numeric_limits<uint32_t>::max()) return ParseResult::Invalid;
+        if (data.size() < start + size + 2) return ParseResult::Incomplete;
+        if (data.substr(start + size, 2) != "\r\n") return ParseResult::Invalid;
+
+        chunks_.push_back({uint32_t(start), uint32_t(size)});
+        chunkPos_ = start + size + 2;
+    }
+}
+
+bool HttpParser::parseHead(const std::string &buffer)
+{
+    const char *base = buffer.data();
+    std::string_view head(base, bodyStart_ - 2); // every line keeps its CRLF
+    auto span = [base](std::string_view s) { return Span{uint32_t(s.data() - base), uint32_t(s.size())}; };
+
+    size_t pos = 0;
+    auto nextLine = [&]() -> std::string_view
+    {
+        size_t eol = head.find('\n', pos);
+        std::string_view line = head.substr(pos, eol - pos);
+        pos = eol + 1;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        return line;
+    };
+
+    // Tolerate stray CRLFs between pipelined requests.
+    while (pos < head.size() && (head[pos] == '\r' || head[pos] == '\n')) ++pos;
+    if (pos >= head.size()) return false;
+
+    // Request-line: METHOD SP request-target SP HTTP-version
+    std::string_view line = nextLine();
+    size_t sp1 = line.find(' ');
+    if (sp1 == 0 || sp1 == std::string_view::npos) return false;
+    size_t targetStart = line.find_first_not_of(' ', sp1);
+    if (targetStart == std::string_view::npos) return false;
+    size_t targetEnd = std::min(line.find(' ', targetStart), line.size());
+
+    method_ = span(line.substr(0, sp1));
+    target_ = span(line.substr(targetStart, targetEnd - targetStart));
+
+    bool haveLength = false;
+    bool haveEncoding = false;
+    while (pos < head.size()) {
+        line = nextLine();
+        if (line.empty()) break;
+
+        size_t colon = line.find(':');
+        if (colon == 0 || colon == std::string_view::npos) continue;
+
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = trimOws(line.substr(colon + 1));
+        headers_.emplace_back(span(name), span(value));
+
+        if (iequals(name, "Content-Length")) {
+            if (value.empty()) return false;
+            size_t n = 0;
+            for (char c: value) {
+                if (c < '0' || c > '9') return false;
+                if (n > (std::numeric_limits<uint32_t>::max() - bodyStart_) / 10) return false;
+                n = n * 10 + size_t(c - '0');
+            }
+            // Conflicting lengths are how request smuggling starts.
+            if (haveLength && n != contentLength_) return false;
+            if (n > std::numeric_limits<uint32_t>::max() - bodyStart_) return false;
+            contentLength_ = n;
+            haveLength = true;
+        } else if (iequals(name, "Transfer-Encoding")) {
+            // Only a final "chunked" frames a request body; anything else
+            // cannot be delimited.
+            std::string_view last = value.substr(value.rfind(',') + 1);
+            if (!iequals(trimOws(last), "chunked")) return false;
+            haveEncoding = true;
+        }
+    }
+    // Both at once is the other way request smuggling starts.
+    if (haveEncoding && haveLength) return false;
+    chunked_ = haveEncoding;
+    return true;
+}
+
+void HttpParser::take(std::string &buffer, const std::string &clientIp, HttpRequest &req)
+{
+    const size_t total = chunked_ ? messageEnd_ : bodyStart_ + contentLength_;
+
+    bool isForm = false;
+    for (const auto &[name, value]: headers_) {
+        if (iequals({buffer.data() + name.off, name.len}, "Content-Type"))
+            isForm = std::string_view(buffer.data() + value.off, value.len)
+                    .starts_with("application/x-www-form-urlencoded");
+    }
+
+    // The usual case is one request per read: steal the buffer outright.
+    if (buffer.size() == total) {
+        req.raw = std::make_shared<std::string>(std::move(buffer));
+        buffer.clear();
+    } else {
+        req.raw = std::make_shared<std::string>(buffer, 0, total);
+        buffer.erase(0, total);
+    }
+
+    // Join the chunks over their own framing; the body only ever moves left.
+    if (chunked_) {
+        char *base = req.raw->data();
+        size_t w = bodyStart_;
+        for (const Span &c: chunks_) {
+            std::memmove(base + w, base + c.off, c.len);
+            w += c.len;
+        }
+        contentLength_ = w - bodyStart_;
+        // Keep the form copy below at `total`, past the (now stale) framing.
+    }
+
+    // Form fields decode into a copy so `body` stays as sent.
+    if (isForm) {
+        req.raw->reserve(total + contentLength_);
+        req.raw->append(req.raw->data() + bodyStart_, contentLength_);
+    }
+
+    char *base = req.raw->data();
+    auto view = [base](Span s) { return std::string_view(base + s.off, s.len); };
+
+    req.method = view(method_);
+    std::string_view target = view(target_);
+    size_t qm = target.find('?');
+    req.path = target.substr(0, qm);
+    req.query.clear();
+    if (qm != std::string_view::npos)
+        parsePairs(base + target_.off + qm + 1, target_.len - qm - 1, req.query);
+
+    req.headers.clear();
+    req.headers.reserve(headers_.size());
+    for (const auto &[name, value]: headers_)
+        req.headers.emplace_back(view(name), view(value));
+
+    req.body = std::string_view(base + bodyStart_, contentLength_);
+    req.form.clear();
+    if (isForm) parsePairs(base + total, contentLength_, req.form);
+
+    // remote IP & X-Forwarded-For
+    req.remote_ip = clientIp;
+    if (std::string_view ff = req.header("X-Forwarded-For"); !ff.empty()) {
+        ff = trimOws(ff.substr(0, ff.find(',')));
+        if (!ff.empty()) req.remote_ip.assign(ff);
+    }
+
+    reset();
+}
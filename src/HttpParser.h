@@ -0,0 +1,88 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using HttpField = std::pair<std::string_view, std::string_view>;
+
+/// One parsed request. Every view points into `raw`, which the request
+/// shares with its copies, so it can be handed between threads freely.
+struct HttpRequest
+{
+    std::shared_ptr<std::string> raw;
+
+    std::string_view method;
+    std::string_view path;
+    std::vector<HttpField> headers; // in arrival order; a repeated name keeps every value
+    std::vector<HttpField> query; // url-decoded in place
+    std::vector<HttpField> form; // url-decoded in place
+    std::string_view body;
+    std::string remote_ip;
+    bool lastOnConnection = false; // answered with Connection: close, whatever it asked
+
+    // Case-insensitive; the last value wins, empty if absent.
+    std::string_view header(std::string_view name) const;
+};
+
+enum class ParseResult
+{
+    Incomplete,
+    Complete,
+    Invalid,
+    TooLarge // the head outgrew the parser's limit
+};
+
+/// Incremental HTTP/1.1 framing over a connection's receive buffer.
+/// `feed` only scans bytes it has not seen yet and records offsets; `take`
+/// moves the finished request's bytes out and turns the offsets into views.
+/// A `Transfer-Encoding: chunked` body is framed chunk by chunk as it
+/// arrives and joined in place by `take`, so `body` is always contiguous.
+class HttpParser
+{
+public:
+    static constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+
+    explicit HttpParser(size_t maxHeaderBytes = MAX_HEADER_BYTES) : maxHeaderBytes_(maxHeaderBytes)
+    {
+    }
+
+    // Look at `buffer` (which only ever grows between calls) for a whole
+    // request at its front.
+    ParseResult feed(const std::string &buffer);
+
+    // After Complete: hand the request's bytes to `req`, leave any pipelined
+    // remainder at the front of `buffer`, and get ready for the next one.
+    void take(std::string &buffer, const std::string &clientIp, HttpRequest &req);
+
+    void reset();
+
+    // The current request's head is parsed and its body is still coming.
+    [[nodiscard]] bool headDone() const { return bodyStart_ != 0; }
+
+private:
+    struct Span
+    {
+        uint32_t off = 0;
+        uint32_t len = 0;
+    };
+
+    bool parseHead(const std::string &buffer);
+
+    ParseResult feedChunks(const std::string &buffer);
+
+    size_t maxHeaderBytes_;
+    size_t scanned_ = 0; // where the search for the blank line resumes
+    size_t bodyStart_ = 0; // non-zero once the head is parsed
+    size_t contentLength_ = 0; // decoded body length once a chunked body is done
+
+    bool chunked_ = false;
+    size_t chunkPos_ = 0; // next chunk-size line
+    size_t messageEnd_ = 0; // chunked only: past the last trailer, once seen
+    std::vector<Span> chunks_; // chunk data, in order
+
+    Span method_, target_;
+    std::vector<std::pair<Span, Span> > headers_;
+};
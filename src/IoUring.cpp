@@ -0,0 +1,274 @@
+#include "IoUring.h"
+
+#if defined(__linux__) && defined(LUMENITE_IO_URING)
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int sys_setup(unsigned entries, io_uring_params *p)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_register(int fd, unsigned opcode, const void *arg, unsigned nrArgs)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+static std::runtime_error failure(const char *what)
+{
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+
+IoUring::IoUring(unsigned entries, unsigned completions)
+{
+    io_uring_params p{};
+    p.cq_entries = completions;
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_R_DISABLED |
+              IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    ringFd = sys_setup(entries, &p);
+    if (ringFd < 0 && errno == EINVAL) {
+        // Before 6.1: no deferred task work, run it cooperatively instead.
+        p = {};
+        p.cq_entries = completions;
+        p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_R_DISABLED |
+                  IORING_SETUP_COOP_TASKRUN;
+        ringFd = sys_setup(entries, &p);
+    }
+    if (ringFd < 0) throw failure("io_uring_setup");
+    if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_SUBMIT_STABLE)) {
+        close(ringFd);
+        throw std::runtime_error("io_uring_setup: kernel too old");
+    }
+    enterFd = ringFd;
+
+    sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+
+    sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED) {
+        sqMap = nullptr;
+        close(ringFd);
+        throw failure("io_uring mmap");
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cqMap = sqMap;
+    } else {
+        cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                     IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED) {
+            cqMap = nullptr;
+            auto error = failure("io_uring mmap");
+            release();
+            throw error;
+        }
+    }
+    sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void *s = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (s == MAP_FAILED) {
+        auto error = failure("io_uring mmap");
+        release();
+        throw error;
+    }
+    sqes = static_cast<io_uring_sqe *>(s);
+
+    auto *sq = static_cast<char *>(sqMap);
+    sqHead = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sqTail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sqEntries = p.sq_entries;
+    sqLocal = *sqTail;
+    // Slot i always holds entry i.
+    auto *array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    for (unsigned i = 0; i < sqEntries; ++i) array[i] = i;
+
+    auto *cq = static_cast<char *>(cqMap);
+    cqHead = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cqTail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+}
+
+IoUring::~IoUring()
+{
+    release();
+}
+
+void IoUring::release()
+{
+    if (buffers) munmap(buffers, buffersSize);
+    if (bufRing) munmap(bufRing, bufRingSize);
+    if (sqes) munmap(sqes, sqesSize);
+    if (cqMap && cqMap != sqMap) munmap(cqMap, cqMapSize);
+    if (sqMap) munmap(sqMap, sqMapSize);
+    if (ringFd >= 0) close(ringFd);
+    buffers = nullptr;
+    bufRing = nullptr;
+    sqes = nullptr;
+    cqMap = sqMap = nullptr;
+    ringFd = -1;
+}
+
+void IoUring::enable()
+{
+    if (sys_register(ringFd, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0) throw failure("io_uring enable");
+
+    // Entering through a registered index saves a file lookup per call.
+    io_uring_rsrc_update update{};
+    update.offset = -1U;
+    update.data = static_cast<uint64_t>(ringFd);
+    if (sys_register(ringFd, IORING_REGISTER_RING_FDS, &update, 1) == 1) {
+        enterFd = static_cast<int>(update.offset);
+        enterFlags = IORING_ENTER_REGISTERED_RING;
+    }
+}
+
+int IoUring::enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, enterFd, toSubmit, minComplete, flags | enterFlags,
+                                    nullptr, 0));
+}
+
+io_uring_sqe *IoUring::sqe()
+{
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (sqLocal - head >= sqEntries) {
+        __atomic_store_n(sqTail, sqLocal, __ATOMIC_RELEASE);
+        while (enter(sqLocal - head, 0, 0) < 0 && errno == EINTR) {
+        }
+        head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    }
+    io_uring_sqe *e = &sqes[sqLocal & sqMask];
+    std::memset(e, 0, sizeof(*e));
+    ++sqLocal;
+    return e;
+}
+
+void IoUring::submitAndWait()
+{
+    __atomic_store_n(sqTail, sqLocal, __ATOMIC_RELEASE);
+    unsigned pending = sqLocal - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    // Completions already waiting: submit without sleeping.
+    bool ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE) != *cqHead;
+    // EBUSY (completions backed up) leaves the rest queued for next time,
+    // after these have been reaped.
+    while (enter(pending, ready ? 0 : 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) {
+    }
+}
+
+int IoUring::complete()
+{
+    __atomic_store_n(sqTail, sqLocal, __ATOMIC_RELEASE);
+    unsigned pending = sqLocal - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    while (enter(pending, 1, IORING_ENTER_GETEVENTS) < 0) {
+        if (errno != EINTR) throw failure("io_uring_enter");
+        pending = 0;
+    }
+    unsigned head = *cqHead;
+    int res = cqes[head & cqMask].res;
+    if (cqes[head & cqMask].flags & IORING_CQE_F_BUFFER) recycle(cqes[head & cqMask].flags >> IORING_CQE_BUFFER_SHIFT);
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return res;
+}
+
+void IoUring::provideBuffers(uint16_t group, unsigned count, unsigned size)
+{
+    bufGroup = group;
+    bufferSize = size;
+    buffersSize = static_cast<size_t>(count) * size;
+    void *b = mmap(nullptr, buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED) throw failure("receive buffers mmap");
+    buffers = static_cast<char *>(b);
+
+    bufRingSize = count * sizeof(io_uring_buf);
+    void *r = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) throw failure("buffer ring mmap");
+    bufRing = static_cast<io_uring_buf_ring *>(r);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (sys_register(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0) {
+        bufMask = count - 1;
+        for (unsigned i = 0; i < count; ++i) {
+            io_uring_buf &slot = bufRing->bufs[i];
+            slot.addr = reinterpret_cast<uint64_t>(buffer(static_cast<uint16_t>(i)));
+            slot.len = size;
+            slot.bid = static_cast<uint16_t>(i);
+        }
+        __atomic_store_n(&bufRing->tail, static_cast<uint16_t>(count), __ATOMIC_RELEASE);
+        if (ringDelivers(group)) return;
+        sys_register(ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    munmap(bufRing, bufRingSize);
+    bufRing = nullptr;
+
+    provideClassic(0, count);
+    int res = complete();
+    if (res < 0) {
+        errno = -res;
+        throw failure("IORING_OP_PROVIDE_BUFFERS");
+    }
+}
+
+// Some kernels take the registration and then answer every receive with
+// ENOBUFS; one byte through a socket pair tells.
+bool IoUring::ringDelivers(uint16_t group)
+{
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) return false;
+    bool delivered = write(pair[1], "x", 1) == 1;
+    if (delivered) {
+        io_uring_sqe *e = sqe();
+        e->opcode = IORING_OP_RECV;
+        e->fd = pair[0];
+        e->flags = IOSQE_BUFFER_SELECT;
+        e->buf_group = group;
+        e->user_data = INTERNAL;
+        delivered = complete() == 1;
+    }
+    close(pair[0]);
+    close(pair[1]);
+    return delivered;
+}
+
+io_uring_sqe *IoUring::provideClassic(uint16_t id, unsigned count)
+{
+    io_uring_sqe *e = sqe();
+    e->opcode = IORING_OP_PROVIDE_BUFFERS;
+    e->fd = static_cast<int>(count);
+    e->addr = reinterpret_cast<uint64_t>(buffer(id));
+    e->len = static_cast<uint32_t>(bufferSize);
+    e->buf_group = bufGroup;
+    e->off = id;
+    e->user_data = INTERNAL;
+    return e;
+}
+
+void IoUring::recycle(uint16_t id)
+{
+    if (!bufRing) {
+        // Goes out with the next submission; only a failure posts a completion.
+        provideClassic(id, 1)->flags = IOSQE_CQE_SKIP_SUCCESS;
+        return;
+    }
+    uint16_t tail = bufRing->tail;
+    io_uring_buf &slot = bufRing->bufs[tail & bufMask];
+    slot.addr = reinterpret_cast<uint64_t>(buffer(id));
+    slot.len = static_cast<uint32_t>(bufferSize);
+    slot.bid = id;
+    __atomic_store_n(&bufRing->tail, static_cast<uint16_t>(tail + 1), __ATOMIC_RELEASE);
+}
+
+#endif
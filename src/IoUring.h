@@ -0,0 +1,108 @@
+#pragma once
+#if defined(__linux__) && defined(LUMENITE_IO_URING)
+
+#include <linux/io_uring.h>
+
+#include <cstddef>
+#include <cstdint>
+
+
+/// Just enough io_uring for the socket loop, on the raw system calls (the
+/// kernel header is all it needs, not liburing). One ring per loop thread:
+/// created disabled, then enabled by the thread that drives it, so the
+/// kernel can run completions on that thread only (single issuer, deferred
+/// task work). Receives draw from a provided-buffer ring registered with
+/// the kernel, so no buffer is tied up per idle connection; where the ring
+/// registers but hands nothing out, the same buffers are provided the
+/// classic way (one PROVIDE_BUFFERS per recycle, skipped on success).
+class IoUring
+{
+public:
+    // Throws std::runtime_error when the kernel refuses (too old, disabled
+    // by sysctl or seccomp).
+    IoUring(unsigned entries, unsigned completions);
+
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+
+    IoUring &operator=(const IoUring &) = delete;
+
+    // From the thread that will submit from now on.
+    void enable();
+
+    // A zeroed submission entry; submits what is queued if the ring is full.
+    io_uring_sqe *sqe();
+
+    // Submit everything queued and wait for at least one completion.
+    void submitAndWait();
+
+    // Call `fn` on every completion ready now, then release them. The
+    // ring's own (user_data 0) never reach `fn`.
+    template<typename Fn>
+    void forEachCompletion(Fn &&fn)
+    {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            if (cqe.user_data != INTERNAL) fn(cqe);
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    // Register `count` (a power of two) buffers of `size` bytes as group
+    // `group`. Call before anything else is in flight.
+    void provideBuffers(uint16_t group, unsigned count, unsigned size);
+
+    char *buffer(uint16_t id) const { return buffers + static_cast<size_t>(id) * bufferSize; }
+
+    // Hand a buffer a completion picked back to the kernel.
+    void recycle(uint16_t id);
+
+private:
+    static constexpr uint64_t INTERNAL = 0;
+
+    void release();
+
+    // Submit, wait for the next completion and take it; setup only.
+    int complete();
+
+    bool ringDelivers(uint16_t group);
+
+    io_uring_sqe *provideClassic(uint16_t id, unsigned count);
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags);
+
+    int ringFd = -1;
+    unsigned enterFlags = 0; // IORING_ENTER_REGISTERED_RING once the fd is registered
+    int enterFd = -1; // the ring fd, or its registered index
+
+    void *sqMap = nullptr;
+    size_t sqMapSize = 0;
+    void *cqMap = nullptr;
+    size_t cqMapSize = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    unsigned sqLocal = 0; // tail including entries not yet published
+
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+
+    io_uring_buf_ring *bufRing = nullptr; // null: provided the classic way
+    size_t bufRingSize = 0;
+    unsigned bufMask = 0;
+    uint16_t bufGroup = 0;
+    char *buffers = nullptr;
+    size_t bufferSize = 0;
+    size_t buffersSize = 0;
+};
+
+#endif
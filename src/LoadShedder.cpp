@@ -0,0 +1,83 @@
+#include "LoadShedder.h"
+
+#include <algorithm>
+#include <limits>
+
+std::atomic<std::shared_ptr<const LoadShedder::Config> > LoadShedder::config{std::make_shared<const Config>()};
+
+std::atomic<int64_t> LoadShedder::intervalEnd{0};
+std::atomic<int64_t> LoadShedder::intervalMin{std::numeric_limits<int64_t>::max()};
+std::atomic<int64_t> LoadShedder::lastMin{0};
+std::atomic<bool> LoadShedder::overloaded{false};
+
+std::atomic<uint64_t> LoadShedder::admitted{0};
+std::atomic<uint64_t> LoadShedder::shed{0};
+
+static int64_t micros(std::chrono::steady_clock::duration d)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+void LoadShedder::configure(const Config &next)
+{
+    config.store(std::make_shared<const Config>(next));
+}
+
+LoadShedder::Config LoadShedder::configuration()
+{
+    return *config.load();
+}
+
+LoadShedder::Stats LoadShedder::stats()
+{
+    Stats st;
+    st.admitted = admitted.load();
+    st.shed = shed.load();
+    st.overloaded = overloaded.load();
+    st.minWaitUs = static_cast<uint64_t>(std::max<int64_t>(0, lastMin.load()));
+    return st;
+}
+
+long LoadShedder::retryAfter()
+{
+    return static_cast<long>(config.load()->retryAfter.count());
+}
+
+bool LoadShedder::admit(Clock::time_point queued, std::string_view path)
+{
+    std::shared_ptr<const Config> cfg = config.load();
+    if (!cfg->enabled) {
+        admitted.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Clock::time_point now = Clock::now();
+    int64_t wait = micros(now - queued);
+    int64_t seen = intervalMin.load(std::memory_order_relaxed);
+    while (wait < seen && !intervalMin.compare_exchange_weak(seen, wait, std::memory_order_relaxed)) {
+    }
+
+    // Whichever worker passes the end of the interval judges it. An interval
+    // nobody was queued in leaves the minimum unset, which is not overload.
+    int64_t at = micros(now.time_since_epoch());
+    int64_t end = intervalEnd.load(std::memory_order_relaxed);
+    if (at >= end && intervalEnd.compare_exchange_strong(end, at + micros(cfg->interval))) {
+        int64_t min = intervalMin.exchange(std::numeric_limits<int64_t>::max());
+        if (min == std::numeric_limits<int64_t>::max()) min = 0;
+        lastMin = min;
+        overloaded = min > micros(cfg->target);
+    }
+
+    int64_t limit = micros(overloaded.load(std::memory_order_relaxed) ? cfg->target : cfg->interval);
+    auto exempt = [&]
+    {
+        return std::any_of(cfg->exempt.begin(), cfg->exempt.end(),
+                           [&](const std::string &prefix) { return path.starts_with(prefix); });
+    };
+    if (wait <= limit || exempt()) {
+        admitted.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    shed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
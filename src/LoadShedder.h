@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/// CoDel-style admission for requests waiting on a Lua worker. A worker
+/// measures how long each request sat in the queue as it takes it. While
+/// even the shortest wait of an interval stays above the target, the queue
+/// is standing rather than absorbing a burst, and a request that waited
+/// longer than the target is answered 503 with Retry-After instead of run.
+/// Otherwise only a request that waited a whole interval is. Either way the
+/// requests that do run have waited a bounded time, and the ones that
+/// cannot be served in time are told so at once. Configured from
+/// app.overload_config.
+class LoadShedder
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config
+    {
+        bool enabled = true;
+        std::chrono::milliseconds target{50}; // acceptable standing wait
+        std::chrono::milliseconds interval{500}; // how long the wait must stay above target
+        std::chrono::seconds retryAfter{1};
+        std::vector<std::string> exempt; // path prefixes never shed (health checks, say)
+    };
+
+    struct Stats
+    {
+        uint64_t admitted = 0;
+        uint64_t shed = 0;
+        bool overloaded = false;
+        uint64_t minWaitUs = 0; // shortest wait of the last full interval
+    };
+
+    static void configure(const Config &config);
+
+    static Config configuration();
+
+    static Stats stats();
+
+    // On the worker about to run a request queued at `queued`: false means
+    // it is to be answered 503 without running.
+    static bool admit(Clock::time_point queued, std::string_view path);
+
+    // Seconds for the Retry-After of a shed request.
+    static long retryAfter();
+
+private:
+    static std::atomic<std::shared_ptr<const Config> > config;
+
+    // Microseconds on Clock.
+    static std::atomic<int64_t> intervalEnd;
+    static std::atomic<int64_t> intervalMin; // shortest wait so far in this interval
+    static std::atomic<int64_t> lastMin;
+    static std::atomic<bool> overloaded;
+
+    static std::atomic<uint64_t> admitted;
+    static std::atomic<uint64_t> shed;
+};
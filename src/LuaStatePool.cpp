@@ -0,0 +1,110 @@
+#include "LuaStatePool.h"
+#include "LumeniteApp.h"
+#include "ErrorHandler.h"
+
+#include <algorithm>
+
+
+LuaStatePool::LuaStatePool(size_t workers)
+{
+    if (workers == 0) workers = 1;
+    pending_ = workers;
+
+    threads_.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+        threads_.emplace_back([this, w = workers_.back().get()] { workerMain(*w); });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    readyCv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+LuaStatePool::~LuaStatePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        for (auto &w: workers_) wake(*w);
+    }
+    for (auto &t: threads_)
+        if (t.joinable()) t.join();
+}
+
+void LuaStatePool::submit(Task task)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(task));
+    // The worker that went idle last is the likeliest to still be warm.
+    if (!idle_.empty()) wake(*idle_.back());
+}
+
+void LuaStatePool::post(lua_State *L, Task task)
+{
+    // Coroutines share their main thread's extra space, so this finds the
+    // worker from any thread of the state.
+    auto *worker = *static_cast<Worker **>(lua_getextraspace(L));
+    std::lock_guard<std::mutex> lock(mutex_);
+    worker->local.push_back(std::move(task));
+    wake(*worker);
+}
+
+void LuaStatePool::wake(Worker &worker)
+{
+    if (!worker.idle) return;
+    worker.idle = false;
+    idle_.erase(std::find(idle_.begin(), idle_.end(), &worker));
+    worker.cv.notify_one();
+}
+
+void LuaStatePool::workerMain(Worker &worker)
+{
+    lua_State *L = nullptr;
+    {
+        std::lock_guard<std::mutex> load(loadMutex_);
+        L = LumeniteApp::newState();
+        *static_cast<Worker **>(lua_getextraspace(L)) = &worker;
+        Router::loadInto(&routes_);
+        std::string error;
+        bool loaded = LumeniteApp::loadWorkerScript(L, error);
+        Router::loadInto(nullptr);
+        if (!loaded) {
+            ErrorHandler::invalidScript(error);
+            lua_close(L);
+            L = nullptr;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --pending_;
+        if (L) ++ready_;
+    }
+    readyCv_.notify_all();
+    if (!L) return;
+
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stopping_ && worker.local.empty() && queue_.empty()) {
+                if (!worker.idle) {
+                    worker.idle = true;
+                    idle_.push_back(&worker);
+                }
+                worker.cv.wait(lock);
+            }
+            // Woken spuriously with work waiting: leave idle_ so submit()
+            // wakes someone who is actually asleep.
+            wake(worker);
+            // Finish requests already in flight here before taking new ones.
+            auto &from = !worker.local.empty() ? worker.local : queue_;
+            if (stopping_ && from.empty()) break;
+            task = std::move(from.front());
+            from.pop_front();
+        }
+        task(L);
+    }
+
+    lua_close(L);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Router.h"
+
+extern "C"
+{
+#include "lua.h"
+}
+
+
+/// One fully initialized interpreter per worker thread.
+/// Each worker builds its own state and replays app.lua into it (routes,
+/// hooks, template filters), then pulls requests from a shared queue, so
+/// whichever state is idle takes the next request. Work that must run on a
+/// particular state (resuming a parked coroutine) goes to that worker's own
+/// queue, which it drains first. No two threads ever touch the same lua_State.
+/// The routes its states register live in the pool, so a reload builds a
+/// second pool beside the first without either seeing the other's routes.
+class LuaStatePool
+{
+public:
+    using Task = std::function<void(lua_State *)>;
+
+    explicit LuaStatePool(size_t workers);
+
+    ~LuaStatePool();
+
+    LuaStatePool(const LuaStatePool &) = delete;
+
+    LuaStatePool &operator=(const LuaStatePool &) = delete;
+
+    void submit(Task task);
+
+    // Thread-safe: run `task` on the worker that owns `L` (or any of its threads).
+    void post(lua_State *L, Task task);
+
+    // Number of states that loaded app.lua successfully.
+    [[nodiscard]] size_t size() const { return ready_; }
+
+    [[nodiscard]] const Router::Table &routes() const { return routes_; }
+
+private:
+    // Each worker sleeps on its own condition variable, so a task posted
+    // to one worker wakes that worker alone.
+    struct Worker
+    {
+        std::deque<Task> local;
+        std::condition_variable cv;
+        bool idle = false; // on idle_, waiting for work
+    };
+
+    void workerMain(Worker &worker);
+
+    // Under mutex_: take `worker` off idle_ and wake it.
+    void wake(Worker &worker);
+
+    std::vector<std::thread> threads_;
+    std::vector<std::unique_ptr<Worker> > workers_;
+    std::deque<Task> queue_;
+    std::vector<Worker *> idle_; // most recently idle last
+    std::mutex mutex_;
+    bool stopping_ = false;
+    Router::Table routes_;
+
+    // Start-up: module globals (db models, plugin registry) are not built
+    // for concurrent loads, so states replay app.lua one at a time.
+    std::mutex loadMutex_;
+    std::condition_variable readyCv_;
+    size_t pending_ = 0;
+    size_t ready_ = 0;
+};
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <chrono>
+#include <climits>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -7,10 +9,19 @@
 
 #include <json/json.h>
 
+#include "AccessLog.h"
+#include "Async.h"
+#include "Compression.h"
 #include "ErrorHandler.h"
+#include "EventStream.h"
+#include "LoadShedder.h"
 #include "LumeniteApp.h"
+#include "Prefork.h"
 #include "Server.h"
+#include "StaticFiles.h"
 #include "TemplateEngine.h"
+#include "Tls.h"
+#include "WebSocket.h"
 
 #include "modules/LumeniteCrypto.h"
 #include "modules/LumeniteDb.h"
@@ -18,14 +29,11 @@
 #include "modules/ModuleBase.h"
 #include "utils/LumenitePackageManager.h"
 
-#include "utils/MimeDetector.h"
 
 
 bool running = false;
 
-std::vector<int> LumeniteApp::before_request_refs;
-std::vector<int> LumeniteApp::after_request_refs;
-std::unordered_map<int, int> LumeniteApp::on_abort_refs;
+std::string LumeniteApp::scriptPath;
 
 
 bool LumeniteApp::listening = false;
@@ -178,10 +186,7 @@ static void json_to_lua(lua_State *L, const Json::Value &val)
 LumeniteApp::LumeniteApp()
 {
     enableAnsiColors();
-    L = luaL_newstate();
-    luaL_openlibs(L);
-    exposeBindings();
-    injectBuiltins();
+    L = newState();
 }
 
 LumeniteApp::~LumeniteApp()
@@ -199,6 +204,8 @@ int LumeniteApp::loadScript(const std::string &path) const
         return 1;
     }
 
+    scriptPath = path;
+
     TemplateEngine::initialize(TemplateEngine::Config{});
 
     LumeniteModule::loadPluginsFromDirectory();
@@ -233,25 +240,277 @@ int LumeniteApp::loadScript(const std::string &path) const
 }
 
 
+lua_State *LumeniteApp::newState()
+{
+    lua_State *state = luaL_newstate();
+    luaL_openlibs(state);
+    exposeBindings(state);
+    injectBuiltins(state);
+    return state;
+}
+
+bool LumeniteApp::loadWorkerScript(lua_State *L, std::string &error)
+{
+    lua_pushboolean(L, 1);
+    lua_setfield(L, LUA_REGISTRYINDEX, WORKER_KEY);
+
+    lua_getglobal(L, "debug");
+    lua_getfield(L, -1, "traceback");
+    lua_remove(L, -2);
+    int tracebackIndex = lua_gettop(L);
+
+    if (luaL_loadfile(L, scriptPath.c_str()) != LUA_OK ||
+        lua_pcall(L, 0, 0, tracebackIndex) != LUA_OK) {
+        error = lua_tostring(L, -1);
+        lua_settop(L, tracebackIndex - 1);
+        return false;
+    }
+
+    lua_settop(L, tracebackIndex - 1);
+    return true;
+}
+
+void LumeniteApp::pushRegistryTable(lua_State *L, const char *key)
+{
+    if (lua_getfield(L, LUA_REGISTRYINDEX, key) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, key);
+    }
+}
+
+static int file_gc(lua_State *L)
+{
+    static_cast<FileHandle *>(luaL_checkudata(L, 1, LumeniteApp::FILE_METATABLE))->~FileHandle();
+    return 0;
+}
+
+void LumeniteApp::pushFile(lua_State *L, FileHandle file)
+{
+    new(lua_newuserdatauv(L, sizeof(FileHandle), 0)) FileHandle(std::move(file));
+    if (luaL_newmetatable(L, FILE_METATABLE)) {
+        lua_pushcfunction(L, file_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+}
+
+FileHandle LumeniteApp::toFile(lua_State *L, int idx)
+{
+    auto *file = static_cast<FileHandle *>(luaL_testudata(L, idx, FILE_METATABLE));
+    return file ? *file : nullptr;
+}
+
+
+// Inside a route the request parks while the fetch runs on the I/O pool.
 static int lua_http_get(lua_State *L)
 {
-    const char *url = luaL_checkstring(L, 1);
+    std::string url = luaL_checkstring(L, 1);
 
-    auto [status, body] = LumenitePackageManager::http_get(url);
+    return Async::await(L, [url]() -> Async::Push
+    {
+        auto result = std::make_shared<std::pair<long, std::string> >(LumenitePackageManager::http_get(url));
+        return [result](lua_State *L)
+        {
+            auto &[status, body] = *result;
+            lua_newtable(L);
 
-    lua_newtable(L);
+            lua_pushstring(L, "status");
+            lua_pushinteger(L, status);
+            lua_settable(L, -3);
 
-    lua_pushstring(L, "status");
-    lua_pushinteger(L, status);
-    lua_settable(L, -3);
+            lua_pushstring(L, "body");
+            lua_pushlstring(L, body.data(), body.size());
+            lua_settable(L, -3);
 
-    lua_pushstring(L, "body");
-    lua_pushlstring(L, body.data(), body.size());
-    lua_settable(L, -3);
+            return 1;
+        };
+    });
+}
+
+// Served by StaticFiles before any route; see Server.cpp.
+static int lua_static(lua_State *L)
+{
+    int arg = lua_istable(L, 1) ? 2 : 1; // app:static(...) or app.static(...)
+    std::string prefix = luaL_checkstring(L, arg);
+    std::string dir = luaL_checkstring(L, arg + 1);
+    try {
+        StaticFiles::mount(prefix, dir);
+    } catch (const std::exception &e) {
+        return luaL_error(L, "app.static: %s", e.what());
+    }
+    return 0;
+}
 
+// app.websocket(path, { on_open = f, on_message = f, on_close = f }): the
+// upgrade and framing happen in C++, see Server.cpp and WebSocket.
+static int lua_websocket(lua_State *L)
+{
+    int arg = lua_istable(L, 1) && lua_istable(L, 3) ? 2 : 1; // app:websocket(...) or app.websocket(...)
+    std::string path = luaL_checkstring(L, arg);
+    luaL_checktype(L, arg + 1, LUA_TTABLE);
+    luaL_argcheck(L, !path.empty() && path[0] == '/', arg, "must start with '/'");
+    for (const char *name: {"on_open", "on_message", "on_close"}) {
+        int type = lua_getfield(L, arg + 1, name);
+        lua_pop(L, 1);
+        if (type != LUA_TNIL && type != LUA_TFUNCTION)
+            return luaL_error(L, "app.websocket: '%s' must be a function", name);
+    }
+
+    LumeniteApp::pushRegistryTable(L, LumeniteApp::WEBSOCKETS_KEY);
+    lua_pushvalue(L, arg + 1);
+    lua_setfield(L, -2, path.c_str());
+    lua_pop(L, 1);
+    WebSocket::route(path);
+    return 0;
+}
+
+// app.broadcast(channel, data[, binary]): framed once, written to every
+// socket subscribed to `channel`; returns how many that was.
+static int lua_broadcast(lua_State *L)
+{
+    int arg = lua_istable(L, 1) ? 2 : 1;
+    std::string channel = luaL_checkstring(L, arg);
+    size_t len;
+    const char *data = luaL_checklstring(L, arg + 1, &len);
+    size_t sent = WebSocket::broadcast(channel, {data, len}, lua_toboolean(L, arg + 2));
+    lua_pushinteger(L, static_cast<lua_Integer>(sent));
+    return 1;
+}
+
+// app.sse(path, function(stream, req) ... end): the handler runs once per
+// client; the stream then stays open, fed by stream:send and app.publish.
+static int lua_sse(lua_State *L)
+{
+    int arg = lua_istable(L, 1) ? 2 : 1; // app:sse(...) or app.sse(...)
+    std::string path = luaL_checkstring(L, arg);
+    luaL_checktype(L, arg + 1, LUA_TFUNCTION);
+    luaL_argcheck(L, !path.empty() && path[0] == '/', arg, "must start with '/'");
+
+    LumeniteApp::pushRegistryTable(L, LumeniteApp::EVENT_STREAMS_KEY);
+    lua_pushvalue(L, arg + 1);
+    lua_setfield(L, -2, path.c_str());
+    lua_pop(L, 1);
+    EventStream::route(path);
+    return 0;
+}
+
+// app.publish(channel, data[, event | {event, id, retry}]): formatted once,
+// written to every stream subscribed to `channel`; returns how many.
+static int lua_publish(lua_State *L)
+{
+    int arg = lua_istable(L, 1) ? 2 : 1;
+    std::string channel = luaL_checkstring(L, arg);
+    EventStream::Event event = EventStream::toEvent(L, arg + 1);
+    lua_pushinteger(L, static_cast<lua_Integer>(EventStream::publish(channel, event)));
+    return 1;
+}
+
+// Every worker under the master, or just this process without one.
+static int lua_worker_stats(lua_State *L)
+{
+    Prefork::pushStats(L);
+    return 1;
+}
+
+static int lua_connection_stats(lua_State *L)
+{
+    EventLoop::Stats st = EventLoop::stats();
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, static_cast<lua_Integer>(st.open));
+    lua_setfield(L, -2, "open");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.handshakeTimeouts));
+    lua_setfield(L, -2, "handshake_timeouts");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.headerTimeouts));
+    lua_setfield(L, -2, "header_timeouts");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.bodyTimeouts));
+    lua_setfield(L, -2, "body_timeouts");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.idleTimeouts));
+    lua_setfield(L, -2, "idle_timeouts");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.writeTimeouts));
+    lua_setfield(L, -2, "write_timeouts");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.headersTooLarge));
+    lua_setfield(L, -2, "headers_too_large");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.requestLimit));
+    lua_setfield(L, -2, "request_limit");
     return 1;
 }
 
+static int lua_overload_config(lua_State *L)
+{
+    int idx = lua_istable(L, 1) ? 1 : 2;
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    LoadShedder::Config cfg = LoadShedder::configuration();
+
+    lua_getfield(L, idx, "enabled");
+    if (!lua_isnil(L, -1)) cfg.enabled = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "target");
+    if (!lua_isnil(L, -1)) cfg.target = std::chrono::milliseconds(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "interval");
+    if (!lua_isnil(L, -1)) cfg.interval = std::chrono::milliseconds(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "retry_after");
+    if (!lua_isnil(L, -1)) cfg.retryAfter = std::chrono::seconds(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "exempt");
+    if (!lua_isnil(L, -1)) {
+        luaL_checktype(L, -1, LUA_TTABLE);
+        cfg.exempt.clear();
+        lua_Integer n = static_cast<lua_Integer>(lua_rawlen(L, -1));
+        for (lua_Integer i = 1; i <= n; ++i) {
+            lua_rawgeti(L, -1, i);
+            if (!lua_isstring(L, -1)) return luaL_error(L, "[Overload] exempt must be a list of path prefixes");
+            cfg.exempt.emplace_back(lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+
+    if (cfg.target.count() <= 0) return luaL_error(L, "[Overload] target must be positive");
+    if (cfg.interval < cfg.target) return luaL_error(L, "[Overload] interval must be at least target");
+    if (cfg.retryAfter.count() < 0) return luaL_error(L, "[Overload] retry_after must not be negative");
+
+    LoadShedder::configure(cfg);
+    return 0;
+}
+
+static int lua_overload_stats(lua_State *L)
+{
+    LoadShedder::Stats st = LoadShedder::stats();
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, static_cast<lua_Integer>(st.admitted));
+    lua_setfield(L, -2, "admitted");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.shed));
+    lua_setfield(L, -2, "shed");
+    lua_pushboolean(L, st.overloaded);
+    lua_setfield(L, -2, "overloaded");
+    lua_pushnumber(L, static_cast<lua_Number>(st.minWaitUs) / 1000.0);
+    lua_setfield(L, -2, "min_wait_ms");
+    return 1;
+}
+
+// Reload app.lua in the background; this request finishes on the old code.
+static int lua_reload(lua_State *L)
+{
+    lua_pushboolean(L, Server::reload());
+    return 1;
+}
+
+static int lua_sleep(lua_State *L)
+{
+    lua_Number seconds = luaL_checknumber(L, 1);
+    luaL_argcheck(L, seconds >= 0, 1, "must not be negative");
+    return Async::sleep(L, std::chrono::milliseconds(static_cast<long long>(seconds * 1000)));
+}
+
 static int lua_app_on_error(lua_State *L)
 {
     int arg_offset = 0;
@@ -262,8 +521,10 @@ static int lua_app_on_error(lua_State *L)
     int status = luaL_checkinteger(L, 1 + arg_offset);
     luaL_checktype(L, 2 + arg_offset, LUA_TFUNCTION);
 
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    LumeniteApp::on_abort_refs[status] = ref;
+    LumeniteApp::pushRegistryTable(L, LumeniteApp::ON_ERROR_KEY);
+    lua_pushvalue(L, 2 + arg_offset);
+    lua_rawseti(L, -2, status);
+    lua_pop(L, 1);
 
     return 0;
 }
@@ -279,9 +540,10 @@ int LumeniteApp::lua_before_request(lua_State *L)
         return luaL_error(L, "app.before_request expected a function like: app.before_request(function(req) ... end)");
     }
 
+    pushRegistryTable(L, BEFORE_REQUEST_KEY);
     lua_pushvalue(L, 1);
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    before_request_refs.push_back(ref);
+    lua_rawseti(L, -2, static_cast<lua_Integer>(lua_rawlen(L, -2)) + 1);
+    lua_pop(L, 1);
 
     return 0;
 }
@@ -297,16 +559,17 @@ int LumeniteApp::lua_after_request(lua_State *L)
             L, "app.after_request expected a function like: app.after_request(function(req, res) ... end)");
     }
 
+    pushRegistryTable(L, AFTER_REQUEST_KEY);
     lua_pushvalue(L, 1);
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    after_request_refs.push_back(ref);
+    lua_rawseti(L, -2, static_cast<lua_Integer>(lua_rawlen(L, -2)) + 1);
+    lua_pop(L, 1);
 
     return 0;
 }
 
 
 // ————— Lua API Binding Exposure —————
-void LumeniteApp::exposeBindings()
+void LumeniteApp::exposeBindings(lua_State *L)
 {
     lua_newtable(L); // app
 
@@ -323,12 +586,46 @@ void LumeniteApp::exposeBindings()
     lua_setfield(L, -2, "session_get");
     lua_pushcfunction(L, lua_session_set);
     lua_setfield(L, -2, "session_set");
+    lua_pushcfunction(L, lua_session_config);
+    lua_setfield(L, -2, "session_config");
+    lua_pushcfunction(L, lua_session_stats);
+    lua_setfield(L, -2, "session_stats");
+    lua_pushcfunction(L, lua_log_config);
+    lua_setfield(L, -2, "log_config");
+    lua_pushcfunction(L, lua_log_stats);
+    lua_setfield(L, -2, "log_stats");
+    lua_pushcfunction(L, lua_compression_config);
+    lua_setfield(L, -2, "compression_config");
+    lua_pushcfunction(L, lua_compression_stats);
+    lua_setfield(L, -2, "compression_stats");
+    lua_pushcfunction(L, lua_worker_stats);
+    lua_setfield(L, -2, "worker_stats");
+    lua_pushcfunction(L, lua_connection_stats);
+    lua_setfield(L, -2, "connection_stats");
+    lua_pushcfunction(L, lua_overload_config);
+    lua_setfield(L, -2, "overload_config");
+    lua_pushcfunction(L, lua_overload_stats);
+    lua_setfield(L, -2, "overload_stats");
+    lua_pushcfunction(L, lua_reload);
+    lua_setfield(L, -2, "reload");
 
     lua_pushcfunction(L, lua_http_get);
     lua_setfield(L, -2, "http_get");
+    lua_pushcfunction(L, lua_sleep);
+    lua_setfield(L, -2, "sleep");
 
     lua_pushcfunction(L, lua_send_file);
     lua_setfield(L, -2, "send_file");
+    lua_pushcfunction(L, lua_static);
+    lua_setfield(L, -2, "static");
+    lua_pushcfunction(L, lua_websocket);
+    lua_setfield(L, -2, "websocket");
+    lua_pushcfunction(L, lua_broadcast);
+    lua_setfield(L, -2, "broadcast");
+    lua_pushcfunction(L, lua_sse);
+    lua_setfield(L, -2, "sse");
+    lua_pushcfunction(L, lua_publish);
+    lua_setfield(L, -2, "publish");
 
 
     lua_pushcfunction(L, lua_json);
@@ -424,7 +721,7 @@ static int builtin_module_loader(lua_State *L)
 }
 
 
-void LumeniteApp::injectBuiltins()
+void LumeniteApp::injectBuiltins(lua_State *L)
 {
     lua_getglobal(L, "package");
     lua_newtable(L); // New searchers table
@@ -483,48 +780,38 @@ int LumeniteApp::lua_abort(lua_State *L)
 
 
 // ————— Route Handlers —————
-int LumeniteApp::lua_route_get(lua_State *L)
+int LumeniteApp::registerRoute(lua_State *L, const char *method, const char *name)
 {
     std::string path;
-    int hidx;
-    extract_route_args(L, "get", path, hidx);
+    int hidx = 0;
+    extract_route_args(L, name, path, hidx);
+    int id = Router::add(method, path);
+
+    pushRegistryTable(L, ROUTES_KEY);
     lua_pushvalue(L, hidx);
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    Router::add("GET", path, ref);
+    lua_rawseti(L, -2, id);
+    lua_pop(L, 1);
     return 0;
 }
 
+int LumeniteApp::lua_route_get(lua_State *L)
+{
+    return registerRoute(L, "GET", "get");
+}
+
 int LumeniteApp::lua_route_post(lua_State *L)
 {
-    std::string path;
-    int hidx;
-    extract_route_args(L, "post", path, hidx);
-    lua_pushvalue(L, hidx);
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    Router::add("POST", path, ref);
-    return 0;
+    return registerRoute(L, "POST", "post");
 }
 
 int LumeniteApp::lua_route_put(lua_State *L)
 {
-    std::string path;
-    int hidx;
-    extract_route_args(L, "put", path, hidx);
-    lua_pushvalue(L, hidx);
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    Router::add("PUT", path, ref);
-    return 0;
+    return registerRoute(L, "PUT", "put");
 }
 
 int LumeniteApp::lua_route_delete(lua_State *L)
 {
-    std::string path;
-    int hidx;
-    extract_route_args(L, "delete", path, hidx);
-    lua_pushvalue(L, hidx);
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    Router::add("DELETE", path, ref);
-    return 0;
+    return registerRoute(L, "DELETE", "delete");
 }
 
 // ————— Session Access —————
@@ -544,6 +831,163 @@ int LumeniteApp::lua_session_set(lua_State *L)
     return 0;
 }
 
+// app.session_config{ idle_timeout = secs, max_age = secs, max_sessions = n }
+int LumeniteApp::lua_session_config(lua_State *L)
+{
+    int idx = lua_istable(L, 1) ? 1 : 2;
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    SessionManager::Config cfg = SessionManager::configuration();
+
+    lua_getfield(L, idx, "idle_timeout");
+    if (!lua_isnil(L, -1)) cfg.idleTimeout = std::chrono::seconds(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "max_age");
+    if (!lua_isnil(L, -1)) cfg.maxAge = std::chrono::seconds(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "max_sessions");
+    if (!lua_isnil(L, -1)) cfg.maxSessions = static_cast<size_t>(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    if (cfg.idleTimeout.count() <= 0 || cfg.maxAge.count() <= 0)
+        return luaL_error(L, "[Session] idle_timeout and max_age must be positive");
+
+    SessionManager::configure(cfg);
+    return 0;
+}
+
+int LumeniteApp::lua_session_stats(lua_State *L)
+{
+    SessionManager::Stats st = SessionManager::stats();
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, static_cast<lua_Integer>(st.live));
+    lua_setfield(L, -2, "live");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.expired));
+    lua_setfield(L, -2, "expired");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.evicted));
+    lua_setfield(L, -2, "evicted");
+    return 1;
+}
+
+int LumeniteApp::lua_log_config(lua_State *L)
+{
+    int idx = lua_istable(L, 1) ? 1 : 2;
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    AccessLog::Config cfg = AccessLog::configuration();
+
+    lua_getfield(L, idx, "format");
+    if (!lua_isnil(L, -1)) {
+        std::string format = luaL_checkstring(L, -1);
+        if (format == "ansi") cfg.format = AccessLog::Format::Ansi;
+        else if (format == "plain") cfg.format = AccessLog::Format::Plain;
+        else if (format == "json") cfg.format = AccessLog::Format::Json;
+        else return luaL_error(L, "[Log] format must be \"ansi\", \"plain\" or \"json\", got \"%s\"", format.c_str());
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "file");
+    if (!lua_isnil(L, -1)) cfg.file = luaL_checkstring(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "max_bytes");
+    if (!lua_isnil(L, -1)) cfg.maxBytes = static_cast<uint64_t>(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "rotate_interval");
+    if (!lua_isnil(L, -1)) cfg.rotateEvery = std::chrono::seconds(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "buffer");
+    if (!lua_isnil(L, -1)) cfg.ringCapacity = static_cast<size_t>(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "flush_ms");
+    if (!lua_isnil(L, -1)) cfg.flushInterval = std::chrono::milliseconds(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    if (cfg.flushInterval.count() <= 0 || cfg.ringCapacity == 0)
+        return luaL_error(L, "[Log] buffer and flush_ms must be positive");
+
+    AccessLog::configure(cfg);
+    return 0;
+}
+
+int LumeniteApp::lua_log_stats(lua_State *L)
+{
+    AccessLog::Stats st = AccessLog::stats();
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, static_cast<lua_Integer>(st.written));
+    lua_setfield(L, -2, "written");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.dropped));
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.rotations));
+    lua_setfield(L, -2, "rotations");
+    return 1;
+}
+
+int LumeniteApp::lua_compression_config(lua_State *L)
+{
+    int idx = lua_istable(L, 1) ? 1 : 2;
+    luaL_checktype(L, idx, LUA_TTABLE);
+
+    Compression::Config cfg = Compression::configuration();
+
+    lua_getfield(L, idx, "enabled");
+    if (!lua_isnil(L, -1)) cfg.enabled = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "min_size");
+    if (!lua_isnil(L, -1)) cfg.minSize = static_cast<size_t>(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "level");
+    if (!lua_isnil(L, -1)) cfg.level = static_cast<int>(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "cache_bytes");
+    if (!lua_isnil(L, -1)) cfg.cacheBytes = static_cast<size_t>(luaL_checkinteger(L, -1));
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "types");
+    if (!lua_isnil(L, -1)) {
+        luaL_checktype(L, -1, LUA_TTABLE);
+        cfg.types.clear();
+        lua_Integer n = static_cast<lua_Integer>(lua_rawlen(L, -1));
+        for (lua_Integer i = 1; i <= n; ++i) {
+            lua_rawgeti(L, -1, i);
+            if (!lua_isstring(L, -1)) return luaL_error(L, "[Compression] types must be a list of strings");
+            cfg.types.emplace_back(lua_tostring(L, -1));
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+
+    if (cfg.level < 1 || cfg.level > 9) return luaL_error(L, "[Compression] level must be between 1 and 9");
+
+    Compression::configure(cfg);
+    return 0;
+}
+
+int LumeniteApp::lua_compression_stats(lua_State *L)
+{
+    Compression::Stats st = Compression::stats();
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, static_cast<lua_Integer>(st.compressed));
+    lua_setfield(L, -2, "compressed");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.cacheHits));
+    lua_setfield(L, -2, "cache_hits");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.bytesIn));
+    lua_setfield(L, -2, "bytes_in");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.bytesOut));
+    lua_setfield(L, -2, "bytes_out");
+    lua_pushinteger(L, static_cast<lua_Integer>(st.cachedBytes));
+    lua_setfield(L, -2, "cached_bytes");
+    return 1;
+}
+
 int LumeniteApp::lua_json(lua_State *L)
 {
     const char *jsonStr = luaL_checkstring(L, 1);
@@ -601,23 +1045,15 @@ int LumeniteApp::lua_send_file(lua_State *L)
         lua_pop(L, 1); // pop headers
     }
 
-    // Read a file
-    std::ifstream file(path, std::ios::binary);
+    // Open (or reuse) the descriptor; the body is streamed by the server.
+    FileHandle file = FileCache::open(path);
     if (!file) {
         raise_http_abort(L, 404, "File not found: " + path);
         luaL_error(L, "send_file: File not found: %s", path.c_str());
         return 0;
     }
 
-    std::ostringstream buffer;
-    buffer << file.rdbuf();
-    std::string body = buffer.str();
-
-    if (content_type.empty()) {
-        content_type = MimeDetector::toString(
-            MimeDetector::detect(reinterpret_cast<const uint8_t *>(body.data()), body.size(), path)
-        );
-    }
+    if (content_type.empty()) content_type = file->mime;
 
     std::string disposition = as_attachment ? "attachment" : "inline";
     if (!download_name.empty()) {
@@ -630,8 +1066,8 @@ int LumeniteApp::lua_send_file(lua_State *L)
     lua_pushinteger(L, status);
     lua_setfield(L, -2, "status");
 
-    lua_pushstring(L, body.c_str());
-    lua_setfield(L, -2, "body");
+    pushFile(L, std::move(file));
+    lua_setfield(L, -2, "file");
 
     lua_newtable(L);
     lua_pushstring(L, content_type.c_str());
@@ -712,7 +1148,7 @@ int LumeniteApp::lua_render_template_string(lua_State *L)
         root = TemplateValue{TemplateMap{}};
     }
 
-    auto [ok, result] = TemplateEngine::safeRenderFromString(tmpl, root);
+    auto [ok, result] = TemplateEngine::safeRenderFromString(tmpl, root, L);
     if (!ok) {
         return luaL_error(L, "[TemplateError.Render] %s", result.c_str());
     }
@@ -733,19 +1169,13 @@ int LumeniteApp::lua_render_template_file(lua_State *L)
     }
 
 
-    try {
-        std::string tmpl = TemplateEngine::loadTemplate(fn);
-        auto [ok, result] = TemplateEngine::safeRenderFromString(tmpl, root);
-
-        if (!ok) {
-            return luaL_error(L, "%s", result.c_str());
-        }
-
-        lua_pushstring(L, result.c_str());
-        return 1;
-    } catch (const std::exception &e) {
-        return luaL_error(L, "[TemplateError.TemplateNotFound] %s", e.what());
+    auto [ok, result] = TemplateEngine::safeRenderFile(fn, root, L);
+    if (!ok) {
+        return luaL_error(L, "%s", result.c_str());
     }
+
+    lua_pushlstring(L, result.data(), result.size());
+    return 1;
 }
 
 
@@ -782,11 +1212,117 @@ int LumeniteApp::lua_register_template_filter(lua_State *L)
 int LumeniteApp::lua_listen(lua_State *L)
 {
     int nargs = lua_gettop(L), port;
-    if (nargs == 1 && lua_isinteger(L, 1)) port = lua_tointeger(L, 1);
+    int opts = nargs == 1 && lua_istable(L, 1) ? 1 : nargs >= 2 && lua_istable(L, 2) ? 2 : 0;
+    bool tls = false;
+    Tls::Config tlsConfig;
+    ListenOptions listenOptions;
+
+    if (opts) {
+        // app.listen{port = 443, cert = "cert.pem", key = "key.pem"}
+        lua_getfield(L, opts, "port");
+        if (!lua_isinteger(L, -1)) return luaL_error(L, "expected an integer port in the listen options");
+        port = static_cast<int>(lua_tointeger(L, -1));
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "cert");
+        lua_getfield(L, opts, "key");
+        if (!lua_isnil(L, -2) || !lua_isnil(L, -1)) {
+            if (!lua_isstring(L, -2) || !lua_isstring(L, -1))
+                return luaL_error(L, "[TLS] cert and key must both be given as file paths");
+            tlsConfig.certFile = lua_tostring(L, -2);
+            tlsConfig.keyFile = lua_tostring(L, -1);
+            tls = true;
+        }
+        lua_pop(L, 2);
+
+        lua_getfield(L, opts, "session_cache");
+        if (!lua_isnil(L, -1)) tlsConfig.sessionCache = static_cast<long>(luaL_checkinteger(L, -1));
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "session_tickets");
+        if (!lua_isnil(L, -1)) tlsConfig.sessionTickets = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "io");
+        if (!lua_isnil(L, -1)) {
+            std::string backend = luaL_checkstring(L, -1);
+            if (backend == "io_uring") listenOptions.io = EventLoop::Backend::IoUring;
+            else if (backend != "epoll") return luaL_error(L, "io must be \"epoll\" or \"io_uring\"");
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "backlog");
+        if (!lua_isnil(L, -1)) {
+            lua_Integer backlog = luaL_checkinteger(L, -1);
+            if (backlog < 1 || backlog > INT_MAX) return luaL_error(L, "backlog must be a positive integer");
+            listenOptions.backlog = static_cast<int>(backlog);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "reuse_port");
+        if (!lua_isnil(L, -1)) listenOptions.reusePort = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "affinity");
+        if (!lua_isnil(L, -1)) listenOptions.affinity = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        // timeouts = {header = 10, body = 30, idle = 15, write = 30, handshake = 10}, in seconds; 0 = none
+        lua_getfield(L, opts, "timeouts");
+        if (!lua_isnil(L, -1)) {
+            luaL_checktype(L, -1, LUA_TTABLE);
+            ConnectionLimits &limits = listenOptions.limits;
+            std::pair<const char *, std::chrono::seconds *> fields[] = {
+                {"handshake", &limits.handshake}, {"header", &limits.header}, {"body", &limits.body},
+                {"idle", &limits.idle}, {"write", &limits.write}
+            };
+            for (auto &[name, limit]: fields) {
+                lua_getfield(L, -1, name);
+                if (!lua_isnil(L, -1)) {
+                    lua_Integer seconds = luaL_checkinteger(L, -1);
+                    if (seconds < 0) return luaL_error(L, "timeouts.%s must not be negative", name);
+                    *limit = std::chrono::seconds(seconds);
+                }
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "max_requests");
+        if (!lua_isnil(L, -1)) {
+            lua_Integer requests = luaL_checkinteger(L, -1);
+            if (requests < 0 || requests > UINT_MAX) return luaL_error(L, "max_requests must be 0 or more");
+            listenOptions.limits.maxRequests = static_cast<unsigned>(requests);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, opts, "max_header_bytes");
+        if (!lua_isnil(L, -1)) {
+            lua_Integer bytes = luaL_checkinteger(L, -1);
+            if (bytes < 1 || bytes > UINT32_MAX) return luaL_error(L, "max_header_bytes must be a positive integer");
+            listenOptions.limits.maxHeaderBytes = static_cast<size_t>(bytes);
+        }
+        lua_pop(L, 1);
+    } else if (nargs == 1 && lua_isinteger(L, 1)) port = lua_tointeger(L, 1);
     else if (nargs >= 2 && lua_isinteger(L, 2)) port = lua_tointeger(L, 2);
     else return luaL_error(L, "expected an integer port as argument");
 
-    Server srv(port, L);
+    // Worker states replay app.lua only to pick up routes and hooks.
+    lua_getfield(L, LUA_REGISTRYINDEX, WORKER_KEY);
+    bool worker = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    if (worker) return 0;
+
+    if (tls) {
+        try {
+            Tls::configure(tlsConfig);
+        } catch (const std::exception &e) {
+            std::string message = e.what();
+            return luaL_error(L, "[TLS] %s", message.c_str());
+        }
+    }
+
+    Server srv(port, listenOptions);
     listening = true;
     srv.run();
     return 0;
@@ -3,6 +3,7 @@
 #include <unordered_map>
 #include "Router.h"
 #include "SessionManager.h"
+#include "utils/FileCache.h"
 #include "json/value.h"
 #define PKG_MNGR_NAME "LPM"
 
@@ -24,19 +25,44 @@ public:
 
     int loadScript(const std::string &path) const;
 
-    static std::vector<int> before_request_refs;
-    static std::vector<int> after_request_refs;
-    static std::unordered_map<int, int> on_abort_refs;
+    // Build a fresh interpreter with the app bindings and module loader.
+    static lua_State *newState();
 
+    // Run the app script inside a worker state. app.listen() only records
+    // the call there, so the script returns once routes and hooks are set.
+    static bool loadWorkerScript(lua_State *L, std::string &error);
+
+    // Get (or create) a table in the state's registry.
+    static void pushRegistryTable(lua_State *L, const char *key);
+
+    // File-backed response bodies travel through Lua as this userdata.
+    static void pushFile(lua_State *L, FileHandle file);
+
+    static FileHandle toFile(lua_State *L, int idx);
+
+    static constexpr auto FILE_METATABLE = "Lumenite.File";
+
+    // Registry tables holding what app.lua registered in one state.
+    static constexpr auto ROUTES_KEY = "lumenite.routes";
+    static constexpr auto BEFORE_REQUEST_KEY = "lumenite.before_request";
+    static constexpr auto AFTER_REQUEST_KEY = "lumenite.after_request";
+    static constexpr auto ON_ERROR_KEY = "lumenite.on_error";
+    static constexpr auto WEBSOCKETS_KEY = "lumenite.websockets"; // path -> handlers
+    static constexpr auto EVENT_STREAMS_KEY = "lumenite.event_streams"; // path -> handler
+    static constexpr auto WORKER_KEY = "lumenite.worker";
+
+    static std::string scriptPath;
 
     static bool listening;
 
 private:
     lua_State *L;
 
-    void exposeBindings();
+    static void exposeBindings(lua_State *L);
+
+    static void injectBuiltins(lua_State *L);
 
-    void injectBuiltins();
+    static int registerRoute(lua_State *L, const char *method, const char *name);
 
 
     static int lua_route_get(lua_State *L);
@@ -51,6 +77,18 @@ private:
 
     static int lua_session_set(lua_State *L);
 
+    static int lua_session_config(lua_State *L);
+
+    static int lua_session_stats(lua_State *L);
+
+    static int lua_log_config(lua_State *L);
+
+    static int lua_log_stats(lua_State *L);
+
+    static int lua_compression_config(lua_State *L);
+
+    static int lua_compression_stats(lua_State *L);
+
     static int lua_json(lua_State *L);
 
     static int lua_send_file(lua_State *L);
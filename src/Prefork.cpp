@@ -0,0 +1,342 @@
+#include "Prefork.h"
+#include "LumeniteApp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#ifdef __linux__
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+unsigned Prefork::processes = 1;
+
+// How a master tells a worker what it is; read once, at first use.
+static constexpr auto WORKER_ENV = "LUMENITE_WORKER"; // "index/count"
+static constexpr auto LISTEN_FDS_ENV = "LUMENITE_LISTEN_FDS"; // "3,4,5"
+static constexpr auto STATS_FD_ENV = "LUMENITE_STATS_FD";
+
+// A worker that dies sooner than this after starting is restarted with a
+// growing delay, so a script that cannot start does not spin the master.
+static constexpr std::chrono::seconds QUICK_EXIT{1};
+static constexpr std::chrono::seconds MAX_BACKOFF{16};
+
+struct Prefork::Environment
+{
+    bool worker = false;
+    unsigned index = 0;
+    unsigned count = 1;
+    std::vector<int> listeners;
+    Slot *slots = nullptr; // `count` of them, shared with the master
+};
+
+const Prefork::Environment &Prefork::environment()
+{
+    static const Environment env = []
+    {
+        Environment e;
+#ifdef __linux__
+        const char *worker = std::getenv(WORKER_ENV);
+        const char *fds = std::getenv(LISTEN_FDS_ENV);
+        const char *stats = std::getenv(STATS_FD_ENV);
+        if (!worker || !fds || !stats) return e;
+        if (std::sscanf(worker, "%u/%u", &e.index, &e.count) != 2 || e.count == 0 || e.index >= e.count) {
+            e.index = 0;
+            e.count = 1;
+            return e;
+        }
+        for (const char *p = fds; *p;) {
+            char *end;
+            long fd = std::strtol(p, &end, 10);
+            if (end == p) break;
+            e.listeners.push_back(static_cast<int>(fd));
+            p = *end == ',' ? end + 1 : end;
+        }
+        int statsFd = std::atoi(stats);
+        void *shared = mmap(nullptr, e.count * sizeof(Slot), PROT_READ | PROT_WRITE, MAP_SHARED, statsFd, 0);
+        close(statsFd);
+        if (shared != MAP_FAILED) e.slots = static_cast<Slot *>(shared);
+        e.worker = true;
+        // Not passed on to anything this worker starts.
+        unsetenv(WORKER_ENV);
+        unsetenv(LISTEN_FDS_ENV);
+        unsetenv(STATS_FD_ENV);
+#endif
+        return e;
+    }();
+    return env;
+}
+
+bool Prefork::worker()
+{
+    return environment().worker;
+}
+
+unsigned Prefork::index()
+{
+    return environment().index;
+}
+
+unsigned Prefork::count()
+{
+    return environment().count;
+}
+
+std::vector<int> Prefork::inherited()
+{
+    return environment().listeners;
+}
+
+Prefork::Slot &Prefork::self()
+{
+    const Environment &env = environment();
+    if (env.slots) return env.slots[env.index];
+    static Slot *local = []
+    {
+        auto *s = new Slot();
+#ifdef __linux__
+        s->pid = getpid();
+#endif
+        s->started = static_cast<int64_t>(std::time(nullptr));
+        return s;
+    }();
+    return *local;
+}
+
+void Prefork::pushStats(lua_State *L)
+{
+    const Environment &env = environment();
+    unsigned n = env.slots ? env.count : 1;
+    const Slot *slots = env.slots ? env.slots : &self();
+
+    uint64_t requests = 0, restarts = 0;
+    lua_createtable(L, static_cast<int>(n), 3);
+    for (unsigned i = 0; i < n; ++i) {
+        const Slot &s = slots[i];
+        uint64_t served = s.requests.load(std::memory_order_relaxed);
+        requests += served;
+        restarts += s.restarts;
+        lua_createtable(L, 0, 4);
+        lua_pushinteger(L, static_cast<lua_Integer>(s.pid.load()));
+        lua_setfield(L, -2, "pid");
+        lua_pushinteger(L, static_cast<lua_Integer>(s.started.load()));
+        lua_setfield(L, -2, "started");
+        lua_pushinteger(L, static_cast<lua_Integer>(s.restarts.load()));
+        lua_setfield(L, -2, "restarts");
+        lua_pushinteger(L, static_cast<lua_Integer>(served));
+        lua_setfield(L, -2, "requests");
+        lua_rawseti(L, -2, static_cast<lua_Integer>(i) + 1);
+    }
+    lua_pushinteger(L, n);
+    lua_setfield(L, -2, "workers");
+    lua_pushinteger(L, static_cast<lua_Integer>(requests));
+    lua_setfield(L, -2, "requests");
+    lua_pushinteger(L, static_cast<lua_Integer>(restarts));
+    lua_setfield(L, -2, "restarts");
+}
+
+// —————————————————————————————————————————————
+// Master
+// —————————————————————————————————————————————
+
+#ifdef __linux__
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Child
+    {
+        pid_t pid = 0;
+        Clock::time_point since;
+        Clock::time_point restartAt;
+        std::chrono::seconds backoff{0};
+    };
+
+    // Everything exec needs, built before fork: between the two the child
+    // may only make async-signal-safe calls.
+    struct Launch
+    {
+        std::string binary;
+        std::vector<std::string> strings;
+        std::vector<char *> argv;
+        std::vector<char *> envp;
+    };
+
+    Launch prepare(unsigned index, unsigned count, const std::vector<int> &listeners, int statsFd)
+    {
+        Launch l;
+        // The real path rather than /proc/self/exe, so the workers are not all named "exe".
+        char path[4096];
+        ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        l.binary = len > 0 ? std::string(path, static_cast<size_t>(len)) : "/proc/self/exe";
+        std::string fds;
+        for (int fd: listeners) fds += (fds.empty() ? "" : ",") + std::to_string(fd);
+
+        l.strings.emplace_back("lumenite");
+        l.strings.push_back(LumeniteApp::scriptPath);
+        size_t args = l.strings.size();
+        for (char **e = environ; *e; ++e) {
+            std::string_view var = *e;
+            if (var.starts_with(WORKER_ENV) || var.starts_with(LISTEN_FDS_ENV) || var.starts_with(STATS_FD_ENV))
+                continue;
+            l.strings.emplace_back(var);
+        }
+        l.strings.push_back(std::string(WORKER_ENV) + "=" + std::to_string(index) + "/" + std::to_string(count));
+        l.strings.push_back(std::string(LISTEN_FDS_ENV) + "=" + fds);
+        l.strings.push_back(std::string(STATS_FD_ENV) + "=" + std::to_string(statsFd));
+
+        for (size_t i = 0; i < l.strings.size(); ++i)
+            (i < args ? l.argv : l.envp).push_back(l.strings[i].data());
+        l.argv.push_back(nullptr);
+        l.envp.push_back(nullptr);
+        return l;
+    }
+
+    pid_t spawn(const Launch &launch, const std::vector<int> &inherit, pid_t master)
+    {
+        pid_t pid = fork();
+        if (pid != 0) return pid;
+
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, nullptr);
+        // Workers go down with the master, however it goes.
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != master) _exit(1);
+        for (int fd: inherit) fcntl(fd, F_SETFD, 0);
+        execve(launch.binary.c_str(), launch.argv.data(), launch.envp.data());
+        _exit(127);
+    }
+
+    void report(unsigned index, pid_t pid, int status)
+    {
+        std::cerr << "\033[33m[Master]\033[0m worker " << index << " (pid " << pid << ") ";
+        if (WIFSIGNALED(status)) std::cerr << "killed by signal " << WTERMSIG(status);
+        else std::cerr << "exited with status " << WEXITSTATUS(status);
+        std::cerr << ", restarting\n";
+    }
+}
+
+[[noreturn]] void Prefork::supervise(const std::vector<int> &listeners)
+{
+    const unsigned n = std::max(1u, processes);
+    const pid_t master = getpid();
+
+    int statsFd = memfd_create("lumenite-workers", MFD_CLOEXEC);
+    void *shared = MAP_FAILED;
+    if (statsFd >= 0 && ftruncate(statsFd, static_cast<off_t>(n * sizeof(Slot))) == 0)
+        shared = mmap(nullptr, n * sizeof(Slot), PROT_READ | PROT_WRITE, MAP_SHARED, statsFd, 0);
+    if (shared == MAP_FAILED) {
+        std::cerr << "\033[31m[Master]\033[0m Could not share worker stats: " << std::strerror(errno) << "\n";
+        std::exit(1);
+    }
+    auto *slots = static_cast<Slot *>(shared);
+    for (unsigned i = 0; i < n; ++i) new(&slots[i]) Slot();
+
+    std::vector<int> inherit(listeners);
+    inherit.push_back(statsFd);
+    std::vector<Launch> launches;
+    for (unsigned i = 0; i < n; ++i) launches.push_back(prepare(i, n, listeners, statsFd));
+
+    // Taken with sigtimedwait() below rather than by handlers.
+    sigset_t watched;
+    sigemptyset(&watched);
+    sigaddset(&watched, SIGCHLD);
+    sigaddset(&watched, SIGINT);
+    sigaddset(&watched, SIGTERM);
+    sigaddset(&watched, SIGHUP);
+    sigprocmask(SIG_BLOCK, &watched, nullptr);
+
+    std::vector<Child> children(n);
+    auto start = [&](unsigned i)
+    {
+        Child &c = children[i];
+        c.pid = spawn(launches[i], inherit, master);
+        if (c.pid < 0) {
+            std::cerr << "\033[31m[Master]\033[0m fork failed: " << std::strerror(errno) << "\n";
+            c.pid = 0;
+            c.restartAt = Clock::now() + MAX_BACKOFF;
+            return;
+        }
+        c.since = Clock::now();
+        slots[i].pid = c.pid;
+        slots[i].started = static_cast<int64_t>(std::time(nullptr));
+    };
+    for (unsigned i = 0; i < n; ++i) start(i);
+    std::cerr << "\033[1;36m *\033[0m Master " << master << " running " << n << " workers\n";
+
+    bool stopping = false;
+    while (true) {
+        // Sleep until a signal, or the next delayed restart is due.
+        auto wake = Clock::time_point::max();
+        for (const Child &c: children)
+            if (!c.pid && !stopping) wake = std::min(wake, c.restartAt);
+        siginfo_t info;
+        int sig;
+        if (wake == Clock::time_point::max()) {
+            sig = sigwaitinfo(&watched, &info);
+        } else {
+            auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::max(Clock::duration::zero(), wake - Clock::now()));
+            timespec ts{static_cast<time_t>(wait.count() / 1'000'000'000), static_cast<long>(wait.count() % 1'000'000'000)};
+            sig = sigtimedwait(&watched, &info, &ts);
+        }
+
+        if (sig == SIGHUP && !stopping) {
+            // Each worker reloads its own states; none is restarted.
+            std::cerr << "\033[1;36m *\033[0m Master reloading " << n << " workers\n";
+            for (const Child &c: children)
+                if (c.pid) kill(c.pid, SIGHUP);
+        }
+
+        if (sig == SIGINT || sig == SIGTERM) {
+            // A second one does not wait for them.
+            for (const Child &c: children)
+                if (c.pid) kill(c.pid, stopping ? SIGKILL : SIGTERM);
+            stopping = true;
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto it = std::find_if(children.begin(), children.end(), [pid](const Child &c) { return c.pid == pid; });
+            if (it == children.end()) continue;
+            auto i = static_cast<unsigned>(it - children.begin());
+            it->pid = 0;
+            slots[i].pid = 0;
+            if (stopping) continue;
+            report(i, pid, status);
+            bool quick = Clock::now() - it->since < QUICK_EXIT;
+            it->backoff = quick ? std::min(MAX_BACKOFF, std::max(std::chrono::seconds(1), it->backoff * 2))
+                                : std::chrono::seconds(0);
+            it->restartAt = Clock::now() + it->backoff;
+        }
+
+        if (stopping) {
+            if (std::none_of(children.begin(), children.end(), [](const Child &c) { return c.pid != 0; }))
+                std::exit(0);
+            continue;
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            if (children[i].pid || Clock::now() < children[i].restartAt) continue;
+            start(i);
+            ++slots[i].restarts;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+extern "C"
+{
+#include "lua.h"
+}
+
+
+/// `lumenite --workers N`: the master loads the app, binds the listeners
+/// and keeps N worker processes serving them, starting a new one whenever
+/// one exits. A worker is this binary run afresh on the same script with
+/// the listeners inherited, so it has its own Lua heaps, its own collector
+/// and its own copy of every C module; a crash or a long GC pause stays in
+/// one process. Workers count what they serve in a table shared with the
+/// master, which app.worker_stats() reads across all of them.
+class Prefork
+{
+public:
+    // One per worker, in memory shared by the master and every worker.
+    struct alignas(64) Slot
+    {
+        std::atomic<int64_t> pid{0}; // 0 while down
+        std::atomic<int64_t> started{0}; // unix time the current process started
+        std::atomic<uint64_t> restarts{0};
+        std::atomic<uint64_t> requests{0}; // since the master started
+    };
+
+    // From the command line; more than 1 makes app:listen start a master.
+    static unsigned processes;
+
+    // This process was started by a master.
+    static bool worker();
+
+    // Which worker this is (0-based), and of how many; 0 and 1 otherwise.
+    static unsigned index();
+
+    static unsigned count();
+
+    // The master's listeners, in the order it opened them.
+    static std::vector<int> inherited();
+
+    // Become the master of `processes` workers on `listeners`. Returns
+    // only by exiting, on SIGINT or SIGTERM once the workers are down.
+    // SIGHUP is passed on, for each worker to reload. Linux only.
+    [[noreturn]] static void supervise(const std::vector<int> &listeners);
+
+    static void countRequest() { self().requests.fetch_add(1, std::memory_order_relaxed); }
+
+    // { workers = n, requests = sum, restarts = sum, { pid = ..., ... }, ... }
+    static void pushStats(lua_State *L);
+
+private:
+    struct Environment;
+
+    static const Environment &environment();
+
+    static Slot &self();
+};
@@ -1,59 +1,117 @@
 #include "Router.h"
-#include <regex>
-#include <cctype>
+#include <algorithm>
 
-std::vector<Route> Router::routes;
+Router::Table Router::mainTable;
+thread_local Router::Table *Router::loading = nullptr;
 
-static std::string buildRegexPattern(const std::string &pattern)
+static size_t commonPrefix(std::string_view a, std::string_view b)
 {
-    std::string pat = "^";
-    pat.reserve(pattern.size() * 2); // avoid repeated reallocation
-
-    for (size_t i = 0; i < pattern.size();) {
-        if (pattern[i] == '<') {
-            // skip until closing >
-            while (i < pattern.size() && pattern[i] != '>') ++i;
-            ++i; // skip '>'
-            pat += R"(([^/]+))";
-        } else {
-            if (std::ispunct(static_cast<unsigned char>(pattern[i]))) {
-                pat += '\\';
-            }
-            pat += pattern[i++];
+    size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+// Insert the rest of a pattern below `node`; returns the node it ends at.
+static RouteNode *insert(RouteNode *node, std::string_view pattern)
+{
+    while (!pattern.empty()) {
+        if (pattern.front() == '<') {
+            size_t close = pattern.find('>');
+            pattern.remove_prefix(close == std::string_view::npos ? pattern.size() : close + 1);
+            if (!node->param) node->param = std::make_unique<RouteNode>();
+            node = node->param.get();
+            continue;
+        }
+
+        size_t run = std::min(pattern.find('<'), pattern.size());
+        std::string_view literal = pattern.substr(0, run);
+
+        auto it = std::find_if(node->children.begin(), node->children.end(),
+                               [&](const auto &c) { return c->prefix.front() == literal.front(); });
+
+        if (it == node->children.end()) {
+            auto child = std::make_unique<RouteNode>();
+            child->prefix.assign(literal);
+            node->children.push_back(std::move(child));
+            node = node->children.back().get();
+            pattern.remove_prefix(run);
+            continue;
+        }
+
+        RouteNode *child = it->get();
+        size_t common = commonPrefix(child->prefix, literal);
+
+        if (common < child->prefix.size()) {
+            // Split the edge: the shared part becomes a new parent.
+            auto mid = std::make_unique<RouteNode>();
+            mid->prefix = child->prefix.substr(0, common);
+            child->prefix.erase(0, common);
+            mid->children.push_back(std::move(*it));
+            *it = std::move(mid);
+            child = it->get();
+        }
+
+        node = child;
+        pattern.remove_prefix(common);
+    }
+    return node;
+}
+
+static int lookup(const RouteNode *node, std::string_view path, std::vector<std::string_view> &args)
+{
+    if (path.empty()) return node->routeId;
+
+    for (const auto &child: node->children) {
+        if (child->prefix.front() != path.front()) continue;
+        if (path.substr(0, child->prefix.size()) == child->prefix) {
+            if (int id = lookup(child.get(), path.substr(child->prefix.size()), args)) return id;
         }
+        break;
     }
 
-    pat += '$';
-    return pat;
+    if (node->param) {
+        // Greedy like the old ([^/]+), backing off only when a literal
+        // suffix inside the same segment ("<name>.txt") needs the bytes.
+        size_t end = std::min(path.find('/'), path.size());
+        for (size_t len = end; len > 0; --len) {
+            args.push_back(path.substr(0, len));
+            if (int id = lookup(node->param.get(), path.substr(len), args)) return id;
+            args.pop_back();
+        }
+    }
+    return 0;
 }
 
-void Router::add(const std::string &method,
-                 const std::string &pattern,
-                 int luaRef)
+int Router::Table::add(const std::string &method,
+                       const std::string &pattern)
 {
-    std::string regexStr = buildRegexPattern(pattern);
-    std::regex compiled(regexStr);
-    routes.push_back({method, pattern, std::move(compiled), luaRef});
+    std::lock_guard<std::mutex> lock(mutex);
+    RouteNode *end = insert(&roots[method], pattern);
+    if (!end->routeId) end->routeId = nextId++;
+    return end->routeId;
 }
 
-bool Router::match(const std::string &method,
-                   const std::string &path,
-                   int &luaRef,
-                   std::vector<std::string> &args)
+bool Router::Table::match(std::string_view method,
+                          std::string_view path,
+                          int &routeId,
+                          std::vector<std::string_view> &args) const
 {
-    for (const auto &R: routes) {
-        if (R.method != method) continue;
-
-        std::smatch m;
-        if (std::regex_match(path, m, R.compiled)) {
-            args.clear();
-            args.reserve(m.size() - 1);
-            for (size_t j = 1; j < m.size(); ++j)
-                args.emplace_back(m[j].str());
-
-            luaRef = R.luaRef;
-            return true;
-        }
-    }
-    return false;
+    auto root = roots.find(method);
+    if (root == roots.end()) return false;
+
+    args.clear();
+    routeId = lookup(&root->second, path, args);
+    return routeId != 0;
+}
+
+int Router::add(const std::string &method,
+                const std::string &pattern)
+{
+    return (loading ? *loading : mainTable).add(method, pattern);
+}
+
+void Router::loadInto(Table *table)
+{
+    loading = table;
 }
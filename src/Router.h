@@ -1,33 +1,72 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
-#include <regex>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
-struct Route
+// One edge of the per-method radix trie.
+// Static edges carry the literal bytes they consume in `prefix`; a `<param>`
+// segment is the node's single `param` child and consumes one or more
+// non-'/' bytes.
+struct RouteNode
 {
-    std::string method;
-    std::string pattern;
-    std::regex compiled;
-    int luaRef;
+    std::string prefix;
+    std::vector<std::unique_ptr<RouteNode> > children; // distinct first byte each
+    std::unique_ptr<RouteNode> param;
+    int routeId = 0; // non-zero when a route ends here
 };
 
 class Router
 {
 public:
-    // Add a route to the router
-    static void add(const std::string &method,
-                    const std::string &pattern,
-                    int luaRef);
-
-    // Match a route to a request
-    // Returns true if a match was found, false otherwise
-    // If a match was found, the luaRef and args are set
-    // (ai)
-    static bool match(const std::string &method,
-                      const std::string &path,
-                      int &luaRef,
-                      std::vector<std::string> &args);
+    // The routes of one load of app.lua. Every state loaded from it
+    // registers the same routes, so adding an existing method + pattern
+    // returns the id it already has. Each state keeps its own handler for
+    // that id in its registry.
+    class Table
+    {
+    public:
+        // Add a route and return its id.
+        int add(const std::string &method,
+                const std::string &pattern);
+
+        // Match a route to a request
+        // Returns true if a match was found, false otherwise
+        // If a match was found, the routeId and args are set; args point into `path`.
+        // Literal segments win over <param> segments at the same position.
+        // Lock-free: the table is complete before it serves.
+        bool match(std::string_view method,
+                   std::string_view path,
+                   int &routeId,
+                   std::vector<std::string_view> &args) const;
+
+    private:
+        // Lets match() look a method up by string_view without a copy.
+        struct MethodHash
+        {
+            using is_transparent = void;
+
+            size_t operator()(std::string_view method) const { return std::hash<std::string_view>{}(method); }
+        };
+
+        std::unordered_map<std::string, RouteNode, MethodHash, std::equal_to<> > roots;
+        int nextId = 1;
+        std::mutex mutex;
+    };
+
+    // Add a route to the table this thread is loading into (see loadInto),
+    // or to the main state's own one outside a load.
+    static int add(const std::string &method,
+                   const std::string &pattern);
+
+    // Until called again, add() on this thread goes to `table` (null: back
+    // to the main state's).
+    static void loadInto(Table *table);
 
 private:
-    static std::vector<Route> routes;
+    static Table mainTable;
+    static thread_local Table *loading;
 };
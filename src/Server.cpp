@@ -5,18 +5,37 @@
 #include "LumeniteApp.h"
 #include "SessionManager.h"
 #include "ErrorHandler.h"
+#include "EventLoop.h"
+#include "LuaStatePool.h"
+#include "AccessLog.h"
+#include "Async.h"
+#include "StaticFiles.h"
+#include "Compression.h"
+#include "Tls.h"
+#include "WebSocket.h"
+#include "EventStream.h"
+#include "Prefork.h"
+#include "TemplateEngine.h"
+#include "LoadShedder.h"
 
 #include <json/json.h>
 
 #include <iostream>
-#include <iomanip>
 #include <sstream>
 #include <vector>
 #include <string>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <condition_variable>
 #include <algorithm>
+#include <iterator>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -31,8 +50,15 @@ typedef SOCKET SocketType;
   #include <arpa/inet.h>
   #include <unistd.h>
   #include <ifaddrs.h>
+  #include <fcntl.h>
+  #include <csignal>
   typedef int SocketType;
 #endif
+#ifdef __linux__
+  #include <linux/filter.h>
+  #include <pthread.h>
+  #include <sched.h>
+#endif
 
 static constexpr auto DEFAULT_CONTENT_TYPE = "text/html";
 
@@ -111,45 +137,65 @@ static const std::unordered_map<int, std::string> statusMessages = {
     {511, "Network Authentication Required"},
 };
 
-std::string getColorForStatus(int code)
+// "HTTP/1.1 <code> <reason>\r\n" for every code, rendered once.
+static const std::string &statusLine(int code)
 {
-    if (code >= 100 && code < 200) return MAGENTA; // Informational
-    if (code >= 200 && code < 300) return GREEN; // Success
-    if (code >= 300 && code < 400) return CYAN; // Redirection
-    if (code == 400) return BOLD YELLOW; // Bad Request
-    if (code == 401 || code == 403) return BOLD MAGENTA; // Unauthorized / Forbidden
-    if (code == 404) return BOLD BLUE; // Not Found
-    if (code >= 400 && code < 500) return YELLOW; // Other Client Errors
-    if (code == 500) return BOLD RED; // Internal Server Error
-    if (code >= 500 && code < 600) return RED; // Other Server Errors
-    return RESET; // Unknown or custom
+    static const std::vector<std::string> lines = []
+    {
+        std::vector<std::string> v(600);
+        for (int c = 100; c < 600; ++c) {
+            auto it = statusMessages.find(c);
+            v[c] = "HTTP/1.1 " + std::to_string(c) + " " + (it != statusMessages.end() ? it->second : "Unknown") + "\r\n";
+        }
+        return v;
+    }();
+    if (code >= 100 && code < 600) return lines[code];
+
+    thread_local std::string custom;
+    custom = "HTTP/1.1 " + std::to_string(code) + " Unknown\r\n";
+    return custom;
 }
 
+static constexpr std::string_view KEEP_ALIVE_FIELD = "Connection: keep-alive\r\n";
+static constexpr std::string_view CLOSE_FIELD = "Connection: close\r\n";
+static constexpr std::string_view LENGTH_FIELD = "Content-Length: ";
+static constexpr std::string_view CHUNKED_FIELD = "Transfer-Encoding: chunked\r\n\r\n";
+static constexpr std::string_view LAST_CHUNK = "0\r\n\r\n";
 
-Server::Server(int port_, lua_State *L_)
-    : port(port_), L(L_)
+std::string HttpResponse::serializeHead(bool keepAlive) const
 {
+    const std::string &line = statusLine(status);
+    std::string length = std::to_string(file ? file->size : body.size());
+
+    size_t size = line.size() + KEEP_ALIVE_FIELD.size() + LENGTH_FIELD.size() + length.size() + 4;
+    for (auto &[k, v]: headers) size += k.size() + v.size() + 4;
+
+    std::string out;
+    out.reserve(size);
+    out += line;
+    for (auto &[k, v]: headers) {
+        out += k;
+        out += ": ";
+        out += v;
+        out += "\r\n";
+    }
+    out += keepAlive ? KEEP_ALIVE_FIELD : CLOSE_FIELD;
+    if (chunked) {
+        out += CHUNKED_FIELD;
+        return out;
+    }
+    out += LENGTH_FIELD;
+    out += length;
+    out += "\r\n\r\n";
+    return out;
 }
 
-
-static std::string urlDecode(const std::string &value)
+Server::Server(int port_, ListenOptions options_)
+    : port(port_), options(options_)
 {
-    std::ostringstream result;
-    for (size_t i = 0; i < value.size(); ++i) {
-        if (value[i] == '+') {
-            result << ' ';
-        } else if (value[i] == '%' && i + 2 < value.size()) {
-            int hex = 0;
-            std::istringstream(value.substr(i + 1, 2)) >> std::hex >> hex;
-            result << static_cast<char>(hex);
-            i += 2;
-        } else {
-            result << value[i];
-        }
-    }
-    return result.str();
 }
 
+
 // Case-insensitive header lookup
 static std::string getHeaderValue(const std::unordered_map<std::string, std::string> &h, const std::string &key)
 {
@@ -198,9 +244,10 @@ static void printLocalIPs(int port)
     }
 #endif
 
+    const char *scheme = Tls::context() ? "https" : "http";
     std::cout << "\033[1;36m *\033[0m \033[1mLumenite Server\033[0m running at:\n";
     for (auto &ip: addrs)
-        std::cout << "   \033[1m->\033[0m \033[33mhttp://" << ip << ":" << port << "\033[0m\n";
+        std::cout << "   \033[1m->\033[0m \033[33m" << scheme << "://" << ip << ":" << port << "\033[0m\n";
     std::cout << "\033[1;36m *\033[0m Press \033[1mCTRL+C\033[0m to quit\n";
 }
 
@@ -208,69 +255,172 @@ static void printLocalIPs(int port)
 // Lua integration helpers (pulled from original):
 // —————————————————————————————————————————————
 
-static void push_lua_request(lua_State *L, const HttpRequest &req)
+static void push_lua_string(lua_State *L, std::string_view s)
 {
-    lua_newtable(L);
-    lua_pushstring(L, "method");
-    lua_pushstring(L, req.method.c_str());
-    lua_settable(L, -3);
-    lua_pushstring(L, "path");
-    lua_pushstring(L, req.path.c_str());
-    lua_settable(L, -3);
-    lua_pushstring(L, "body");
-    lua_pushstring(L, req.body.c_str());
-    lua_settable(L, -3);
-    lua_pushstring(L, "remote_ip");
-    lua_pushstring(L, req.remote_ip.c_str());
-    lua_settable(L, -3);
+    lua_pushlstring(L, s.data(), s.size());
+}
 
-    lua_pushstring(L, "headers");
+// A name seen once maps to its value; repeated names collect into an array.
+static void push_lua_fields(lua_State *L, const std::vector<HttpField> &fields)
+{
     lua_newtable(L);
-    for (auto &h: req.headers) {
-        lua_pushstring(L, h.first.c_str());
-        lua_pushstring(L, h.second.c_str());
-        lua_settable(L, -3);
+    for (auto &[k, v]: fields) {
+        push_lua_string(L, k);
+        int existing = lua_rawget(L, -2);
+        if (existing == LUA_TNIL) {
+            lua_pop(L, 1);
+            push_lua_string(L, k);
+            push_lua_string(L, v);
+            lua_rawset(L, -3);
+        } else if (existing == LUA_TTABLE) {
+            push_lua_string(L, v);
+            lua_rawseti(L, -2, static_cast<lua_Integer>(lua_rawlen(L, -2)) + 1);
+            lua_pop(L, 1);
+        } else {
+            lua_createtable(L, 2, 0);
+            lua_insert(L, -2);
+            lua_rawseti(L, -2, 1);
+            push_lua_string(L, v);
+            lua_rawseti(L, -2, 2);
+            push_lua_string(L, k);
+            lua_insert(L, -2);
+            lua_rawset(L, -3);
+        }
     }
-    lua_settable(L, -3);
+}
+
+// —————————————————————————————————————————————
+// Request userdata: one per request, shared by every hook and the route.
+// Fields are built on first access and cached in the user value, so a
+// handler that only reads req.path never converts headers or form data.
+// —————————————————————————————————————————————
 
-    lua_pushstring(L, "query");
+static constexpr auto REQUEST_METATABLE = "Lumenite.Request";
+
+struct LuaRequest
+{
+    const HttpRequest *req; // cleared when the request is finished
+};
+
+static void push_lua_cookies(lua_State *L, const HttpRequest &req)
+{
     lua_newtable(L);
-    for (auto &q: req.query) {
-        if (q.second.size() == 1) {
-            lua_pushstring(L, q.first.c_str());
-            lua_pushstring(L, q.second[0].c_str());
-            lua_settable(L, -3);
-        } else {
-            lua_pushstring(L, q.first.c_str());
-            lua_newtable(L);
-            for (size_t i = 0; i < q.second.size(); ++i) {
-                lua_pushinteger(L, i + 1);
-                lua_pushstring(L, q.second[i].c_str());
-                lua_settable(L, -3);
-            }
-            lua_settable(L, -3);
+    std::string_view h = req.header("Cookie");
+    while (!h.empty()) {
+        size_t semi = h.find(';');
+        std::string_view pair = h.substr(0, semi);
+        h = semi == std::string_view::npos ? std::string_view() : h.substr(semi + 1);
+
+        while (!pair.empty() && pair.front() == ' ') pair.remove_prefix(1);
+        size_t eq = pair.find('=');
+        if (eq == std::string_view::npos || eq == 0) continue;
+        std::string_view value = pair.substr(eq + 1);
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') value = value.substr(1, value.size() - 2);
+
+        push_lua_string(L, pair.substr(0, eq));
+        push_lua_string(L, value);
+        lua_rawset(L, -3);
+    }
+}
+
+// Push the value of request field `key`; false if there is no such field.
+static bool push_request_field(lua_State *L, const HttpRequest &req, std::string_view key)
+{
+    if (key == "method") push_lua_string(L, req.method);
+    else if (key == "path") push_lua_string(L, req.path);
+    else if (key == "remote_ip") push_lua_string(L, req.remote_ip);
+    else if (key == "body") push_lua_string(L, req.body);
+    else if (key == "query") push_lua_fields(L, req.query);
+    else if (key == "form") push_lua_fields(L, req.form);
+    else if (key == "cookies") push_lua_cookies(L, req);
+    else if (key == "headers") {
+        lua_createtable(L, 0, static_cast<int>(req.headers.size()));
+        for (auto &[k, v]: req.headers) {
+            push_lua_string(L, k);
+            push_lua_string(L, v);
+            lua_rawset(L, -3);
+        }
+    } else return false;
+    return true;
+}
+
+static constexpr const char *REQUEST_FIELDS[] = {
+    "method", "path", "remote_ip", "body", "headers", "query", "form", "cookies"
+};
+
+static int request_index(lua_State *L)
+{
+    auto *lr = static_cast<LuaRequest *>(luaL_checkudata(L, 1, REQUEST_METATABLE));
+    lua_getiuservalue(L, 1, 1); // cache
+    lua_pushvalue(L, 2);
+    if (lua_rawget(L, 3) != LUA_TNIL || !lr->req || lua_type(L, 2) != LUA_TSTRING) return 1;
+    lua_pop(L, 1);
+
+    size_t len;
+    const char *key = lua_tolstring(L, 2, &len);
+    if (!push_request_field(L, *lr->req, std::string_view(key, len))) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, 3);
+    return 1;
+}
+
+// Hooks may attach their own fields (req.user = ...); they share the cache.
+static int request_newindex(lua_State *L)
+{
+    luaL_checkudata(L, 1, REQUEST_METATABLE);
+    lua_getiuservalue(L, 1, 1);
+    lua_insert(L, 2);
+    lua_rawset(L, 2);
+    return 0;
+}
+
+static int request_next(lua_State *L)
+{
+    lua_settop(L, 2);
+    if (lua_next(L, 1)) return 2;
+    lua_pushnil(L);
+    return 1;
+}
+
+// pairs(req) sees every field, so materialize whatever is still missing.
+static int request_pairs(lua_State *L)
+{
+    auto *lr = static_cast<LuaRequest *>(luaL_checkudata(L, 1, REQUEST_METATABLE));
+    lua_getiuservalue(L, 1, 1);
+    if (lr->req) {
+        for (const char *key: REQUEST_FIELDS) {
+            if (lua_getfield(L, -1, key) == LUA_TNIL && push_request_field(L, *lr->req, key))
+                lua_setfield(L, -3, key);
+            lua_pop(L, 1);
         }
     }
-    lua_settable(L, -3);
+    lua_pushcfunction(L, request_next);
+    lua_insert(L, -2);
+    lua_pushnil(L);
+    return 3;
+}
 
-    lua_pushstring(L, "form");
+static LuaRequest *push_lua_request(lua_State *L, const HttpRequest &req)
+{
+    auto *lr = static_cast<LuaRequest *>(lua_newuserdatauv(L, sizeof(LuaRequest), 1));
+    lr->req = &req;
     lua_newtable(L);
-    for (auto &f: req.form) {
-        if (f.second.size() == 1) {
-            lua_pushstring(L, f.first.c_str());
-            lua_pushstring(L, f.second[0].c_str());
-        } else {
-            lua_pushstring(L, f.first.c_str());
-            lua_newtable(L);
-            for (size_t i = 0; i < f.second.size(); ++i) {
-                lua_pushinteger(L, i + 1);
-                lua_pushstring(L, f.second[i].c_str());
-                lua_settable(L, -3);
-            }
-        }
-        lua_settable(L, -3);
+    lua_setiuservalue(L, -2, 1);
+
+    if (luaL_newmetatable(L, REQUEST_METATABLE)) {
+        lua_pushcfunction(L, request_index);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, request_newindex);
+        lua_setfield(L, -2, "__newindex");
+        lua_pushcfunction(L, request_pairs);
+        lua_setfield(L, -2, "__pairs");
     }
-    lua_settable(L, -3);
+    lua_setmetatable(L, -2);
+    return lr;
 }
 
 static void push_lua_response(lua_State *L, const HttpResponse &res)
@@ -282,6 +432,10 @@ static void push_lua_response(lua_State *L, const HttpResponse &res)
     lua_pushstring(L, "body");
     lua_pushstring(L, res.body.c_str());
     lua_settable(L, -3);
+    if (res.file) {
+        LumeniteApp::pushFile(L, res.file);
+        lua_setfield(L, -2, "file");
+    }
 
     lua_pushstring(L, "headers");
     lua_newtable(L);
@@ -310,19 +464,7 @@ static void handle_lua_error(lua_State *L, HttpResponse &res)
             if (lua_isstring(L, -1)) msg = lua_tostring(L, -1);
             lua_pop(L, 1);
 
-            // Log abort
-            auto now = std::time(nullptr);
-            std::tm *tm = std::localtime(&now);
-            std::ostringstream ds, ts;
-            ds << "\033[90m" << std::put_time(tm, "%d/%b/%Y") << "\033[0m";
-            ts << "\033[37m:\033[35m" << std::put_time(tm, "%H:%M:%S") << "\033[0m";
-            auto sc = getColorForStatus(code);
-
-            std::cout
-                    << "\033[1m[" << ds.str() << ts.str() << "]\033[0m "
-                    << "\033[1m\033[31mABORT          \033[0m"
-                    << sc << std::setw(4) << code << "\033[0m "
-                    << "\033[1m\033[31m" << msg << "\033[0m\n";
+            AccessLog::abort(code, msg);
 
             // Fallback HTML
             std::ostringstream fb;
@@ -330,16 +472,20 @@ static void handle_lua_error(lua_State *L, HttpResponse &res)
                     << (statusMessages.count(code) ? statusMessages.at(code) : "Error")
                     << "</h1>";
             res.body = fb.str();
+            res.file.reset();
             res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
             lua_pop(L, 1);
             return;
         }
     }
     // Generic Lua error
-    std::cerr << "\033[31m[Lua Error]\033[0m " << lua_tostring(L, -1) << "\n";
+    size_t len = 0;
+    const char *err = lua_tolstring(L, -1, &len);
+    AccessLog::error(err ? std::string_view(err, len) : std::string_view("(error object is not a string)"));
     lua_pop(L, 1);
     res.status = 500;
     res.body = "<h1>500 Internal Server Error</h1>";
+    res.file.reset();
     res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
 }
 
@@ -368,6 +514,10 @@ static void parse_lua_response(lua_State *L, HttpResponse &res)
             res.body.assign(s, sz);
         }
         lua_pop(L, 1);
+
+        lua_getfield(L, -1, "file");
+        res.file = LumeniteApp::toFile(L, -1);
+        lua_pop(L, 1);
     } else if (lua_isstring(L, -1) || lua_isnumber(L, -1)) {
         size_t sz;
         const char *s = lua_tolstring(L, -1, &sz);
@@ -380,217 +530,366 @@ static void parse_lua_response(lua_State *L, HttpResponse &res)
 }
 
 // —————————————————————————————————————————————
-// 1) Read full HTTP request (headers + body) into HttpRequest
+// 1) Invoke before_request, route, after_request in Lua. The route runs as
+//    a coroutine: when it parks on an Async operation the worker moves on to
+//    other requests, and this one continues on the same state once it is done.
 // —————————————————————————————————————————————
-static bool receiveRequest(SocketType sock, const std::string &clientIp, HttpRequest &req)
-{
-    std::string raw;
-    char buf[4096];
-    ssize_t n;
-
-    while (raw.find("\r\n\r\n") == std::string::npos) {
-        n = recv(sock, buf, sizeof(buf), 0);
-        if (n <= 0) return false;
-        raw.append(buf, (size_t) n);
-    }
-
-    auto hdrEnd = raw.find("\r\n\r\n");
-    std::string hdrs = raw.substr(0, hdrEnd);
-    std::string body = raw.substr(hdrEnd + 4);
-
-    std::istringstream ss(hdrs);
-    std::string line;
-    // Request‐line: METHOD PATH-QUERY HTTP/VERSION
-    std::getline(ss, line);
-    if (!line.empty() && line.back() == '\r') line.pop_back(); {
-        std::istringstream ls(line);
-        std::string httpVer;
-        ls >> req.method >> req.path >> httpVer;
-    }
-
-    // headers
-    while (std::getline(ss, line) && !line.empty()) {
-        if (line.back() == '\r') line.pop_back();
-        auto c = line.find(':');
-        if (c != std::string::npos) {
-            std::string k = line.substr(0, c);
-            std::string v = line.substr(c + 1);
-            if (!v.empty() && v.front() == ' ') v.erase(0, 1);
-            req.headers[k] = v;
+struct RequestTask
+{
+    HttpRequest req;
+    HttpResponse res;
+    std::shared_ptr<LuaStatePool> pool; // kept until answered, across a reload
+    std::function<void(WireResponse &&)> done;
+
+    std::string session;
+    LuaRequest *handle = nullptr; // pinned by requestRef
+    int requestRef = LUA_NOREF;
+    lua_State *co = nullptr; // route coroutine, pinned by threadRef
+    int threadRef = LUA_NOREF;
+    int bodyRef = LUA_NOREF; // iterator or coroutine producing a streamed body
+    std::unique_ptr<Compression::Stream> deflate; // set when the streamed body is compressed
+};
+
+using RequestTaskPtr = std::shared_ptr<RequestTask>;
+
+static void fail_request(HttpResponse &res)
+{
+    res.status = 500;
+    res.body = "<h1>500 Internal Server Error</h1>";
+    res.file.reset();
+    res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
+}
+
+// True if a hook answered the request itself.
+static bool runBeforeHooks(lua_State *L, RequestTask &t)
+{
+    LumeniteApp::pushRegistryTable(L, LumeniteApp::BEFORE_REQUEST_KEY);
+    const int beforeHooks = lua_gettop(L);
+    const lua_Integer beforeCount = static_cast<lua_Integer>(lua_rawlen(L, beforeHooks));
+    for (lua_Integer i = 1; i <= beforeCount; ++i) {
+        lua_rawgeti(L, beforeHooks, i);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, t.requestRef);
+        if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+            handle_lua_error(L, t.res);
+            continue;
+        }
+        if (lua_istable(L, -1)) {
+            // override res from table
+            lua_getfield(L, -1, "status");
+            if (lua_isinteger(L, -1)) t.res.status = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            lua_getfield(L, -1, "body");
+            if (lua_isstring(L, -1)) t.res.body = lua_tostring(L, -1);
+            lua_pop(L, 1);
+            lua_getfield(L, -1, "headers");
+            if (lua_istable(L, -1)) {
+                lua_pushnil(L);
+                while (lua_next(L, -2)) {
+                    if (lua_isstring(L, -2) && lua_isstring(L, -1))
+                        t.res.headers[lua_tostring(L, -2)] = lua_tostring(L, -1);
+                    lua_pop(L, 1);
+                }
+            }
+            lua_settop(L, beforeHooks - 1);
+            return true;
         }
+        lua_pop(L, 1);
     }
+    lua_pop(L, 1); // before_request hooks
+    return false;
+}
+
+static void runAfterHooks(lua_State *L, RequestTask &t)
+{
+    LumeniteApp::pushRegistryTable(L, LumeniteApp::AFTER_REQUEST_KEY);
+    const int afterHooks = lua_gettop(L);
+    const lua_Integer afterCount = static_cast<lua_Integer>(lua_rawlen(L, afterHooks));
+    for (lua_Integer i = 1; i <= afterCount; ++i) {
+        lua_rawgeti(L, afterHooks, i);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, t.requestRef);
+        push_lua_response(L, t.res);
+        if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+            handle_lua_error(L, t.res);
+            continue;
+        }
+        if (lua_istable(L, -1)) {
+            lua_getfield(L, -1, "status");
+            if (lua_isinteger(L, -1)) t.res.status = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+
+            lua_getfield(L, -1, "body");
+            if (lua_isstring(L, -1)) t.res.body = lua_tostring(L, -1);
+            lua_pop(L, 1);
+
+            // Returning a table without the file replaces it with `body`.
+            lua_getfield(L, -1, "file");
+            t.res.file = LumeniteApp::toFile(L, -1);
+            lua_pop(L, 1);
 
-    // parse query string
-    if (auto qm = req.path.find('?'); qm != std::string::npos) {
-        std::string qs = req.path.substr(qm + 1);
-        req.path.resize(qm);
-        for (size_t p = 0; p < qs.size();) {
-            auto amp = qs.find('&', p);
-            std::string kv = qs.substr(p, amp - p);
-            auto eq = kv.find('=');
-            std::string k = urlDecode(kv.substr(0, eq));
-            std::string v = eq != std::string::npos ? urlDecode(kv.substr(eq + 1)) : "";
-            req.query[k].push_back(v);
-            if (amp == std::string::npos) break;
-            p = amp + 1;
+            lua_getfield(L, -1, "headers");
+            if (lua_istable(L, -1)) {
+                lua_pushnil(L);
+                while (lua_next(L, -2)) {
+                    if (lua_isstring(L, -2) && lua_isstring(L, -1))
+                        t.res.headers[lua_tostring(L, -2)] = lua_tostring(L, -1);
+                    lua_pop(L, 1);
+                }
+            }
+            lua_pop(L, 1);
         }
+        lua_pop(L, 1);
     }
+    lua_pop(L, 1); // after_request hooks
+}
 
-    // read body per Content-Length
-    size_t contentLen = 0;
-    if (auto it = req.headers.find("Content-Length"); it != req.headers.end()) {
-        contentLen = std::stoul(it->second);
-    }
-    while (body.size() < contentLen) {
-        n = recv(sock, buf, sizeof(buf), 0);
-        if (n <= 0) break;
-        body.append(buf, (size_t) n);
-    }
-    req.body = body;
-
-    // parse form
-    if (req.headers["Content-Type"] == "application/x-www-form-urlencoded") {
-        for (size_t p = 0; p < body.size();) {
-            auto amp = body.find('&', p);
-            std::string pr = body.substr(p, amp - p);
-            auto eq = pr.find('=');
-            std::string k = urlDecode(pr.substr(0, eq));
-            std::string v = eq != std::string::npos ? urlDecode(pr.substr(eq + 1)) : "";
-            req.form[k].push_back(v);
-            if (amp == std::string::npos) break;
-            p = amp + 1;
+static Compression::Encoding negotiateEncoding(const HttpRequest &req, HttpResponse &res);
+
+static WireResponse buildWireResponse(const HttpRequest &req, HttpResponse &res, Compression::Encoding encoding);
+
+// A handler may return an iterator function or a coroutine as the body (or
+// as `body` in its table): pin it for streaming, leaving the value in place.
+static int ref_body_stream(lua_State *L)
+{
+    int type = lua_type(L, -1);
+    if (type == LUA_TTABLE) {
+        lua_getfield(L, -1, "body");
+        type = lua_type(L, -1);
+        if (type == LUA_TFUNCTION || type == LUA_TTHREAD) return luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_pop(L, 1);
+        return LUA_NOREF;
+    }
+    if (type != LUA_TFUNCTION && type != LUA_TTHREAD) return LUA_NOREF;
+    lua_pushvalue(L, -1);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+static std::string frame_chunk(std::string_view data)
+{
+    char size[20];
+    int n = std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    std::string out;
+    out.reserve(n + data.size() + 2);
+    out.append(size, n);
+    out += data;
+    out += "\r\n";
+    return out;
+}
+
+// A piece of the streamed body as it goes on the wire: compressed if that
+// was negotiated, framed, and followed by the last chunk at the end.
+static std::string body_chunk(RequestTask &t, std::string_view data, bool last)
+{
+    std::string compressed;
+    if (t.deflate && (last || !data.empty())) {
+        compressed = last ? t.deflate->finish(data) : t.deflate->write(data);
+        data = compressed;
+    }
+    std::string piece = data.empty() ? std::string() : frame_chunk(data);
+    if (last) piece += LAST_CHUNK;
+    return piece;
+}
+
+// Produce the next piece of a streamed body: call the iterator, or resume
+// the coroutine, once. nil, a finished coroutine or an error ends the body;
+// an error also cuts the connection so the client sees it truncated.
+// Awaitable calls made from here run inline.
+static void pullBody(lua_State *L, const RequestTaskPtr &task, const BodyStream::Ready &ready)
+{
+    const int top = lua_gettop(L);
+    SessionManager::restoreSession(task->session);
+
+    bool finished = false;
+    int status;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, task->bodyRef);
+    if (lua_isthread(L, -1)) {
+        lua_State *co = lua_tothread(L, -1);
+        int nres = 0;
+        status = lua_resume(co, L, 0, &nres);
+        if (status == LUA_OK || status == LUA_YIELD) {
+            if (nres > 0) {
+                lua_pop(co, nres - 1);
+                lua_xmove(co, L, 1);
+            } else {
+                lua_pushliteral(L, "");
+            }
+            finished = status == LUA_OK;
+            status = LUA_OK;
+        } else {
+            lua_xmove(co, L, 1);
         }
+    } else {
+        status = lua_pcall(L, 0, 1, 0);
     }
 
-    // remote IP & X-Forwarded-For
-    req.remote_ip = clientIp;
-    if (auto it = req.headers.find("X-Forwarded-For"); it != req.headers.end()) {
-        std::string ff = it->second;
-        if (auto c = ff.find(','); c != std::string::npos) ff.resize(c);
-        ff.erase(0, ff.find_first_not_of(" \t"));
-        ff.erase(ff.find_last_not_of(" \t") + 1);
-        req.remote_ip = ff;
+    std::string piece;
+    if (status != LUA_OK) {
+        size_t len = 0;
+        const char *err = lua_tolstring(L, -1, &len);
+        AccessLog::error(err ? std::string_view(err, len) : std::string_view("(error object is not a string)"));
+        finished = true;
+    } else if (lua_isstring(L, -1)) {
+        size_t len = 0;
+        const char *data = lua_tolstring(L, -1, &len);
+        piece = body_chunk(*task, {data, len}, finished);
+    } else if (lua_isnil(L, -1)) {
+        piece = body_chunk(*task, {}, true);
+        finished = true;
+    } else {
+        AccessLog::error("streamed body produced a " + std::string(luaL_typename(L, -1)) + ", expected a string");
+        finished = true;
     }
+    lua_settop(L, top);
 
-    return true;
+    if (finished) {
+        luaL_unref(L, LUA_REGISTRYINDEX, task->bodyRef);
+        task->bodyRef = LUA_NOREF;
+    }
+    ready(std::move(piece), finished);
 }
 
-// —————————————————————————————————————————————
-// 2) Invoke before_request, route, after_request in Lua
-// —————————————————————————————————————————————
-static void processRequest(lua_State *L, HttpRequest &req, HttpResponse &res)
+static std::shared_ptr<BodyStream> makeBodyStream(lua_State *L, const RequestTaskPtr &task)
+{
+    auto stream = std::make_shared<BodyStream>();
+    stream->next = [task, L](BodyStream::Ready ready)
+    {
+        task->pool->post(L, [task, ready = std::move(ready)](lua_State *W) { pullBody(W, task, ready); });
+    };
+    stream->stop = [task, L]
+    {
+        task->pool->post(L, [task](lua_State *W)
+        {
+            luaL_unref(W, LUA_REGISTRYINDEX, task->bodyRef);
+            task->bodyRef = LUA_NOREF;
+        });
+    };
+    return stream;
+}
+
+static void finishRequest(lua_State *L, const RequestTaskPtr &task, bool afterHooks)
 {
+    const int top = lua_gettop(L);
     try {
-        SessionManager::start(req, res);
+        SessionManager::restoreSession(task->session);
+        if (afterHooks) runAfterHooks(L, *task);
+    } catch (...) {
+        lua_settop(L, top);
+        fail_request(task->res);
+    }
 
-        // before_request hooks
-        for (int ref: LumeniteApp::before_request_refs) {
-            lua_rawgeti(L,LUA_REGISTRYINDEX, ref);
-            push_lua_request(L, req);
-            if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
-                handle_lua_error(L, res);
-                lua_pop(L, 1);
-                continue;
-            }
-            if (lua_istable(L, -1)) {
-                // override res from table
-                lua_getfield(L, -1, "status");
-                if (lua_isinteger(L, -1)) res.status = lua_tointeger(L, -1);
-                lua_pop(L, 1);
-                lua_getfield(L, -1, "body");
-                if (lua_isstring(L, -1)) res.body = lua_tostring(L, -1);
-                lua_pop(L, 1);
-                lua_getfield(L, -1, "headers");
-                if (lua_istable(L, -1)) {
-                    lua_pushnil(L);
-                    while (lua_next(L, -2)) {
-                        if (lua_isstring(L, -2) && lua_isstring(L, -1))
-                            res.headers[lua_tostring(L, -2)] = lua_tostring(L, -1);
-                        lua_pop(L, 1);
-                    }
-                }
-                lua_pop(L, 1);
-                lua_pop(L, 1);
-                return;
-            }
-            lua_pop(L, 1);
+    // The request object must not reach `req` once it is answered, even if
+    // Lua kept a reference.
+    if (task->handle) task->handle->req = nullptr;
+    luaL_unref(L, LUA_REGISTRYINDEX, task->requestRef);
+    luaL_unref(L, LUA_REGISTRYINDEX, task->threadRef);
+
+    // A body or file set by a hook or an error page replaces the stream.
+    if (task->bodyRef != LUA_NOREF && (task->res.file || !task->res.body.empty())) {
+        luaL_unref(L, LUA_REGISTRYINDEX, task->bodyRef);
+        task->bodyRef = LUA_NOREF;
+    }
+    task->res.chunked = task->bodyRef != LUA_NOREF;
+
+    Compression::Encoding encoding = negotiateEncoding(task->req, task->res);
+    if (task->res.chunked && encoding != Compression::Encoding::Identity)
+        task->deflate = std::make_unique<Compression::Stream>(encoding, Compression::level());
+
+    WireResponse wire = buildWireResponse(task->req, task->res, encoding);
+    if (task->res.chunked) wire.stream = makeBodyStream(L, task);
+
+    // The task outlives this call while its body streams; it must not keep
+    // the connection alive through `done`.
+    auto done = std::move(task->done);
+    task->done = nullptr;
+    done(std::move(wire));
+}
+
+static void resumeRoute(lua_State *L, const RequestTaskPtr &task, int nargs, Async::OperationPtr op)
+{
+    const int top = lua_gettop(L);
+    try {
+        SessionManager::restoreSession(task->session);
+
+        int nres = 0;
+        int status = Async::resume(task->co, L, nargs, &nres, op);
+        if (status == LUA_YIELD) {
+            Async::start(std::move(op), [task, L](Async::OperationPtr ready)
+            {
+                task->pool->post(L, [task, ready](lua_State *W) { resumeRoute(W, task, 0, ready); });
+            });
+            return;
         }
 
-        // route match
-        int luaRef = 0;
-        std::vector<std::string> args;
-        Router::match(req.method, req.path, luaRef, args);
-
-        if (luaRef) {
-            lua_rawgeti(L,LUA_REGISTRYINDEX, luaRef);
-            push_lua_request(L, req);
-            for (auto &a: args) lua_pushlstring(L, a.data(), a.size());
-
-            // insert traceback
-            lua_getglobal(L, "debug");
-            lua_getfield(L, -1, "traceback");
-            lua_remove(L, -2);
-            int tb = lua_gettop(L) - (1 + args.size()) - 1;
-            lua_insert(L, tb);
-
-            if (lua_pcall(L, 1 + (int)args.size(), 1, tb) != LUA_OK) {
-                handle_lua_error(L, res);
-            } else {
-                parse_lua_response(L, res);
-            }
-            lua_remove(L, tb);
+        if (status == LUA_OK) {
+            if (nres == 0) lua_pushnil(task->co);
+            else lua_pop(task->co, nres - 1);
+            lua_xmove(task->co, L, 1);
+            task->bodyRef = ref_body_stream(L);
+            parse_lua_response(L, task->res);
         } else {
-            res.status = 404;
-            res.body = "<h1>404 Not Found</h1>";
-            res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
+            // A failed coroutine keeps its stack, so the traceback is still there.
+            if (lua_type(task->co, -1) == LUA_TSTRING) luaL_traceback(L, task->co, lua_tostring(task->co, -1), 0);
+            else lua_xmove(task->co, L, 1);
+            handle_lua_error(L, task->res);
         }
+    } catch (...) {
+        lua_settop(L, top);
+        fail_request(task->res);
+    }
+    finishRequest(L, task, true);
+}
 
-        // after_request hooks
-        for (int ref: LumeniteApp::after_request_refs) {
-            lua_rawgeti(L,LUA_REGISTRYINDEX, ref);
-            push_lua_request(L, req);
-            push_lua_response(L, res);
-            if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
-                handle_lua_error(L, res);
-                lua_pop(L, 1);
-                continue;
-            }
-            if (lua_istable(L, -1)) {
-                lua_getfield(L, -1, "status");
-                if (lua_isinteger(L, -1)) res.status = lua_tointeger(L, -1);
-                lua_pop(L, 1);
+static void startRequest(lua_State *L, const RequestTaskPtr &task)
+{
+    const int top = lua_gettop(L);
+    try {
+        SessionManager::start(task->req, task->res);
+        task->session = SessionManager::currentSession();
 
-                lua_getfield(L, -1, "body");
-                if (lua_isstring(L, -1)) res.body = lua_tostring(L, -1);
-                lua_pop(L, 1);
+        // One request object for every hook and the route.
+        task->handle = push_lua_request(L, task->req);
+        task->requestRef = luaL_ref(L, LUA_REGISTRYINDEX);
 
-                lua_getfield(L, -1, "headers");
-                if (lua_istable(L, -1)) {
-                    lua_pushnil(L);
-                    while (lua_next(L, -2)) {
-                        if (lua_isstring(L, -2) && lua_isstring(L, -1))
-                            res.headers[lua_tostring(L, -2)] = lua_tostring(L, -1);
-                        lua_pop(L, 1);
-                    }
-                }
-                lua_pop(L, 1);
-            }
-            lua_pop(L, 1);
+        if (runBeforeHooks(L, *task)) {
+            finishRequest(L, task, false);
+            return;
         }
+
+        // route match
+        int routeId = 0;
+        std::vector<std::string_view> args;
+        if (!task->pool->routes().match(task->req.method, task->req.path, routeId, args)) {
+            task->res.status = 404;
+            task->res.body = "<h1>404 Not Found</h1>";
+            task->res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
+            finishRequest(L, task, true);
+            return;
+        }
+
+        task->co = lua_newthread(L);
+        task->threadRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_State *co = task->co;
+        LumeniteApp::pushRegistryTable(co, LumeniteApp::ROUTES_KEY);
+        lua_rawgeti(co, -1, routeId);
+        lua_remove(co, -2);
+        lua_rawgeti(co, LUA_REGISTRYINDEX, task->requestRef);
+        for (auto &a: args) lua_pushlstring(co, a.data(), a.size());
     } catch (...) {
-        res.status = 500;
-        res.body = "<h1>500 Internal Server Error</h1>";
-        res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
+        lua_settop(L, top);
+        fail_request(task->res);
+        finishRequest(L, task, false);
+        return;
     }
+    resumeRoute(L, task, lua_gettop(task->co) - 1, nullptr);
 }
 
 // —————————————————————————————————————————————
-// 3) Decide if we keep the connection alive
+// 2) Decide if we keep the connection alive
 // —————————————————————————————————————————————
 static bool shouldKeepAlive(const HttpRequest &req)
 {
-    if (auto it = req.headers.find("Connection"); it != req.headers.end()) {
-        std::string v = it->second;
+    if (req.lastOnConnection) return false;
+    if (std::string_view h = req.header("Connection"); !h.empty()) {
+        std::string v(h);
         std::transform(v.begin(), v.end(), v.begin(), ::tolower);
         if (v == "close") return false;
         if (v == "keep-alive") return true;
@@ -600,58 +899,649 @@ static bool shouldKeepAlive(const HttpRequest &req)
 }
 
 // —————————————————————————————————————————————
-// 4) Log to console
+// 3) Log the request (formatted and written by the AccessLog thread)
 // —————————————————————————————————————————————
 static void logRequest(const HttpRequest &req, const HttpResponse &res)
 {
-    auto now = std::time(nullptr);
-    auto lt = *std::localtime(&now);
-    std::ostringstream ds, ts;
-    ds << "\033[90m" << std::put_time(&lt, "%d/%b/%Y") << "\033[0m";
-    ts << "\033[37m:\033[35m" << std::put_time(&lt, "%H:%M:%S") << "\033[0m";
-    auto sc = getColorForStatus(res.status);
+    AccessLog::request(res.status, req.method, req.path, req.remote_ip);
+}
+
+// —————————————————————————————————————————————
+// 4) Pick a Content-Encoding. A response a cache may keep is compressed
+//    once per version of its body and then served from Compression's cache
+// —————————————————————————————————————————————
+static bool cacheable(const HttpResponse &res)
+{
+    if (res.status != 200) return false;
+    std::string cc = getHeaderValue(res.headers, "Cache-Control");
+    std::transform(cc.begin(), cc.end(), cc.begin(), ::tolower);
+    if (cc.find("no-store") != std::string::npos || cc.find("private") != std::string::npos) return false;
+    return cc.find("public") != std::string::npos || cc.find("max-age") != std::string::npos ||
+           !getHeaderValue(res.headers, "ETag").empty() || !getHeaderValue(res.headers, "Last-Modified").empty();
+}
+
+// Sets Content-Encoding (and Vary) for the encoding it returns; the body is
+// compressed by buildWireResponse, a streamed one piece by piece.
+static Compression::Encoding negotiateEncoding(const HttpRequest &req, HttpResponse &res)
+{
+    using Encoding = Compression::Encoding;
+    if (res.file || res.status < 200 || res.status == 204 || res.status == 304) return Encoding::Identity;
+    if (!getHeaderValue(res.headers, "Content-Encoding").empty()) return Encoding::Identity;
+    if (!Compression::compressible(getHeaderValue(res.headers, "Content-Type"),
+                                   res.chunked ? UINT64_MAX : res.body.size()))
+        return Encoding::Identity;
+
+    // From here the body depends on Accept-Encoding, whatever this client sent.
+    std::string &vary = res.headers["Vary"];
+    if (vary.empty()) vary = "Accept-Encoding";
+    else if (vary != "*" && vary.find("Accept-Encoding") == std::string::npos) vary += ", Accept-Encoding";
+
+    Encoding encoding = Compression::negotiate(req.header("Accept-Encoding"));
+    if (encoding == Encoding::Identity) return encoding;
+    res.headers["Content-Encoding"] = Compression::name(encoding);
+
+    // Other bytes than the handler produced: a strong validator no longer holds.
+    for (auto &[name, value]: res.headers) {
+        std::string lk = name;
+        std::transform(lk.begin(), lk.end(), lk.begin(), ::tolower);
+        if (lk == "etag" && !value.starts_with("W/")) value.insert(0, "W/");
+    }
+    return encoding;
+}
 
-    const char *mc = "\033[37m";
-    if (req.method == "GET") mc = "\033[36m";
-    else if (req.method == "POST") mc = "\033[35m";
-    else if (req.method == "DELETE") mc = "\033[31m";
+static void compressBody(const HttpRequest &req, HttpResponse &res, Compression::Encoding encoding)
+{
+    if (!cacheable(res)) {
+        res.body = Compression::compress(res.body, encoding);
+        return;
+    }
+    std::string key(req.path);
+    for (const auto &[name, value]: req.query) {
+        key += key.size() == req.path.size() ? '?' : '&';
+        key.append(name).append("=").append(value);
+    }
+    res.body = *Compression::cached(key, Compression::contentVersion(res.body), encoding, res.body);
+}
 
-    std::cout
-            << "\033[1m[" << ds.str() << ts.str() << "]\033[0m "
-            << "\033[1m\033[37m" << std::left << std::setw(16)
-            << req.remote_ip << "\033[0m "
-            << sc << res.status << "\033[0m "
-            << mc << req.method << "\033[0m "
-            << "\033[34m" << req.path << "\033[0m\n";
+// —————————————————————————————————————————————
+// 5) Build the wire response; the body (or file) stays in its own buffer
+//    next to the serialized head
+// —————————————————————————————————————————————
+static WireResponse buildWireResponse(const HttpRequest &req, HttpResponse &res, Compression::Encoding encoding)
+{
+    // Framing headers are always ours; serializeHead() writes them.
+    res.headers.erase("Connection");
+    res.headers.erase("Content-Length");
+    res.headers.erase("Transfer-Encoding");
+    if (res.file) res.body.clear();
+    if (encoding != Compression::Encoding::Identity && !res.chunked) compressBody(req, res, encoding);
+
+    logRequest(req, res);
+
+    WireResponse wire;
+    wire.keepAlive = shouldKeepAlive(req);
+    wire.head = res.serializeHead(wire.keepAlive);
+    wire.body = std::move(res.body);
+    wire.file = std::move(res.file);
+    return wire;
+}
+
+// Start a request on the worker owning `L`; `done` runs once it is answered,
+// possibly on a later turn of the same worker.
+static void handleRequest(lua_State *L, const std::shared_ptr<LuaStatePool> &pool, HttpRequest &&req,
+                          std::function<void(WireResponse &&)> done)
+{
+    auto task = std::make_shared<RequestTask>();
+    task->req = std::move(req);
+    task->pool = pool;
+    task->done = std::move(done);
+    startRequest(L, task);
 }
 
 // —————————————————————————————————————————————
-// 5) Send raw bytes
+// 6) WebSocket upgrades. on_open runs like a route, with the request and its
+//    cookie session; on_message and on_close follow on the same worker, in
+//    the order the loop saw them
 // —————————————————————————————————————————————
-static void sendRaw(SocketType sock, const std::string &data)
+static bool pushSocketHandler(lua_State *L, const std::string &path, const char *name)
+{
+    LumeniteApp::pushRegistryTable(L, LumeniteApp::WEBSOCKETS_KEY);
+    lua_getfield(L, -1, path.c_str());
+    if (lua_istable(L, -1)) lua_getfield(L, -1, name);
+    else lua_pushnil(L);
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+    if (lua_isfunction(L, -1)) return true;
+    lua_pop(L, 1);
+    return false;
+}
+
+static void logSocketError(lua_State *L)
 {
-    send(sock, data.data(), static_cast<int>(data.size()), 0);
+    size_t len = 0;
+    const char *err = lua_tolstring(L, -1, &len);
+    AccessLog::error(err ? std::string_view(err, len) : std::string_view("(error object is not a string)"));
+}
+
+static void deliverMessage(lua_State *L, const WebSocket::SessionPtr &session, const std::string &message, bool binary)
+{
+    const int top = lua_gettop(L);
+    if (session->handleRef == LUA_NOREF || !pushSocketHandler(L, session->path, "on_message")) return;
+    SessionManager::restoreSession(session->cookieSession);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, session->handleRef);
+    lua_pushlstring(L, message.data(), message.size());
+    lua_pushboolean(L, binary);
+    if (lua_pcall(L, 3, 1, 0) != LUA_OK) {
+        logSocketError(L);
+    } else if (lua_type(L, -1) == LUA_TSTRING) {
+        // Returning a string answers the message.
+        size_t len = 0;
+        const char *reply = lua_tolstring(L, -1, &len);
+        WebSocket::send(session, {reply, len}, binary);
+    }
+    lua_settop(L, top);
+}
+
+static void deliverClose(lua_State *L, const WebSocket::SessionPtr &session, int code, const std::string &reason)
+{
+    const int top = lua_gettop(L);
+    if (pushSocketHandler(L, session->path, "on_close")) {
+        SessionManager::restoreSession(session->cookieSession);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, session->handleRef);
+        lua_pushinteger(L, code);
+        lua_pushlstring(L, reason.data(), reason.size());
+        if (lua_pcall(L, 3, 0, 0) != LUA_OK) logSocketError(L);
+    }
+    lua_settop(L, top);
+    luaL_unref(L, LUA_REGISTRYINDEX, session->handleRef);
+    session->handleRef = LUA_NOREF;
+}
+
+static void handleUpgrade(lua_State *L, const std::shared_ptr<LuaStatePool> &pool, const ConnectionPtr &conn,
+                          HttpRequest &&req)
+{
+    HttpResponse res;
+    int status;
+    std::string acceptKey = WebSocket::handshake(req, status);
+    std::string path(req.path);
+    WebSocket::SessionPtr session;
+
+    const int top = lua_gettop(L);
+    if (status == 101) {
+        try {
+            SessionManager::start(req, res);
+            session = WebSocket::open(conn, req);
+            session->cookieSession = SessionManager::currentSession();
+            WebSocket::pushHandle(L, session);
+            session->handleRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+            // Returning false from on_open refuses the socket.
+            if (pushSocketHandler(L, path, "on_open")) {
+                lua_rawgeti(L, LUA_REGISTRYINDEX, session->handleRef);
+                LuaRequest *handle = push_lua_request(L, req);
+                int rc = lua_pcall(L, 2, 1, 0);
+                handle->req = nullptr;
+                if (rc != LUA_OK) {
+                    handle_lua_error(L, res);
+                    status = res.status;
+                } else if (lua_isboolean(L, -1) && !lua_toboolean(L, -1)) {
+                    status = 403;
+                }
+            }
+        } catch (...) {
+            status = 500;
+        }
+        lua_settop(L, top);
+    }
+
+    if (status != 101) {
+        if (session) {
+            luaL_unref(L, LUA_REGISTRYINDEX, session->handleRef);
+            session->handleRef = LUA_NOREF;
+        }
+        res.status = status;
+        if (res.body.empty()) {
+            res.body = "<h1>" + std::to_string(status) + " " +
+                       (statusMessages.count(status) ? statusMessages.at(status) : "Error") + "</h1>";
+            res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
+        }
+        if (status == 426) res.headers["Sec-WebSocket-Version"] = "13";
+        conn->loop->complete(conn, buildWireResponse(req, res, Compression::Encoding::Identity));
+        return;
+    }
+
+    // Messages and the close run on this state, one at a time, in order;
+    // the socket keeps its states alive across a reload until it closes.
+    std::weak_ptr<WebSocket::Session> weak = session;
+    session->onMessage = [pool, L, weak](std::string &&message, bool binary)
+    {
+        pool->post(L, [weak, message = std::move(message), binary](lua_State *W)
+        {
+            if (auto session = weak.lock()) deliverMessage(W, session, message, binary);
+        });
+    };
+    session->onClose = [pool, L, weak](int code, std::string &&reason)
+    {
+        pool->post(L, [weak, code, reason = std::move(reason)](lua_State *W)
+        {
+            if (auto session = weak.lock()) deliverClose(W, session, code, reason);
+        });
+    };
+
+    std::string fields;
+    for (const auto &[name, value]: res.headers) fields.append(name).append(": ").append(value).append("\r\n");
+    res.status = 101;
+    logRequest(req, res);
+    WebSocket::accept(session, acceptKey, fields);
 }
 
 // —————————————————————————————————————————————
-// Server::run — listen, accept, spawn per-client threads
+// 7) Event streams. The handler runs once, like a route; after that the
+//    stream is fed from anywhere without coming back to Lua
 // —————————————————————————————————————————————
-[[noreturn]] void Server::run() const
+static void handleEventStream(lua_State *L, const ConnectionPtr &conn, HttpRequest &&req)
 {
-#ifdef _WIN32
-    WSADATA wsa;
-    WSAStartup(MAKEWORD(2, 2), &wsa);
+    HttpResponse res;
+    int status = req.method == "GET" ? 200 : 405;
+    EventStream::StreamPtr stream;
+
+    const int top = lua_gettop(L);
+    if (status == 200) {
+        try {
+            SessionManager::start(req, res);
+            stream = EventStream::open(conn, req);
+
+            // Returning false answers 204, which tells EventSource not to reconnect.
+            LumeniteApp::pushRegistryTable(L, LumeniteApp::EVENT_STREAMS_KEY);
+            lua_getfield(L, -1, std::string(req.path).c_str());
+            EventStream::pushHandle(L, stream);
+            LuaRequest *handle = push_lua_request(L, req);
+            int rc = lua_pcall(L, 2, 1, 0);
+            handle->req = nullptr;
+            if (rc != LUA_OK) {
+                handle_lua_error(L, res);
+                status = res.status;
+            } else if (lua_isboolean(L, -1) && !lua_toboolean(L, -1)) {
+                status = 204;
+            }
+        } catch (...) {
+            status = 500;
+        }
+        lua_settop(L, top);
+    }
+
+    if (status != 200) {
+        res.status = status;
+        if (res.body.empty() && status != 204) {
+            res.body = "<h1>" + std::to_string(status) + " " +
+                       (statusMessages.count(status) ? statusMessages.at(status) : "Error") + "</h1>";
+            res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
+        }
+        if (status == 405) res.headers["Allow"] = "GET";
+        conn->loop->complete(conn, buildWireResponse(req, res, Compression::Encoding::Identity));
+        return;
+    }
+
+    std::string fields;
+    for (const auto &[name, value]: res.headers) fields.append(name).append(": ").append(value).append("\r\n");
+    res.status = 200;
+    logRequest(req, res);
+    EventStream::accept(stream, fields);
+}
+
+// —————————————————————————————————————————————
+// 8) Hot reload. SIGHUP or app.reload() loads app.lua into a second pool
+//    while the first keeps serving; once every new state has loaded, new
+//    requests go to it. The old pool closes when the last request, parked
+//    coroutine or WebSocket holding it is done. The listeners stay as they
+//    are, and a script that fails to load leaves the running code in place.
+// —————————————————————————————————————————————
+using PoolPtr = std::shared_ptr<LuaStatePool>;
+
+// Where new requests go. Never destroyed: exit() does not wait for requests.
+static std::atomic<PoolPtr> &livePool()
+{
+    static auto *live = new std::atomic<PoolPtr>();
+    return *live;
+}
+
+static PoolPtr startPool(size_t size)
+{
+    // The last holder can be a task on one of the pool's own workers, which
+    // cannot join itself.
+    return {new LuaStatePool(size), [](LuaStatePool *pool) { std::thread([pool] { delete pool; }).detach(); }};
+}
+
+#ifndef _WIN32
+static int reloadPipe[2] = {-1, -1};
+
+static void onHangup(int)
+{
+    char byte = 1;
+    [[maybe_unused]] ssize_t n = write(reloadPipe[1], &byte, 1);
+}
+
+// Before the first pool loads, so a SIGHUP meanwhile is kept for later
+// rather than ending the process.
+static void catchHangup()
+{
+    if (pipe(reloadPipe) != 0) return;
+    for (int fd: reloadPipe) fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(reloadPipe[1], F_SETFL, O_NONBLOCK);
+
+    struct sigaction sa{};
+    sa.sa_handler = onHangup;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, nullptr);
+}
+
+static void reload(size_t size)
+{
+    auto started = std::chrono::steady_clock::now();
+    PoolPtr fresh = startPool(size);
+    if (fresh->size() != size) {
+        std::cerr << "\033[31m[Server]\033[0m Reload failed: " << fresh->size() << " of " << size
+                << " states loaded " << LumeniteApp::scriptPath << ", still serving the previous code\n";
+        return;
+    }
+    livePool().store(std::move(fresh));
+    TemplateEngine::clearCache();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    std::cerr << "\033[1;36m *\033[0m Reloaded " << LumeniteApp::scriptPath << " in " << ms.count() << " ms\n";
+}
+
+// One reload at a time; signals that arrive during one make one more.
+static void startReloader(size_t size)
+{
+    if (reloadPipe[0] < 0) return;
+    std::thread([size]
+    {
+        char pending[64];
+        while (true) {
+            ssize_t n = read(reloadPipe[0], pending, sizeof(pending));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            reload(size);
+        }
+    }).detach();
+}
+#else
+static void catchHangup()
+{
+}
+
+static void startReloader(size_t)
+{
+}
 #endif
 
+bool Server::reload()
+{
+#ifndef _WIN32
+    // The master passes it on to every worker.
+    if (Prefork::worker()) return kill(getppid(), SIGHUP) == 0;
+    if (reloadPipe[1] < 0) return false;
+    onHangup(SIGHUP);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// —————————————————————————————————————————————
+// 9) Load shedding. A request a worker takes too late (see LoadShedder) is
+//    answered 503 right there, without running any Lua.
+// —————————————————————————————————————————————
+static std::optional<WireResponse> shed(const HttpRequest &req, LoadShedder::Clock::time_point queued)
+{
+    if (LoadShedder::admit(queued, req.path)) return std::nullopt;
+    HttpResponse res;
+    res.status = 503;
+    res.headers["Retry-After"] = std::to_string(LoadShedder::retryAfter());
+    res.headers["Content-Type"] = DEFAULT_CONTENT_TYPE;
+    res.body = "<h1>503 Service Unavailable</h1>";
+    logRequest(req, res);
+    return buildWireResponse(req, res, Compression::Encoding::Identity);
+}
+
+static SocketType openListener(int port, int backlog)
+{
     SocketType lsock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lsock, SOL_SOCKET, SO_REUSEADDR, (const char *) &one, sizeof(one));
+
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
     addr.sin_addr.s_addr = INADDR_ANY;
     bind(lsock, (sockaddr *) &addr, sizeof(addr));
-    listen(lsock, 10);
+    listen(lsock, backlog > 0 ? backlog : SOMAXCONN);
+    return lsock;
+}
+
+#ifdef __linux__
+
+// One listener per loop, all in the port's SO_REUSEPORT group: the kernel
+// spreads new connections over their queues, so no single accept queue
+// takes the whole storm. Empty when the kernel or the port refuses.
+static std::vector<int> openShards(int port, int backlog, size_t count)
+{
+    std::vector<int> shards;
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    int one = 1;
+    for (size_t i = 0; i < count; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+            bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(fd, backlog > 0 ? backlog : SOMAXCONN) != 0) {
+            if (fd >= 0) close(fd);
+            for (int shard: shards) close(shard);
+            return {};
+        }
+        shards.push_back(fd);
+    }
+    return shards;
+}
+
+// Pick the group member by the CPU that took the SYN. Members are indexed
+// in listen() order, so with loop i pinned to CPU i each connection is
+// accepted and served where its packets already are.
+static bool steerByCpu(int fd)
+{
+    sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+        {BPF_RET | BPF_A, 0, 0, 0},
+    };
+    sock_fprog prog{static_cast<unsigned short>(std::size(code)), code};
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == 0;
+}
+
+static void pinTo(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// A request that is not for a static file goes to the Lua workers; safe
+// from any thread.
+static void toPool(const ConnectionPtr &conn, HttpRequest &&request)
+{
+    PoolPtr pool = livePool().load();
+    auto queued = LoadShedder::Clock::now();
+    if (EventStream::routed(request.path)) {
+        pool->submit([conn, req = std::move(request), queued](lua_State *L) mutable
+        {
+            if (auto wire = shed(req, queued)) conn->loop->complete(conn, std::move(*wire));
+            else handleEventStream(L, conn, std::move(req));
+        });
+        return;
+    }
+    if (!request.header("Upgrade").empty() && WebSocket::routed(request.path)) {
+        pool->submit([pool, conn, req = std::move(request), queued](lua_State *L) mutable
+        {
+            if (auto wire = shed(req, queued)) conn->loop->complete(conn, std::move(*wire));
+            else handleUpgrade(L, pool, conn, std::move(req));
+        });
+        return;
+    }
+    pool->submit([pool, conn, req = std::move(request), queued](lua_State *L) mutable
+    {
+        if (auto wire = shed(req, queued)) {
+            conn->loop->complete(conn, std::move(*wire));
+            return;
+        }
+        handleRequest(L, pool, std::move(req), [conn](WireResponse &&wire)
+        {
+            conn->loop->complete(conn, std::move(wire));
+        });
+    });
+}
+
+// —————————————————————————————————————————————
+// Server::run — one epoll loop per core, fixed worker pool for Lua
+// —————————————————————————————————————————————
+[[noreturn]] void Server::run() const
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    // Under a master the loops are numbered across all workers: worker i
+    // runs loops [first, first + count) of `total`.
+    bool worker = Prefork::worker();
+    unsigned processes = worker ? Prefork::count() : std::max(1u, Prefork::processes);
+    size_t count = std::max<size_t>(1, cores / processes);
+    size_t total = count * processes;
+    size_t first = worker ? Prefork::index() * count : 0;
+
+    std::vector<int> listeners = worker ? Prefork::inherited() : std::vector<int>{};
+    if (listeners.empty() && options.reusePort) {
+        listeners = openShards(port, options.backlog, total);
+        if (listeners.empty())
+            std::cerr << "\033[33m[Server]\033[0m SO_REUSEPORT unavailable, loops share one listener\n";
+    }
+    if (listeners.empty()) {
+        SocketType lsock = openListener(port, options.backlog);
+        fcntl(lsock, F_SETFL, fcntl(lsock, F_GETFL, 0) | O_NONBLOCK);
+        listeners.push_back(lsock);
+    }
+
+    // Loop i runs on cpus[i]; steering needs those to be CPUs 0..n-1 exactly.
+    std::vector<int> cpus;
+    if (options.affinity) {
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE && cpus.size() < total; ++cpu)
+                if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        bool identity = cpus.size() == total && listeners.size() == total && cpus.back() == static_cast<int>(total) - 1;
+        if (!worker && identity && !steerByCpu(listeners[0]))
+            std::cerr << "\033[33m[Server]\033[0m Could not attach the CPU steering program, accepts are hashed\n";
+    }
+
+    if (!worker) printLocalIPs(port);
+    if (processes > 1 && !worker) Prefork::supervise(listeners);
+
+    // The other workers' shards stay open in the master, not here.
+    std::vector<int> mine;
+    for (size_t i = first; i < first + count; ++i) mine.push_back(listeners[i % listeners.size()]);
+    for (int fd: listeners)
+        if (std::find(mine.begin(), mine.end(), fd) == mine.end()) close(fd);
+
+    catchHangup();
+    livePool().store(startPool(count));
+    if (livePool().load()->size() == 0) {
+        std::cerr << "\033[31m[Server]\033[0m No Lua worker state could load " << LumeniteApp::scriptPath << "\n";
+        std::exit(1);
+    }
+    startReloader(count);
+
+    auto dispatch = [](const ConnectionPtr &conn, HttpRequest &&request)
+    {
+        Prefork::countRequest();
+        // Cached static hits are answered right here on the loop; a path the
+        // cache does not know yet is looked for on the I/O pool.
+        bool pending;
+        if (auto wire = StaticFiles::cached(request, shouldKeepAlive(request), pending)) {
+            conn->loop->complete(conn, std::move(*wire));
+            return;
+        }
+        if (!pending) {
+            toPool(conn, std::move(request));
+            return;
+        }
+        Async::run([conn, req = std::move(request)]() mutable
+        {
+            if (auto wire = StaticFiles::serve(req, shouldKeepAlive(req))) conn->loop->complete(conn, std::move(*wire));
+            else toPool(conn, std::move(req));
+        });
+    };
+
+    EventLoop::Backend io = options.io;
+    if (io == EventLoop::Backend::IoUring && Tls::context()) {
+        std::cerr << "\033[33m[Server]\033[0m io_uring does not carry TLS yet, using epoll\n";
+        io = EventLoop::Backend::Epoll;
+    }
+
+    std::vector<std::unique_ptr<EventLoop> > loops;
+    for (size_t i = 0; i < count; ++i)
+        loops.push_back(std::make_unique<EventLoop>(mine[i], dispatch, io, options.limits));
+
+    for (size_t i = 1; i < loops.size(); ++i) {
+        int cpu = cpus.empty() ? -1 : cpus[(first + i) % cpus.size()];
+        std::thread([loop = loops[i].get(), cpu]
+        {
+            if (cpu >= 0) pinTo(cpu);
+            loop->run();
+        }).detach();
+    }
+
+    // Last: threads started from here on would inherit it.
+    if (!cpus.empty()) pinTo(cpus[first % cpus.size()]);
+    loops[0]->run();
+}
+
+#else
+
+// —————————————————————————————————————————————
+// Server::run — portable fallback: blocking accept, thread per client
+// —————————————————————————————————————————————
+static void setTimeout(SocketType sock, int option, std::chrono::seconds limit)
+{
+    if (limit.count() <= 0) return;
+#ifdef _WIN32
+    DWORD ms = static_cast<DWORD>(limit.count() * 1000);
+    setsockopt(sock, SOL_SOCKET, option, (const char *) &ms, sizeof(ms));
+#else
+    timeval tv{static_cast<time_t>(limit.count()), 0};
+    setsockopt(sock, SOL_SOCKET, option, &tv, sizeof(tv));
+#endif
+}
+
+[[noreturn]] void Server::run() const
+{
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+    SocketType lsock = openListener(port, options.backlog);
 
     printLocalIPs(port);
+    if (Prefork::processes > 1)
+        std::cerr << "\033[33m[Server]\033[0m --workers needs Linux, running as one process\n";
+
+    size_t size = std::max(1u, std::thread::hardware_concurrency());
+    catchHangup();
+    livePool().store(startPool(size));
+    startReloader(size);
 
     while (true) {
         sockaddr_in ca{};
@@ -663,24 +1553,136 @@ static void sendRaw(SocketType sock, const std::string &data)
         inet_ntop(AF_INET, &ca.sin_addr, ipb, sizeof(ipb));
         std::string clientIp(ipb);
 
-        // handle each client in its own thread
-        std::thread([this, csock, clientIp]()
+        // Blocking sockets get what deadlines they can: every receive waits
+        // at most the header or keep-alive limit, every send the write limit.
+        setTimeout(csock, SO_RCVTIMEO, std::max(options.limits.header, options.limits.idle));
+        setTimeout(csock, SO_SNDTIMEO, options.limits.write);
+
+        std::thread([csock, clientIp, limits = options.limits]()
         {
+            // A blocking handshake is fine with a thread of its own.
+            SSL *ssl = nullptr;
+            if (Tls::context()) {
+                ssl = Tls::accept(static_cast<int>(csock));
+                if (ssl && SSL_accept(ssl) != 1) {
+                    SSL_free(ssl);
+                    ssl = nullptr;
+                }
+                if (!ssl) {
+#ifdef _WIN32
+                    closesocket(csock);
+#else
+                    close(csock);
+#endif
+                    return;
+                }
+            }
+            auto receive = [&](char *p, int n) { return ssl ? SSL_read(ssl, p, n) : static_cast<int>(recv(csock, p, n, 0)); };
+            auto sendAll = [&](const char *p, size_t n)
+            {
+                while (n > 0) {
+                    int chunk = static_cast<int>(std::min<size_t>(n, 1 << 30));
+                    int sent = ssl ? SSL_write(ssl, p, chunk) : static_cast<int>(send(csock, p, chunk, 0));
+                    if (sent <= 0) return false;
+                    p += sent;
+                    n -= static_cast<size_t>(sent);
+                }
+                return true;
+            };
+
+            std::string buffer;
+            HttpParser parser(limits.maxHeaderBytes);
+            char buf[4096];
             bool keep = true;
+            unsigned served = 0;
             while (keep) {
-                HttpRequest req;
-                HttpResponse res; // default
-
-                if (!receiveRequest(csock, clientIp, req)) break;
-
-                processRequest(L, req, res);
-
-                keep = shouldKeepAlive(req);
-                res.headers["Connection"] = keep ? "keep-alive" : "close";
-                res.headers["Content-Length"] = std::to_string(res.body.size());
+                ParseResult pr;
+                while ((pr = parser.feed(buffer)) == ParseResult::Incomplete) {
+                    auto n = receive(buf, sizeof(buf));
+                    if (n <= 0) break;
+                    buffer.append(buf, (size_t) n);
+                }
+                if (pr != ParseResult::Complete) break;
 
-                sendRaw(csock, res.serialize());
-                logRequest(req, res);
+                HttpRequest req;
+                parser.take(buffer, clientIp, req);
+                req.lastOnConnection = limits.maxRequests && ++served >= limits.maxRequests;
+
+                WireResponse out;
+                std::mutex doneMutex;
+                std::condition_variable doneCv;
+                bool done = false;
+                if (auto wire = StaticFiles::serve(req, shouldKeepAlive(req))) {
+                    out = std::move(*wire);
+                    done = true;
+                } else {
+                    PoolPtr pool = livePool().load();
+                    auto queued = LoadShedder::Clock::now();
+                    pool->submit([&](lua_State *L)
+                    {
+                        if (auto wire = shed(req, queued)) {
+                            std::lock_guard<std::mutex> lock(doneMutex);
+                            out = std::move(*wire);
+                            done = true;
+                            doneCv.notify_one();
+                            return;
+                        }
+                        handleRequest(L, pool, std::move(req), [&](WireResponse &&wire)
+                        {
+                            std::lock_guard<std::mutex> lock(doneMutex);
+                            out = std::move(wire);
+                            done = true;
+                            doneCv.notify_one();
+                        });
+                    });
+                }
+                {
+                    std::unique_lock<std::mutex> lock(doneMutex);
+                    doneCv.wait(lock, [&] { return done; });
+                }
+                keep = out.keepAlive;
+                sendAll(out.head.data(), out.head.size());
+                if (!out.body.empty()) sendAll(out.body.data(), out.body.size());
+                if (out.stream) {
+                    // Pull the body one piece at a time, waiting on each.
+                    for (bool last = false; !last;) {
+                        std::string piece;
+                        bool ready = false;
+                        out.stream->next([&](std::string &&p, bool l)
+                        {
+                            std::lock_guard<std::mutex> lock(doneMutex);
+                            piece = std::move(p);
+                            last = l;
+                            ready = true;
+                            doneCv.notify_one();
+                        });
+                        {
+                            std::unique_lock<std::mutex> lock(doneMutex);
+                            doneCv.wait(lock, [&] { return ready; });
+                        }
+                        if (last && piece.empty()) keep = false; // broke off
+                        if (!piece.empty() && !sendAll(piece.data(), piece.size())) {
+                            if (!last) out.stream->stop();
+                            keep = false;
+                            break;
+                        }
+                    }
+                }
+                if (out.file) {
+                    char chunk[64 * 1024];
+                    for (uint64_t off = 0; off < out.file->size;) {
+                        long n = FileCache::readAt(*out.file, chunk, sizeof(chunk), off);
+                        if (n <= 0 || !sendAll(chunk, static_cast<size_t>(n))) {
+                            keep = false;
+                            break;
+                        }
+                        off += static_cast<uint64_t>(n);
+                    }
+                }
+            }
+            if (ssl) {
+                SSL_shutdown(ssl);
+                SSL_free(ssl);
             }
 #ifdef _WIN32
             closesocket(csock);
@@ -690,3 +1692,5 @@ static void sendRaw(SocketType sock, const std::string &data)
         }).detach();
     }
 }
+
+#endif
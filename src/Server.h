@@ -1,26 +1,18 @@
 #pragma once
 #include "LumeniteApp.h"
+#include "HttpParser.h"
+#include "EventLoop.h"
+#include "utils/FileCache.h"
 #include <string>
 #include <unordered_map>
 #include <vector>
-#include <sstream>
+#include <ostream>
 
 extern "C"
 {
 #include "lua.h"
 }
 
-struct HttpRequest
-{
-    std::string method;
-    std::string path;
-    std::unordered_map<std::string, std::string> headers;
-    std::unordered_map<std::string, std::vector<std::string> > query;
-    std::unordered_map<std::string, std::vector<std::string> > form;
-    std::string body;
-    std::string remote_ip;
-};
-
 inline std::ostream &operator<<(std::ostream &os, const HttpRequest &req)
 {
     for (const auto &[key, value]: req.headers) {
@@ -34,22 +26,29 @@ struct HttpResponse
     int status = 200;
     std::unordered_map<std::string, std::string> headers;
     std::string body;
+    FileHandle file; // when set, streamed after the head instead of `body`
+    bool chunked = false; // body follows as Transfer-Encoding: chunked pieces
 
-    std::string serialize() const
-    {
-        std::ostringstream oss;
-        oss << "HTTP/1.1 " << status << " OK\r\n";
-        for (auto &[k,v]: headers)
-            oss << k << ": " << v << "\r\n";
-        oss << "\r\n" << body;
-        return oss.str();
-    }
+    // Status line and headers, ending in the blank line. The body (or file)
+    // is queued after it as its own buffer rather than copied in.
+    std::string serializeHead(bool keepAlive) const;
+};
+
+// How Server::run listens; everything but the backlog and the limits is
+// Linux only.
+struct ListenOptions
+{
+    EventLoop::Backend io = EventLoop::Backend::Epoll; // a TLS listener always uses epoll
+    int backlog = 0; // pending connections per listener; 0 = SOMAXCONN
+    bool reusePort = true; // one SO_REUSEPORT listener per loop instead of one shared
+    bool affinity = false; // pin loop i to CPU i and steer each accept to its CPU's loop
+    ConnectionLimits limits; // deadlines and caps per connection
 };
 
 class Server
 {
 public:
-    Server(int port, lua_State *L);
+    explicit Server(int port, ListenOptions options = {});
 
 
     static std::string getHeaderValue(const std::unordered_map<std::string, std::string> &headers,
@@ -57,9 +56,14 @@ public:
 
     [[noreturn]] void run() const;
 
+    // Load the app script into fresh states and switch new requests to them
+    // once all have loaded; in a worker, every worker does. Returns at once.
+    // False where there is nothing to reload (not serving, or Windows).
+    static bool reload();
+
 private:
     int port;
-    lua_State *L;
+    ListenOptions options;
 
 
     static void sendResponse(int clientSocket, const std::string &out);
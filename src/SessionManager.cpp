@@ -1,64 +1,214 @@
 #include "SessionManager.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
-#include <random>
+#include <stdexcept>
 #include <string.h>
 
+#include <openssl/rand.h>
+
 #include "Server.h"
 
 
 // ————— SessionManager definitions —————
-std::unordered_map<std::string, std::unordered_map<std::string, std::string> > SessionManager::store;
+std::array<SessionManager::Shard, SessionManager::SHARDS> SessionManager::shards;
+std::atomic<int64_t> SessionManager::idleSeconds{30 * 60};
+std::atomic<int64_t> SessionManager::maxAgeSeconds{24 * 60 * 60};
+std::atomic<size_t> SessionManager::maxSessions{100000};
+std::atomic<uint64_t> SessionManager::expiredCount{0};
+std::atomic<uint64_t> SessionManager::evictedCount{0};
+std::atomic<size_t> SessionManager::sweepCursor{0};
 thread_local std::string SessionManager::currentId;
 thread_local bool SessionManager::isNew = false;
 
 static std::string make_id()
 {
-    uint64_t r = std::mt19937_64(
-        static_cast<uint64_t>(
-            std::chrono::high_resolution_clock::now().time_since_epoch().count())
-    )();
-
-    char buffer[17];
-    snprintf(buffer, sizeof(buffer), "%016llx", r);
-    return std::string(buffer);
+    // The id is the only credential a session has, so it comes from the
+    // CSPRNG: 128 bits that earlier ids say nothing about.
+    unsigned char bytes[16];
+    if (RAND_bytes(bytes, sizeof(bytes)) != 1) throw std::runtime_error("[Session] RAND_bytes failed");
+
+    static const char hex[] = "0123456789abcdef";
+    std::string id(sizeof(bytes) * 2, '\0');
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        id[2 * i] = hex[bytes[i] >> 4];
+        id[2 * i + 1] = hex[bytes[i] & 0xf];
+    }
+    return id;
+}
+
+void SessionManager::configure(const Config &config)
+{
+    idleSeconds = config.idleTimeout.count();
+    maxAgeSeconds = config.maxAge.count();
+    maxSessions = std::max<size_t>(config.maxSessions, 1);
+}
+
+SessionManager::Config SessionManager::configuration()
+{
+    Config c;
+    c.idleTimeout = std::chrono::seconds(idleSeconds.load());
+    c.maxAge = std::chrono::seconds(maxAgeSeconds.load());
+    c.maxSessions = maxSessions.load();
+    return c;
+}
+
+SessionManager::Stats SessionManager::stats()
+{
+    Stats s;
+    const auto now = Clock::now();
+    for (auto &shard: shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        expireDue(shard, now);
+        s.live += shard.sessions.size();
+    }
+    s.expired = expiredCount.load();
+    s.evicted = evictedCount.load();
+    return s;
+}
+
+SessionManager::Shard &SessionManager::shardFor(const std::string &id)
+{
+    return shards[std::hash<std::string>{}(id) % SHARDS];
+}
+
+SessionManager::Clock::time_point SessionManager::deadline(const Session &session)
+{
+    return std::min(session.lastSeen + std::chrono::seconds(idleSeconds.load()),
+                    session.created + std::chrono::seconds(maxAgeSeconds.load()));
+}
+
+// Caller holds shard.mutex for all of the helpers below.
+SessionManager::Session &SessionManager::create(Shard &shard, const std::string &id, Clock::time_point now)
+{
+    auto [it, inserted] = shard.sessions.try_emplace(id);
+    Session &session = it->second;
+    if (!inserted) return session;
+
+    session.created = session.lastSeen = now;
+    shard.lru.push_front(&it->first);
+    session.lru = shard.lru.begin();
+    shard.timers.schedule(&it->first, deadline(session));
+
+    // Memory cap: drop the least recently used sessions of this shard.
+    size_t cap = std::max<size_t>(1, maxSessions.load() / SHARDS);
+    while (shard.sessions.size() > cap) {
+        erase(shard, shard.sessions.find(*shard.lru.back()));
+        ++evictedCount;
+    }
+    return session;
+}
+
+void SessionManager::erase(Shard &shard, std::unordered_map<std::string, Session>::iterator it)
+{
+    shard.timers.cancel(&it->first);
+    shard.lru.erase(it->second.lru);
+    shard.sessions.erase(it);
+}
+
+void SessionManager::expireDue(Shard &shard, Clock::time_point now)
+{
+    // Touches only bump lastSeen; a timer that fires early is simply re-armed.
+    shard.timers.advance(now, [&](const std::string *id)
+    {
+        auto it = shard.sessions.find(*id);
+        if (it == shard.sessions.end()) return;
+        Clock::time_point due = deadline(it->second);
+        if (due <= now) {
+            erase(shard, it);
+            ++expiredCount;
+        } else {
+            shard.timers.schedule(id, due);
+        }
+    });
 }
 
 void SessionManager::start(HttpRequest &req, HttpResponse &res)
 {
-    auto it = req.headers.find("Cookie");
-    if (it != req.headers.end()) {
-        const std::string &cookies = it->second;
+    // Workers serve many clients; never inherit the previous request's id.
+    currentId.clear();
+    isNew = false;
+
+    std::string_view cookies = req.header("Cookie");
+    if (!cookies.empty()) {
         size_t p = cookies.find("LUMENITE_SESSION=");
-        if (p != std::string::npos) {
+        if (p != std::string_view::npos) {
             size_t start = p + strlen("LUMENITE_SESSION=");
             size_t end = cookies.find(';', start);
-            currentId = cookies.substr(start, (end == std::string::npos ? cookies.size() : end) - start);
+            currentId = cookies.substr(start, (end == std::string_view::npos ? cookies.size() : end) - start);
         }
     }
 
+    const auto now = Clock::now();
 
+    // Shards only reap when locked, so walk one more per request; skip it
+    // rather than wait if another worker is in there.
+    {
+        Shard &shard = shards[sweepCursor.fetch_add(1, std::memory_order_relaxed) % SHARDS];
+        std::unique_lock<std::mutex> lock(shard.mutex, std::try_to_lock);
+        if (lock.owns_lock()) expireDue(shard, now);
+    }
 
-    //std::cout << res.headers << std::endl;
+    if (!currentId.empty()) {
+        Shard &shard = shardFor(currentId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        expireDue(shard, now);
 
+        auto it = shard.sessions.find(currentId);
+        if (it != shard.sessions.end()) {
+            if (deadline(it->second) > now) {
+                it->second.lastSeen = now;
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru);
+                return;
+            }
+            erase(shard, it);
+            ++expiredCount;
+        }
+    }
 
-    auto sessionIt = store.find(currentId);
-    if (currentId.empty() || sessionIt == store.end()) {
-        currentId = make_id();
-        store[currentId] = {};
-        res.headers["Set-Cookie"] = "LUMENITE_SESSION=" + currentId + "; Path=/; HttpOnly";
+    currentId = make_id();
+    isNew = true;
+    {
+        Shard &shard = shardFor(currentId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        expireDue(shard, now);
+        create(shard, currentId, now);
     }
+    res.headers["Set-Cookie"] = "LUMENITE_SESSION=" + currentId + "; Path=/; HttpOnly";
+}
+
+const std::string &SessionManager::currentSession()
+{
+    return currentId;
+}
+
+void SessionManager::restoreSession(const std::string &id)
+{
+    currentId = id;
 }
 
 std::string SessionManager::get(const std::string &key)
 {
-    auto &session = store[currentId];
-    auto it = session.find(key);
-    return it == session.end() ? "" : it->second;
+    if (currentId.empty()) return "";
+
+    Shard &shard = shardFor(currentId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(currentId);
+    if (it == shard.sessions.end()) return "";
+
+    auto &values = it->second.values;
+    auto v = values.find(key);
+    return v == values.end() ? "" : v->second;
 }
 
 void SessionManager::set(const std::string &key, const std::string &val)
 {
-    store[currentId][key] = val;
+    if (currentId.empty()) return;
+
+    Shard &shard = shardFor(currentId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // The client already holds this id; if the session was evicted while
+    // the handler ran, bring it back rather than dropping the write.
+    create(shard, currentId, Clock::now()).values[key] = val;
 }
@@ -3,29 +3,99 @@
 //
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <list>
 #include <string>
 #include <unordered_map>
+#include <mutex>
+
+#include "utils/TimerWheel.h"
 
 
 // forward‑declare the HTTP structs
 struct HttpRequest;
 struct HttpResponse;
 
-/// Simple in‑memory session store exposed to Lua
+/// In‑memory session store exposed to Lua.
+/// Sessions are spread over independently locked shards; each shard keeps
+/// an LRU list for the memory cap and a timer wheel for idle/absolute expiry.
 class SessionManager
 {
 public:
+    struct Config
+    {
+        std::chrono::seconds idleTimeout{30 * 60};
+        std::chrono::seconds maxAge{24 * 60 * 60};
+        size_t maxSessions = 100000;
+    };
+
+    struct Stats
+    {
+        size_t live = 0;
+        uint64_t expired = 0;
+        uint64_t evicted = 0;
+    };
+
+    static void configure(const Config &config);
+
+    static Config configuration();
+
+    static Stats stats();
+
     static void start(HttpRequest &req, HttpResponse &res);
 
+    // The session bound to this thread; a request that suspends saves it and
+    // restores it on whichever turn of the worker resumes the request.
+    static const std::string &currentSession();
+
+    static void restoreSession(const std::string &id);
+
     static std::string get(const std::string &key);
 
     static void set(const std::string &key, const std::string &val);
 
 private:
-    static std::unordered_map<
-        std::string,
-        std::unordered_map<std::string, std::string>
-    > store;
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t SHARDS = 16;
+
+    struct Session
+    {
+        std::unordered_map<std::string, std::string> values;
+        Clock::time_point created;
+        Clock::time_point lastSeen;
+        std::list<const std::string *>::iterator lru;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        // Keys are stable, so the LRU list and the wheel point at them.
+        std::unordered_map<std::string, Session> sessions;
+        std::list<const std::string *> lru; // most recently used first
+        TimerWheel<const std::string *> timers{std::chrono::seconds(1), 4096};
+    };
+
+    static Shard &shardFor(const std::string &id);
+
+    static Session &create(Shard &shard, const std::string &id, Clock::time_point now);
+
+    static void erase(Shard &shard, std::unordered_map<std::string, Session>::iterator it);
+
+    static void expireDue(Shard &shard, Clock::time_point now);
+
+    static Clock::time_point deadline(const Session &session);
+
+    static std::array<Shard, SHARDS> shards;
+    static std::atomic<int64_t> idleSeconds;
+    static std::atomic<int64_t> maxAgeSeconds;
+    static std::atomic<size_t> maxSessions;
+    static std::atomic<uint64_t> expiredCount;
+    static std::atomic<uint64_t> evictedCount;
+    static std::atomic<size_t> sweepCursor;
+
     static thread_local std::string currentId;
     static thread_local bool isNew;
-};
\ No newline at end of file
+};
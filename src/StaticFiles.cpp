@@ -0,0 +1,543 @@
+#include "StaticFiles.h"
+#include "AccessLog.h"
+#include "Async.h"
+#include "utils/MimeDetector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#endif
+
+namespace fs = std::filesystem;
+
+std::mutex StaticFiles::mutex;
+std::vector<StaticFiles::Mount> StaticFiles::mounts;
+std::unordered_map<std::string, StaticFiles::Slot> StaticFiles::entries;
+std::list<std::string> StaticFiles::lru;
+std::unordered_map<std::string, StaticFiles::Miss> StaticFiles::misses;
+size_t StaticFiles::cachedBytes = 0;
+size_t StaticFiles::openFiles = 0;
+uint64_t StaticFiles::generation = 0;
+
+// Lets every request skip the lock while nothing is mounted.
+static std::atomic<bool> anyMounts{false};
+
+static constexpr std::string_view OK_LINE = "HTTP/1.1 200 OK\r\n";
+static constexpr std::string_view NOT_MODIFIED_LINE = "HTTP/1.1 304 Not Modified\r\n";
+static constexpr size_t SNIFF_BYTES = 512;
+
+#ifdef __linux__
+// Guarded by StaticFiles::mutex.
+static int inotifyFd = -1;
+static std::unordered_map<int, std::string> watchedDirs; // wd -> directory
+static std::unordered_set<std::string> watchedPaths;
+#endif
+
+// Variants being compressed on the I/O pool; guarded by StaticFiles::mutex.
+static std::unordered_set<std::string> compressing;
+
+
+static std::string httpDate(int64_t t)
+{
+    std::time_t tt = static_cast<std::time_t>(t);
+    std::tm tm{};
+#ifdef _WIN32
+    gmtime_s(&tm, &tt);
+#else
+    gmtime_r(&tt, &tm);
+#endif
+    char buf[40];
+    std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+static int64_t parseHttpDate(std::string_view s)
+{
+    std::tm tm{};
+    std::istringstream in{std::string(s)};
+    in >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S");
+    if (in.fail()) return -1;
+#ifdef _WIN32
+    return static_cast<int64_t>(_mkgmtime(&tm));
+#else
+    return static_cast<int64_t>(timegm(&tm));
+#endif
+}
+
+static uint64_t fnv1a(std::string_view data)
+{
+    uint64_t h = 1469598103934665603ull;
+    for (unsigned char c: data) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// If-None-Match uses the weak comparison, so W/"x" matches "x".
+static bool etagMatches(std::string_view list, std::string_view etag)
+{
+    while (true) {
+        size_t comma = list.find(',');
+        std::string_view item = trim(list.substr(0, comma));
+        if (item == "*") return true;
+        if (item.starts_with("W/")) item.remove_prefix(2);
+        if (item == etag) return true;
+        if (comma == std::string_view::npos) return false;
+        list.remove_prefix(comma + 1);
+    }
+}
+
+// "/a%20b/" -> "/a b/index.html"; nothing for anything that could leave the mount.
+static std::optional<std::string> relativePath(std::string_view rest)
+{
+    std::string rel;
+    rel.reserve(rest.size() + 11);
+    if (rest.empty() || rest.front() != '/') rel += '/';
+    for (size_t i = 0; i < rest.size(); ++i) {
+        char c = rest[i];
+        if (c == '%' && i + 2 < rest.size() && std::isxdigit((unsigned char) rest[i + 1]) &&
+            std::isxdigit((unsigned char) rest[i + 2])) {
+            c = static_cast<char>(std::stoi(std::string(rest.substr(i + 1, 2)), nullptr, 16));
+            i += 2;
+        }
+        if (c == '\0' || c == '\\') return std::nullopt;
+        rel += c;
+    }
+    for (size_t pos = 0; pos < rel.size();) {
+        size_t next = rel.find('/', pos + 1);
+        std::string_view seg = std::string_view(rel).substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1);
+        if (seg == "..") return std::nullopt;
+        if (next == std::string::npos) break;
+        pos = next;
+    }
+    if (rel.back() == '/') rel += "index.html";
+    return rel;
+}
+
+
+void StaticFiles::mount(const std::string &prefix, const std::string &dir)
+{
+    std::error_code ec;
+    fs::path root = fs::canonical(dir, ec);
+    if (ec || !fs::is_directory(root, ec)) throw std::runtime_error("'" + dir + "' is not a directory");
+
+    std::string p = prefix;
+    if (p.empty() || p.front() != '/') p.insert(p.begin(), '/');
+    while (!p.empty() && p.back() == '/') p.pop_back();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = std::find_if(mounts.begin(), mounts.end(), [&](const Mount &m) { return m.prefix == p; });
+    if (it != mounts.end()) {
+        it->root = root.generic_string();
+    } else {
+        mounts.push_back({p, root.generic_string()});
+        // Longest prefix first, so a nested mount wins.
+        std::stable_sort(mounts.begin(), mounts.end(),
+                         [](const Mount &a, const Mount &b) { return a.prefix.size() > b.prefix.size(); });
+    }
+    anyMounts = true;
+
+#ifdef __linux__
+    if (inotifyFd < 0) {
+        inotifyFd = inotify_init1(IN_CLOEXEC);
+        if (inotifyFd >= 0) std::thread(watchLoop).detach();
+    }
+#endif
+}
+
+std::optional<WireResponse> StaticFiles::serve(const HttpRequest &req, bool keepAlive)
+{
+    return respond(req, keepAlive, nullptr);
+}
+
+std::optional<WireResponse> StaticFiles::cached(const HttpRequest &req, bool keepAlive, bool &pending)
+{
+    pending = false;
+    return respond(req, keepAlive, &pending);
+}
+
+// Without `pending`, a path the cache does not know is looked up on disk.
+std::optional<WireResponse> StaticFiles::respond(const HttpRequest &req, bool keepAlive, bool *pending)
+{
+    if (!anyMounts) return std::nullopt;
+    bool headOnly = req.method == "HEAD";
+    if (!headOnly && req.method != "GET") return std::nullopt;
+
+    std::string root;
+    std::string_view rest;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Mount &m: mounts) {
+            if (!req.path.starts_with(m.prefix)) continue;
+            rest = req.path.substr(m.prefix.size());
+            if (!rest.empty() && rest.front() != '/') continue;
+            root = m.root;
+            break;
+        }
+    }
+    if (root.empty()) return std::nullopt;
+
+    auto rel = relativePath(rest);
+    if (!rel) return std::nullopt;
+    std::string path = root + *rel;
+
+    EntryPtr entry = lookup(path);
+    if (!entry) {
+        if (missing(path)) return std::nullopt;
+        if (pending) {
+            *pending = true;
+            return std::nullopt;
+        }
+        bool watched;
+        uint64_t before = prepare(path, watched);
+        entry = load(path, root);
+        if (!entry) {
+            remember(path, watched, before);
+            return std::nullopt; // not ours: the router may still know it
+        }
+        insert(entry, before);
+    }
+
+    // Each encoding is its own representation, with its own ETag.
+    using Encoding = Compression::Encoding;
+    bool varies = entry->size <= MAX_COMPRESSED_FILE && Compression::compressible(entry->type, entry->size);
+    Encoding encoding = varies ? Compression::negotiate(req.header("Accept-Encoding")) : Encoding::Identity;
+    std::string etag = entry->etag;
+    if (encoding != Encoding::Identity) etag.insert(etag.size() - 1, std::string("-") + Compression::name(encoding));
+
+    bool notModified;
+    if (std::string_view inm = req.header("If-None-Match"); !inm.empty()) {
+        notModified = etagMatches(inm, etag);
+    } else {
+        std::string_view ims = req.header("If-Modified-Since");
+        int64_t since = ims.empty() ? -1 : parseHttpDate(ims);
+        notModified = since >= 0 && entry->mtime <= since;
+    }
+
+    std::shared_ptr<const std::string> variant;
+    if (encoding != Encoding::Identity && !notModified) {
+        variant = compressed(entry, encoding);
+        if (!variant) {
+            encoding = Encoding::Identity;
+            etag = entry->etag;
+        }
+    }
+
+    WireResponse wire;
+    wire.keepAlive = keepAlive;
+    std::string &head = wire.head;
+    head.reserve(NOT_MODIFIED_LINE.size() + entry->fields.size() + etag.size() + 128);
+    head += notModified ? NOT_MODIFIED_LINE : OK_LINE;
+    head += entry->fields;
+    head += "ETag: ";
+    head += etag;
+    head += "\r\n";
+    if (varies) head += "Vary: Accept-Encoding\r\n";
+    if (encoding != Encoding::Identity) {
+        head += "Content-Encoding: ";
+        head += Compression::name(encoding);
+        head += "\r\n";
+    }
+    head += keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if (!notModified) {
+        head += "Content-Length: ";
+        head += std::to_string(variant ? variant->size() : entry->size);
+        head += "\r\n";
+        if (!headOnly) {
+            if (variant) wire.body = *variant;
+            else if (entry->file) wire.file = entry->file;
+            else wire.body = entry->body;
+        }
+    }
+    head += "\r\n";
+
+    AccessLog::request(notModified ? 304 : 200, req.method, req.path, req.remote_ip);
+    return wire;
+}
+
+StaticFiles::EntryPtr StaticFiles::lookup(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (it == entries.end()) return nullptr;
+
+    Slot &slot = it->second;
+    if (!slot.watched && Clock::now() - slot.checked >= REVALIDATE_AFTER) {
+        struct stat st{};
+        if (stat(path.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_size) != slot.entry->size ||
+            static_cast<int64_t>(st.st_mtime) != slot.entry->mtime) {
+            erase(it);
+            return nullptr;
+        }
+        slot.checked = Clock::now();
+    }
+    lru.splice(lru.begin(), lru, slot.lru);
+    return slot.entry;
+}
+
+StaticFiles::EntryPtr StaticFiles::load(const std::string &path, const std::string &root)
+{
+    // A symlink may lead out of the mount.
+    std::error_code ec;
+    std::string real = fs::canonical(path, ec).generic_string();
+    if (ec || real.size() <= root.size() || real.compare(0, root.size(), root) != 0 || real[root.size()] != '/')
+        return nullptr;
+
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd < 0) return nullptr;
+
+    auto file = std::make_shared<OpenFile>();
+    file->fd = fd;
+    file->path = path;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+    file->size = static_cast<uint64_t>(st.st_size);
+    file->mtime = static_cast<int64_t>(st.st_mtime);
+    file->inode = static_cast<uint64_t>(st.st_ino);
+
+    auto entry = std::make_shared<Entry>();
+    entry->path = path;
+    entry->size = file->size;
+    entry->mtime = file->mtime;
+
+    char sniff[SNIFF_BYTES];
+    long sniffed;
+    char tag[64];
+    if (file->size <= MAX_CACHED_FILE) {
+        entry->body.resize(file->size);
+        uint64_t off = 0;
+        while (off < file->size) {
+            long n = FileCache::readAt(*file, entry->body.data() + off, file->size - off, off);
+            if (n <= 0) return nullptr;
+            off += static_cast<uint64_t>(n);
+        }
+        sniffed = static_cast<long>(std::min<size_t>(entry->body.size(), SNIFF_BYTES));
+        std::memcpy(sniff, entry->body.data(), sniffed);
+        std::snprintf(tag, sizeof(tag), "\"%016llx\"", (unsigned long long) fnv1a(entry->body));
+    } else {
+        sniffed = FileCache::readAt(*file, sniff, sizeof(sniff), 0);
+        std::snprintf(tag, sizeof(tag), "\"%llx-%llx-%llx\"", (unsigned long long) file->size,
+                      (unsigned long long) file->mtime, (unsigned long long) file->inode);
+        entry->file = file;
+    }
+    file->mime = MimeDetector::toString(MimeDetector::detect(
+        reinterpret_cast<const uint8_t *>(sniff), sniffed > 0 ? static_cast<size_t>(sniffed) : 0, path));
+
+    entry->etag = tag;
+    entry->type = file->mime;
+    entry->fields = "Content-Type: " + entry->type + "\r\nLast-Modified: " + httpDate(entry->mtime) + "\r\n";
+    return entry;
+}
+
+// The file in `encoding` if Compression has it for this version. Otherwise
+// nothing, and the variant is built on the I/O pool for later requests:
+// reading and deflating up to MAX_COMPRESSED_FILE would stall the loop.
+std::shared_ptr<const std::string> StaticFiles::compressed(const EntryPtr &entry, Compression::Encoding encoding)
+{
+    std::string key = "file:" + entry->path;
+    if (auto hit = Compression::find(key, entry->etag, encoding)) return hit;
+    if (!Compression::keeps(entry->size)) return nullptr; // would never be cached
+
+    std::string job = key + "\n" + entry->etag + Compression::name(encoding);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!compressing.insert(job).second) return nullptr; // already under way
+    }
+    Async::run([entry, key = std::move(key), job = std::move(job), encoding]
+    {
+        try {
+            if (!entry->file) {
+                Compression::cached(key, entry->etag, encoding, entry->body);
+            } else {
+                std::string whole(entry->size, '\0');
+                uint64_t off = 0;
+                while (off < entry->size) {
+                    long n = FileCache::readAt(*entry->file, whole.data() + off, entry->size - off, off);
+                    if (n <= 0) break;
+                    off += static_cast<uint64_t>(n);
+                }
+                if (off == entry->size) Compression::cached(key, entry->etag, encoding, whole);
+            }
+        } catch (const std::exception &) {
+            // Left uncached; the file keeps going out as it is.
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        compressing.erase(job);
+    });
+    return nullptr;
+}
+
+// Whether `path` was found missing lately and nothing has changed since.
+bool StaticFiles::missing(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = misses.find(path);
+    if (it == misses.end()) return false;
+    if (it->second.watched || Clock::now() - it->second.at < MISS_TTL) return true;
+    misses.erase(it);
+    return false;
+}
+
+void StaticFiles::remember(const std::string &path, bool watched, uint64_t loadedAt)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation != loadedAt) return;
+    if (misses.size() >= MISS_ENTRIES) {
+        auto now = Clock::now();
+        std::erase_if(misses, [&](const auto &m) { return !m.second.watched && now - m.second.at >= MISS_TTL; });
+        // Still full: any one will do, it is only looked up again.
+        if (misses.size() >= MISS_ENTRIES) misses.erase(misses.begin());
+    }
+    misses[path] = Miss{watched, Clock::now()};
+}
+
+// Before loading `path`: watch its directory first, so no change can slip in
+// between the read and the watch. Sets `watched` if that worked, which fails
+// when the directory does not exist. Returns the generation to hand to
+// insert() or remember().
+uint64_t StaticFiles::prepare(const std::string &path, bool &watched)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    watched = watch(path.substr(0, path.rfind('/')));
+    return generation;
+}
+
+void StaticFiles::insert(const EntryPtr &entry, uint64_t loadedAt)
+{
+    std::string dir = entry->path.substr(0, entry->path.rfind('/'));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // Something changed while it was being read; serve it once, don't keep it.
+    if (generation != loadedAt) return;
+    if (auto it = entries.find(entry->path); it != entries.end()) erase(it);
+
+    lru.push_front(entry->path);
+    entries.emplace(entry->path, Slot{entry, lru.begin(), watch(dir), Clock::now()});
+    cachedBytes += entry->body.size();
+    if (entry->file) ++openFiles;
+
+    while (entries.size() > CACHE_ENTRIES || cachedBytes > CACHE_BYTES || openFiles > MAX_OPEN_FILES)
+        erase(entries.find(lru.back()));
+}
+
+void StaticFiles::erase(std::unordered_map<std::string, Slot>::iterator it)
+{
+    cachedBytes -= it->second.entry->body.size();
+    if (it->second.entry->file) --openFiles;
+    lru.erase(it->second.lru);
+    entries.erase(it);
+}
+
+// Drop `path`, or everything at and below it; "" with `subtree` drops all.
+void StaticFiles::invalidate(const std::string &path, bool subtree)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ++generation;
+    if (!subtree) {
+        if (auto it = entries.find(path); it != entries.end()) erase(it);
+        misses.erase(path);
+        return;
+    }
+    auto under = [&](const std::string &p)
+    {
+        return path.empty() || p == path || (p.starts_with(path) && p[path.size()] == '/');
+    };
+    for (auto it = entries.begin(); it != entries.end();) {
+        auto next = std::next(it);
+        if (under(it->first)) erase(it);
+        it = next;
+    }
+    std::erase_if(misses, [&](const auto &m) { return under(m.first); });
+}
+
+// Called with the lock held: make sure changes in `dir` are reported.
+bool StaticFiles::watch(const std::string &dir)
+{
+#ifdef __linux__
+    if (inotifyFd < 0) return false;
+    if (watchedPaths.count(dir)) return true;
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO |
+                               IN_DELETE | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (wd < 0) return false; // out of watches: fall back to stat()
+    watchedDirs[wd] = dir;
+    watchedPaths.insert(dir);
+    return true;
+#else
+    (void) dir;
+    return false;
+#endif
+}
+
+void StaticFiles::watchLoop()
+{
+#ifdef __linux__
+    alignas(inotify_event) char buf[16 * 1024];
+    while (true) {
+        ssize_t n = read(inotifyFd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return;
+        }
+        for (char *p = buf; p < buf + n;) {
+            auto *ev = reinterpret_cast<inotify_event *>(p);
+            p += sizeof(inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                invalidate("", true); // events were lost
+                continue;
+            }
+
+            std::string dir;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = watchedDirs.find(ev->wd);
+                if (it == watchedDirs.end()) continue;
+                dir = it->second;
+                if (ev->mask & IN_IGNORED) {
+                    watchedPaths.erase(dir);
+                    watchedDirs.erase(it);
+                }
+            }
+
+            if (ev->len > 0) invalidate(dir + "/" + ev->name, ev->mask & IN_ISDIR);
+            else invalidate(dir, true); // the directory itself changed or went away
+        }
+    }
+#endif
+}
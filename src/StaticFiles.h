@@ -0,0 +1,125 @@
+#pragma once
+#include "Compression.h"
+#include "EventLoop.h"
+#include "HttpParser.h"
+#include "utils/FileCache.h"
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/// Directories mounted with app.static(prefix, dir), answered on the event
+/// loop before the router runs, so a static hit never touches a lua_State.
+/// Small files are cached whole, larger ones as an open descriptor for
+/// sendfile; either way with a precomputed head (Content-Type, strong ETag,
+/// Last-Modified). Text assets are also sent gzip- or deflate-encoded when
+/// the client takes it, compressed once per version of the file on the
+/// Async I/O pool and kept in Compression's cache; until a variant is there
+/// the file goes out as it is. Entries are dropped as soon as inotify
+/// reports a change, or re-validated by stat() where inotify is not
+/// available. Paths found missing are remembered too, until inotify reports
+/// a change in their directory or, where it cannot, for MISS_TTL; the loop
+/// itself only ever answers from the cache.
+class StaticFiles
+{
+public:
+    static constexpr size_t MAX_CACHED_FILE = 64 * 1024; // larger files are sent with sendfile
+    static constexpr size_t CACHE_BYTES = 64 * 1024 * 1024;
+    static constexpr size_t CACHE_ENTRIES = 4096;
+    static constexpr size_t MAX_OPEN_FILES = 256; // entries holding a descriptor
+    static constexpr size_t MAX_COMPRESSED_FILE = 1024 * 1024; // larger files always go out as they are
+    static constexpr std::chrono::seconds REVALIDATE_AFTER{1}; // without inotify only
+    static constexpr size_t MISS_ENTRIES = 4096;
+    static constexpr std::chrono::seconds MISS_TTL{1}; // misses inotify does not cover
+
+    // Serve `dir` under the URL `prefix`; mounting the same prefix again
+    // replaces it. Throws std::runtime_error if `dir` is not a directory.
+    static void mount(const std::string &prefix, const std::string &dir);
+
+    // The response for a GET/HEAD of a file under a mount, 304 included;
+    // nothing if the request is not for an existing static file. May open
+    // and read the file, so not for the event loop.
+    static std::optional<WireResponse> serve(const HttpRequest &req, bool keepAlive);
+
+    // serve() from the cache alone, for the event loop. Nothing with
+    // `pending` set means the path is not known either way yet: only serve()
+    // can tell.
+    static std::optional<WireResponse> cached(const HttpRequest &req, bool keepAlive, bool &pending);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Mount
+    {
+        std::string prefix; // "/static", or "" for the root
+        std::string root; // canonical, no trailing slash
+    };
+
+    struct Entry
+    {
+        std::string path;
+        std::string fields; // Content-Type and Last-Modified lines
+        std::string type;
+        std::string etag;
+        int64_t mtime = 0;
+        uint64_t size = 0;
+        std::string body; // whole file, if small
+        FileHandle file; // otherwise
+    };
+
+    using EntryPtr = std::shared_ptr<const Entry>;
+
+    struct Slot
+    {
+        EntryPtr entry;
+        std::list<std::string>::iterator lru;
+        bool watched = false; // inotify covers it; otherwise stat() it now and then
+        Clock::time_point checked;
+    };
+
+    struct Miss
+    {
+        bool watched = false; // inotify will drop it; otherwise it expires
+        Clock::time_point at;
+    };
+
+    static std::optional<WireResponse> respond(const HttpRequest &req, bool keepAlive, bool *pending);
+
+    static EntryPtr lookup(const std::string &path);
+
+    static bool missing(const std::string &path);
+
+    static void remember(const std::string &path, bool watched, uint64_t loadedAt);
+
+    static EntryPtr load(const std::string &path, const std::string &root);
+
+    static std::shared_ptr<const std::string> compressed(const EntryPtr &entry, Compression::Encoding encoding);
+
+    static uint64_t prepare(const std::string &path, bool &watched);
+
+    static void insert(const EntryPtr &entry, uint64_t loadedAt);
+
+    static void invalidate(const std::string &path, bool subtree);
+
+    static void erase(std::unordered_map<std::string, Slot>::iterator it);
+
+    static bool watch(const std::string &dir);
+
+    static void watchLoop();
+
+    static std::mutex mutex;
+    static std::vector<Mount> mounts; // longest prefix first
+    static std::unordered_map<std::string, Slot> entries;
+    static std::list<std::string> lru; // most recently used first
+    static std::unordered_map<std::string, Miss> misses;
+    static size_t cachedBytes;
+    static size_t openFiles;
+    static uint64_t generation; // bumped by every invalidation
+};
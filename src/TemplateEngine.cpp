@@ -8,15 +8,13 @@
 #include <regex>
 
 
-lua_State *TemplateEngine::luaState_ = nullptr;
-std::unordered_map<std::string, int> TemplateEngine::luaFilters_;
 TemplateValue TemplateEngine::globalContext_;
 
 
 TemplateEngine::Config TemplateEngine::config_;
 std::mutex TemplateEngine::cacheMutex_;
 std::unordered_map<std::string, TemplateEngine::CacheEntry> TemplateEngine::templateCache_;
-std::unordered_map<std::string, TemplateEngine::CacheEntry> TemplateEngine::compiledCache_;
+std::unordered_map<std::string, TemplateEngine::CompiledEntry> TemplateEngine::compiledCache_;
 
 
 void TemplateEngine::setGlobal(const std::string &key, const TemplateValue &val)
@@ -93,61 +91,156 @@ void TemplateEngine::registerLuaFilter(const std::string &name, lua_State *L, in
         throw std::runtime_error("Expected a function for filter: " + name);
     }
 
+    funcIndex = lua_absindex(L, funcIndex);
+    if (lua_getfield(L, LUA_REGISTRYINDEX, FILTERS_KEY) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, FILTERS_KEY);
+    }
     lua_pushvalue(L, funcIndex); // copy the function
-    int ref = luaL_ref(L, LUA_REGISTRYINDEX); // store in Lua registry
-    luaFilters_[name] = ref;
+    lua_setfield(L, -2, name.c_str()); // store in this state's filter table
+    lua_pop(L, 1);
+}
+
+
+std::string TemplateEngine::renderFromString(const std::string &templateText,
+                                             const TemplateValue &context,
+                                             lua_State *L)
+{
+    auto tmpl = getCompiled("", &templateText);
+    std::string out;
+    out.reserve(templateText.size());
+    renderNodes(tmpl->nodes, context, nullptr, L, out);
+    return out;
+}
+
+
+std::string TemplateEngine::renderFile(const std::string &filename,
+                                       const TemplateValue &context,
+                                       lua_State *L)
+{
+    auto tmpl = getCompiled(filename, nullptr);
+    std::string out;
+    renderNodes(tmpl->nodes, context, nullptr, L, out);
+    return out;
+}
 
-    if (!luaState_) {
-        luaState_ = L;
+
+static bool sourcesUnchanged(const CompiledTemplate &tmpl)
+{
+    for (const auto &[path, mtime]: tmpl.sources) {
+        std::error_code ec;
+        if (std::filesystem::last_write_time(path, ec) != mtime || ec) return false;
     }
+    return true;
 }
 
+std::shared_ptr<const CompiledTemplate> TemplateEngine::getCompiled(const std::string &filename,
+                                                                    const std::string *inlineText)
+{
+    const std::string key = inlineText ? "string:" + *inlineText : "file:" + getFullPath(filename);
 
-std::string TemplateEngine::renderFromString(const std::string &templateText,
-                                             const TemplateValue &context)
+    if (config_.enableCache) {
+        // At most one render a second per template looks at the disk, and
+        // it does so outside the lock; the rest use what is cached.
+        std::shared_ptr<const CompiledTemplate> cached;
+        bool recheck = false;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex_);
+            auto it = compiledCache_.find(key);
+            if (it != compiledCache_.end()) {
+                const auto now = std::chrono::steady_clock::now();
+                cached = it->second.tmpl;
+                it->second.lastUsed = now;
+                if (now - it->second.checked >= FRESHNESS_INTERVAL) {
+                    it->second.checked = now;
+                    recheck = true;
+                }
+            }
+        }
+        if (cached && (!recheck || sourcesUnchanged(*cached))) return cached;
+    }
+
+    // Compile outside the lock; two workers racing on a cold template both
+    // build it and the later insert wins, which is harmless.
+    auto tmpl = std::make_shared<CompiledTemplate>();
+    compile(inlineText ? *inlineText : readSource(filename, *tmpl), *tmpl);
+
+    if (config_.enableCache) {
+        std::lock_guard<std::mutex> lock(cacheMutex_);
+        if (compiledCache_.size() >= config_.maxCacheSize) {
+            evictLRU();
+        }
+        const auto now = std::chrono::steady_clock::now();
+        compiledCache_[key] = {tmpl, now, now};
+    }
+    return tmpl;
+}
+
+
+void TemplateEngine::compile(const std::string &text, CompiledTemplate &out)
 {
     std::vector<std::string> includeStack;
-    std::string processedContent = processIncludes(templateText, includeStack);
+    std::string flat = processIncludes(text, includeStack, out);
+    flat = resolveInheritance(flat, {}, out, 0);
+    out.nodes = parse(flat);
+}
+
+
+std::string TemplateEngine::readSource(const std::string &filename, CompiledTemplate &out)
+{
+    std::string fullPath = getFullPath(filename);
+
+    std::ifstream file(fullPath, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("[TemplateError.TemplateNotFound] Template not found: " + filename);
+    }
+
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    std::error_code ec;
+    out.sources.emplace_back(fullPath, std::filesystem::last_write_time(fullPath, ec));
+    return content;
+}
+
 
-    std::string workingContent = processedContent;
-    std::string parentFile;
+std::string TemplateEngine::resolveInheritance(const std::string &text,
+                                               std::unordered_map<std::string, std::string> overrides,
+                                               CompiledTemplate &out, int depth)
+{
+    if (depth > 16) {
+        throw std::runtime_error("[TemplateError.SyntaxError] Template inheritance too deep (circular extends?)");
+    }
 
     // Regex match for: {% extends "filename" %}
-    std::regex extendsPattern(R"(\{\%\s*extends\s*"([^"]+)\"\s*\%\})");
+    static const std::regex extendsPattern(R"(\{\%\s*extends\s*"([^"]+)\"\s*\%\})");
     std::smatch match;
 
-    if (std::regex_search(workingContent, match, extendsPattern)) {
-        parentFile = match[1];
+    if (!std::regex_search(text, match, extendsPattern)) {
+        // Top of the chain: fill every block with the deepest override, or
+        // its own default content.
+        std::string result = text;
+        injectBlocks(result, overrides);
+        return result;
+    }
 
-        // Validate template name
-        if (parentFile.find('<') != std::string::npos || parentFile.find('>') != std::string::npos) {
-            throw std::runtime_error("[TemplateError.SyntaxError] Invalid parent template name: " + parentFile);
-        }
+    std::string parentFile = match[1];
 
-        // Remove the entire {% extends ... %} line
-        workingContent = std::regex_replace(workingContent, extendsPattern, "");
+    // Validate template name
+    if (parentFile.find('<') != std::string::npos || parentFile.find('>') != std::string::npos) {
+        throw std::runtime_error("[TemplateError.SyntaxError] Invalid parent template name: " + parentFile);
     }
 
-    std::unordered_map<std::string, std::string> childBlocks;
-    std::string childBody = extractAndProcessBlocks(workingContent, childBlocks);
-
-    std::string result;
-    if (!parentFile.empty()) {
-        std::string parentContent = loadTemplate(parentFile);
-        std::vector<std::string> parentIncludeStack;
-        std::string processedParent = processIncludes(parentContent, parentIncludeStack);
-        injectBlocks(processedParent, childBlocks);
-        result = processedParent;
-    } else if (!childBlocks.empty()) {
-        result = childBody;
-    } else {
-        result = workingContent;
+    std::unordered_map<std::string, std::string> blocks;
+    extractAndProcessBlocks(match.prefix().str() + match.suffix().str(), blocks);
+    for (auto &[name, body]: overrides) {
+        blocks[name] = std::move(body); // the deeper child wins
     }
 
-    result = processLoops(result, context);
-    result = processConditionals(result, context);
-    result = substitute(result, context);
-    return result;
+    std::vector<std::string> parentIncludeStack;
+    std::string parent = processIncludes(readSource(parentFile, out), parentIncludeStack, out);
+    return resolveInheritance(parent, std::move(blocks), out, depth + 1);
 }
 
 
@@ -190,9 +283,10 @@ std::string TemplateEngine::loadTemplate(const std::string &filename)
 }
 
 
-std::string TemplateEngine::processIncludes(const std::string &text, std::vector<std::string> &includeStack)
+std::string TemplateEngine::processIncludes(const std::string &text, std::vector<std::string> &includeStack,
+                                            CompiledTemplate &out)
 {
-    std::regex includePattern(R"(\{\%\s*include\s*"([^"]+)\"\s*\%\})");
+    static const std::regex includePattern(R"(\{\%\s*include\s*"([^"]+)\"\s*\%\})");
     std::smatch match;
     std::string result;
     std::string::const_iterator searchStart(text.cbegin());
@@ -206,8 +300,8 @@ std::string TemplateEngine::processIncludes(const std::string &text, std::vector
         }
 
         includeStack.push_back(filename);
-        std::string includedContent = loadTemplate(filename);
-        std::string processedInclude = processIncludes(includedContent, includeStack);
+        std::string includedContent = readSource(filename, out);
+        std::string processedInclude = processIncludes(includedContent, includeStack, out);
         includeStack.pop_back();
 
         result.append(processedInclude);
@@ -219,79 +313,6 @@ std::string TemplateEngine::processIncludes(const std::string &text, std::vector
 }
 
 
-std::string TemplateEngine::processConditionals(const std::string &text, const TemplateValue &context)
-{
-    std::regex ifPattern(R"(\{\%\s*if\s+([^\%]+?)\s*\%\}((.|\n)*?)\{\%\s*endif\s*\%\})");
-    std::smatch match;
-    std::string result = text;
-    bool matched = true;
-
-    while (matched) {
-        matched = std::regex_search(result, match, ifPattern);
-        if (!matched) break;
-
-        std::string condition = trim(match[1]);
-        std::string block = match[2];
-
-        bool shouldShow = false;
-        auto value = resolve(context, condition);
-        if (value) {
-            std::string s = value->toString();
-            shouldShow = !s.empty() && s != "0" && s != "false";
-        }
-
-        result = match.prefix().str() + (shouldShow ? block : "") + match.suffix().str();
-    }
-
-    return result;
-}
-
-
-std::string TemplateEngine::processLoops(const std::string &text, const TemplateValue &ctx)
-{
-    std::regex forPattern(R"(\{\%\s*for\s+(\w+)\s+in\s+(\w+)\s*\%\}([\s\S]*?)\{\%\s*endfor\s*\%\})");
-    std::smatch match;
-    std::string result = text;
-    bool matched = true;
-
-    while (matched) {
-        matched = std::regex_search(result, match, forPattern);
-
-        if (!matched) break;
-
-        std::string loopVar = match[1];
-        std::string listName = match[2];
-        std::string block = match[3];
-
-        std::string loopOut;
-
-        auto maybeList = resolve(ctx, listName);
-        if (!maybeList || !std::holds_alternative<TemplateList>(maybeList->value)) {
-            throw std::runtime_error("[TemplateError.ValueError] List not found or invalid: " + listName);
-        }
-
-        const TemplateList &items = std::get<TemplateList>(maybeList->value);
-        for (const auto &item: items) {
-            TemplateMap combinedCtx;
-
-            if (ctx.isMap()) {
-                combinedCtx = ctx.asMap(); // copy parent context
-            }
-
-            combinedCtx[loopVar] = item;
-            TemplateValue loopCtx;
-            loopCtx.value = combinedCtx;
-
-            loopOut += substitute(block, loopCtx);
-        }
-
-        result = match.prefix().str() + loopOut + match.suffix().str();
-    }
-
-    return result;
-}
-
-
 std::string TemplateEngine::extractAndProcessBlocks(
     const std::string &text,
     std::unordered_map<std::string, std::string> &blocks)
@@ -362,72 +383,276 @@ void TemplateEngine::injectBlocks(std::string &parent,
 }
 
 
-std::string TemplateEngine::substitute(const std::string &text, const TemplateValue &ctx)
+static std::vector<std::string> splitPath(const std::string &key)
 {
-    std::regex variablePattern(R"(\{\{\s*(.*?)\s*\}\})");
-    std::smatch match;
-    std::string result;
-    std::string::const_iterator searchStart(text.cbegin());
-
-    while (std::regex_search(searchStart, text.cend(), match, variablePattern)) {
-        result.append(searchStart, match[0].first);
-
-        std::string expression = match[1].str(); // e.g., name|default("John")|upper
-        std::istringstream ss(expression);
-        std::string segment;
-        std::vector<std::string> parts;
-
-        while (std::getline(ss, segment, '|'))
-            parts.push_back(trim(segment));
+    std::vector<std::string> path;
+    size_t start = 0;
+    while (true) {
+        size_t dot = key.find('.', start);
+        path.push_back(key.substr(start, dot - start));
+        if (dot == std::string::npos) break;
+        start = dot + 1;
+    }
+    return path;
+}
 
-        if (parts.empty())
-            throw std::runtime_error("Empty {{ }} expression");
 
-        std::string key = parts[0];
-        std::string value;
-        std::string fallback;
+std::vector<TemplateNode> TemplateEngine::parse(const std::string &text)
+{
+    using Kind = TemplateNode::Kind;
+
+    std::vector<TemplateNode> root;
+    // Open {% for %} / {% if %} bodies. A parent list is never appended to
+    // while one of its children is open, so these pointers stay valid.
+    std::vector<std::vector<TemplateNode> *> stack{&root};
+    std::vector<Kind> open;
+
+    auto appendText = [&](size_t from, size_t to)
+    {
+        if (to <= from) return;
+        auto &nodes = *stack.back();
+        if (!nodes.empty() && nodes.back().kind == Kind::Text) {
+            nodes.back().text.append(text, from, to - from);
+        } else {
+            TemplateNode node;
+            node.text.assign(text, from, to - from);
+            nodes.push_back(std::move(node));
+        }
+    };
 
-        auto resolved = resolve(ctx, key);
-        if (resolved) value = resolved->toString();
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t tagStart = text.find('{', pos);
+        if (tagStart == std::string::npos || tagStart + 1 >= text.size()) {
+            appendText(pos, text.size());
+            break;
+        }
 
-        for (size_t i = 1; i < parts.size(); ++i) {
-            const std::string &filter = parts[i];
+        char kind = text[tagStart + 1];
+        if (kind != '{' && kind != '%') {
+            appendText(pos, tagStart + 1);
+            pos = tagStart + 1;
+            continue;
+        }
 
-            if (filter.starts_with("default(") && filter.back() == ')') {
-                fallback = filter.substr(8, filter.size() - 9);
-                if (!fallback.empty() && fallback.front() == '"' && fallback.back() == '"') {
-                    fallback = fallback.substr(1, fallback.size() - 2);
-                }
+        size_t tagEnd = text.find(kind == '{' ? "}}" : "%}", tagStart + 2);
+        if (tagEnd == std::string::npos) {
+            appendText(pos, text.size());
+            break;
+        }
 
-                if (value.empty()) value = fallback;
-            } else {
-                auto fit = luaFilters_.find(filter);
-                if (fit != luaFilters_.end() && luaState_) {
-                    lua_rawgeti(luaState_, LUA_REGISTRYINDEX, fit->second);
-                    lua_pushstring(luaState_, value.c_str());
-                    if (lua_pcall(luaState_, 1, 1, 0) == LUA_OK) {
-                        if (lua_isstring(luaState_, -1)) value = lua_tostring(luaState_, -1);
-                        lua_pop(luaState_, 1);
-                    } else {
-                        std::string err = lua_tostring(luaState_, -1);
-                        lua_pop(luaState_, 1);
-                        throw std::runtime_error("Lua filter error: " + err);
+        appendText(pos, tagStart);
+        std::string inner = trim(text.substr(tagStart + 2, tagEnd - tagStart - 2));
+        size_t next = tagEnd + 2;
+
+        if (kind == '{') {
+            // e.g., name|default("John")|upper
+            std::istringstream ss(inner);
+            std::string segment;
+            std::vector<std::string> parts;
+            while (std::getline(ss, segment, '|'))
+                parts.push_back(trim(segment));
+
+            if (parts.empty())
+                throw std::runtime_error("Empty {{ }} expression");
+
+            TemplateNode node;
+            node.kind = Kind::Variable;
+            node.text = parts[0];
+            node.path = splitPath(parts[0]);
+            for (size_t i = 1; i < parts.size(); ++i) {
+                const std::string &filter = parts[i];
+                if (filter.starts_with("default(") && filter.back() == ')') {
+                    std::string fallback = filter.substr(8, filter.size() - 9);
+                    if (!fallback.empty() && fallback.front() == '"' && fallback.back() == '"') {
+                        fallback = fallback.substr(1, fallback.size() - 2);
                     }
+                    node.filters.push_back({"default", fallback});
                 } else {
-                    throw std::runtime_error("Unknown filter: " + filter);
+                    node.filters.push_back({filter, ""});
                 }
             }
+            stack.back()->push_back(std::move(node));
+            pos = next;
+            continue;
         }
 
-        if (value.empty())
-            throw std::runtime_error("Missing template variable: " + key);
+        std::istringstream words(inner);
+        std::string word;
+        words >> word;
+
+        if (word == "for") {
+            std::string var, in, list, extra;
+            words >> var >> in >> list;
+            if (var.empty() || in != "in" || list.empty() || (words >> extra))
+                throw std::runtime_error("[TemplateError.Syntax] Malformed for tag: {% " + inner + " %}");
+
+            TemplateNode node;
+            node.kind = Kind::For;
+            node.text = list;
+            node.path = splitPath(list);
+            node.loopVar = var;
+            stack.back()->push_back(std::move(node));
+            stack.push_back(&stack.back()->back().children);
+            open.push_back(Kind::For);
+        } else if (word == "if") {
+            std::string cond = trim(inner.substr(2));
+            if (cond.empty())
+                throw std::runtime_error("[TemplateError.Syntax] Missing condition in {% if %}");
+
+            TemplateNode node;
+            node.kind = Kind::If;
+            node.text = cond;
+            node.path = splitPath(cond);
+            stack.back()->push_back(std::move(node));
+            stack.push_back(&stack.back()->back().children);
+            open.push_back(Kind::If);
+        } else if (word == "endfor" || word == "endif") {
+            Kind closing = word == "endfor" ? Kind::For : Kind::If;
+            if (open.empty() || open.back() != closing)
+                throw std::runtime_error("[TemplateError.Syntax] Unexpected {% " + word + " %}");
+            stack.pop_back();
+            open.pop_back();
+        } else {
+            // Not ours (or already handled at compile time); keep it verbatim.
+            appendText(tagStart, next);
+        }
+        pos = next;
+    }
 
-        result.append(value);
-        searchStart = match.suffix().first;
+    if (!open.empty()) {
+        throw std::runtime_error(std::string("[TemplateError.Syntax] Unclosed {% ") +
+                                 (open.back() == Kind::For ? "for" : "if") + " %}");
+    }
+    return root;
+}
+
+
+struct TemplateEngine::Scope
+{
+    const std::string &name;
+    const TemplateValue &value;
+    const Scope *parent;
+};
+
+
+const TemplateValue *TemplateEngine::lookup(const std::vector<std::string> &path, const TemplateValue &ctx,
+                                            const Scope *scope)
+{
+    const TemplateValue *current = nullptr;
+    size_t i = 0;
+
+    // Loop variables shadow the context, innermost first.
+    for (const Scope *s = scope; s; s = s->parent) {
+        if (s->name == path[0]) {
+            current = &s->value;
+            i = 1;
+            break;
+        }
     }
+    if (!current) current = &ctx;
 
-    result.append(searchStart, text.cend());
-    return result;
+    for (; i < path.size(); ++i) {
+        if (!current->isMap()) return nullptr;
+
+        const auto &map = current->asMap();
+        auto it = map.find(path[i]);
+        if (it == map.end()) return nullptr;
+
+        current = &it->second;
+    }
+    return current;
+}
+
+
+std::string TemplateEngine::applyFilters(const TemplateNode &node, std::string value, lua_State *L)
+{
+    for (const auto &filter: node.filters) {
+        if (filter.name == "default") {
+            if (value.empty()) value = filter.arg;
+            continue;
+        }
+
+        int top = L ? lua_gettop(L) : 0;
+        bool found = false;
+        if (L && lua_getfield(L, LUA_REGISTRYINDEX, FILTERS_KEY) == LUA_TTABLE)
+            found = lua_getfield(L, -1, filter.name.c_str()) == LUA_TFUNCTION;
+        if (!found) {
+            if (L) lua_settop(L, top);
+            throw std::runtime_error("Unknown filter: " + filter.name);
+        }
+
+        lua_remove(L, -2); // filter table
+        lua_pushlstring(L, value.data(), value.size());
+        if (lua_pcall(L, 1, 1, 0) == LUA_OK) {
+            if (lua_isstring(L, -1)) value = lua_tostring(L, -1);
+            lua_pop(L, 1);
+        } else {
+            std::string err = lua_tostring(L, -1);
+            lua_pop(L, 1);
+            throw std::runtime_error("Lua filter error: " + err);
+        }
+    }
+    return value;
+}
+
+
+static bool isTruthy(const TemplateValue *value)
+{
+    if (!value) return false;
+    if (value->isString()) {
+        const std::string &s = value->asString();
+        return !s.empty() && s != "0" && s != "false";
+    }
+    if (value->isMap()) return !value->asMap().empty();
+    return !value->asList().empty();
+}
+
+
+void TemplateEngine::renderNodes(const std::vector<TemplateNode> &nodes, const TemplateValue &ctx,
+                                 const Scope *scope, lua_State *L, std::string &out)
+{
+    using Kind = TemplateNode::Kind;
+
+    for (const auto &node: nodes) {
+        switch (node.kind) {
+            case Kind::Text:
+                out.append(node.text);
+                break;
+
+            case Kind::Variable: {
+                const TemplateValue *value = lookup(node.path, ctx, scope);
+                if (node.filters.empty() && value && value->isString() && !value->asString().empty()) {
+                    out.append(value->asString());
+                    break;
+                }
+
+                std::string rendered = applyFilters(node, value ? value->toString() : "", L);
+                if (rendered.empty())
+                    throw std::runtime_error("Missing template variable: " + node.text);
+                out.append(rendered);
+                break;
+            }
+
+            case Kind::For: {
+                const TemplateValue *list = lookup(node.path, ctx, scope);
+                if (!list || !list->isList()) {
+                    throw std::runtime_error("[TemplateError.ValueError] List not found or invalid: " + node.text);
+                }
+                for (const auto &item: list->asList()) {
+                    Scope inner{node.loopVar, item, scope};
+                    renderNodes(node.children, ctx, &inner, L, out);
+                }
+                break;
+            }
+
+            case Kind::If:
+                if (isTruthy(lookup(node.path, ctx, scope))) {
+                    renderNodes(node.children, ctx, scope, L, out);
+                }
+                break;
+        }
+    }
 }
 
 
@@ -474,7 +699,7 @@ void TemplateEngine::evictLRU()
     if (compiledCache_.size() > targetSize) {
         std::vector<std::pair<std::string, std::chrono::steady_clock::time_point> > items;
         for (const auto &[key, entry]: compiledCache_)
-            items.emplace_back(key, entry.lastModified);
+            items.emplace_back(key, entry.lastUsed);
 
         std::sort(items.begin(), items.end(), [](const auto &a, const auto &b)
         {
@@ -547,10 +772,26 @@ TemplateValue TemplateEngine::luaToTemplateValue(lua_State *L, int index)
 
 std::pair<bool, std::string> TemplateEngine::safeRenderFromString(
     const std::string &templateText,
-    const TemplateValue &context)
+    const TemplateValue &context,
+    lua_State *L)
+{
+    try {
+        std::string result = renderFromString(templateText, context, L);
+        return {true, result};
+    } catch (const std::exception &e) {
+        return {false, e.what()};
+    } catch (...) {
+        return {false, "Unknown rendering error."};
+    }
+}
+
+std::pair<bool, std::string> TemplateEngine::safeRenderFile(
+    const std::string &filename,
+    const TemplateValue &context,
+    lua_State *L)
 {
     try {
-        std::string result = renderFromString(templateText, context);
+        std::string result = renderFile(filename, context, L);
         return {true, result};
     } catch (const std::exception &e) {
         return {false, e.what()};
@@ -6,6 +6,9 @@
 #include <chrono>
 #include <variant>
 #include <optional>
+#include <memory>
+#include <filesystem>
+#include <sstream>
 
 extern "C"
 {
@@ -82,6 +85,36 @@ static std::ostream &operator<<(std::ostream &os, const TemplateValue &val)
 }
 
 
+// ————— Compiled form —————
+// A template with its includes and extends already resolved, parsed once
+// into a tree that rendering walks in a single pass.
+
+struct TemplateFilterCall
+{
+    std::string name; // "default" or a registered Lua filter
+    std::string arg; // default("...") fallback
+};
+
+struct TemplateNode
+{
+    enum class Kind { Text, Variable, For, If };
+
+    Kind kind = Kind::Text;
+    std::string text; // Text: literal bytes; Variable/If/For: the expression as written
+    std::vector<std::string> path; // Variable/If: key path; For: list key path
+    std::string loopVar; // For
+    std::vector<TemplateFilterCall> filters; // Variable
+    std::vector<TemplateNode> children; // For / If body
+};
+
+struct CompiledTemplate
+{
+    std::vector<TemplateNode> nodes;
+    // Every file the template was built from, with the mtime it had then.
+    std::vector<std::pair<std::string, std::filesystem::file_time_type> > sources;
+};
+
+
 class TemplateEngine
 {
 public:
@@ -93,6 +126,13 @@ public:
         size_t size_bytes = 0;
     };
 
+    struct CompiledEntry
+    {
+        std::shared_ptr<const CompiledTemplate> tmpl;
+        std::chrono::steady_clock::time_point lastUsed;
+        std::chrono::steady_clock::time_point checked; // sources last compared against the disk
+    };
+
     struct Config
     {
         std::string templateDir = "./templates/";
@@ -110,11 +150,22 @@ public:
     static void setTemplateDir(const std::string &dir);
 
 
+    // `L` is the calling interpreter; Lua filters run inside it.
     static std::string renderFromString(const std::string &templateText,
-                                        const TemplateValue &context);
+                                        const TemplateValue &context,
+                                        lua_State *L = nullptr);
 
     static std::pair<bool, std::string> safeRenderFromString(const std::string &templateText,
-                                                             const TemplateValue &context);
+                                                             const TemplateValue &context,
+                                                             lua_State *L = nullptr);
+
+    static std::string renderFile(const std::string &filename,
+                                  const TemplateValue &context,
+                                  lua_State *L = nullptr);
+
+    static std::pair<bool, std::string> safeRenderFile(const std::string &filename,
+                                                       const TemplateValue &context,
+                                                       lua_State *L = nullptr);
 
     static std::string loadTemplate(const std::string &filename);
 
@@ -134,27 +185,37 @@ public:
     static void clearGlobals();
 
 private:
-    // Lua filters
-    static lua_State *luaState_;
-    static std::unordered_map<std::string, int> luaFilters_;
+    // Lua filters live in each state's registry under this key
+    static constexpr auto FILTERS_KEY = "lumenite.template_filters";
+
+    // How stale a compiled template may get before its files are stat()ed again.
+    static constexpr std::chrono::seconds FRESHNESS_INTERVAL{1};
 
     // Template cache
     static Config config_;
     static std::mutex cacheMutex_;
     static std::unordered_map<std::string, CacheEntry> templateCache_;
-    static std::unordered_map<std::string, CacheEntry> compiledCache_;
+    static std::unordered_map<std::string, CompiledEntry> compiledCache_;
 
     static TemplateValue globalContext_;
 
 
-    // Internal processing
-    static std::string processIncludes(const std::string &text, std::vector<std::string> &includeStack);
+    // Compilation
+    static std::shared_ptr<const CompiledTemplate> getCompiled(const std::string &filename,
+                                                               const std::string *inlineText);
+
+    static void compile(const std::string &text, CompiledTemplate &out);
 
-    static std::string processLoops(const std::string &text, const TemplateValue &context);
+    static std::string readSource(const std::string &filename, CompiledTemplate &out);
 
-    static std::string processConditionals(const std::string &text, const TemplateValue &context);
+    static std::string resolveInheritance(const std::string &text,
+                                          std::unordered_map<std::string, std::string> overrides,
+                                          CompiledTemplate &out, int depth);
 
-    static std::string substitute(const std::string &text, const TemplateValue &context);
+    static std::vector<TemplateNode> parse(const std::string &text);
+
+    static std::string processIncludes(const std::string &text, std::vector<std::string> &includeStack,
+                                       CompiledTemplate &out);
 
     static std::string extractAndProcessBlocks(const std::string &text,
                                                std::unordered_map<std::string, std::string> &blocks);
@@ -162,6 +223,17 @@ private:
     static void injectBlocks(std::string &parent,
                              const std::unordered_map<std::string, std::string> &childBlocks);
 
+    // Rendering
+    struct Scope;
+
+    static void renderNodes(const std::vector<TemplateNode> &nodes, const TemplateValue &ctx,
+                            const Scope *scope, lua_State *L, std::string &out);
+
+    static const TemplateValue *lookup(const std::vector<std::string> &path, const TemplateValue &ctx,
+                                       const Scope *scope);
+
+    static std::string applyFilters(const TemplateNode &node, std::string value, lua_State *L);
+
     // Utilities
     static std::string trim(const std::string &str);
 
@@ -0,0 +1,110 @@
+#include "Tls.h"
+
+#include <openssl/err.h>
+
+#include <cstring>
+#include <stdexcept>
+
+SSL_CTX *Tls::ctx = nullptr;
+
+static constexpr unsigned char SESSION_CONTEXT[] = "lumenite";
+static constexpr unsigned char HTTP11[] = "\x08http/1.1";
+
+
+// Settle on http/1.1 when the client offers it; a client offering only
+// something else carries on without ALPN rather than failing.
+static int selectAlpn(SSL *, const unsigned char **out, unsigned char *outlen, const unsigned char *in,
+                      unsigned int inlen, void *)
+{
+    unsigned char *chosen = nullptr;
+    if (SSL_select_next_proto(&chosen, outlen, HTTP11, sizeof(HTTP11) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    *out = chosen;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+void Tls::configure(const Config &config)
+{
+    SSL_CTX *next = SSL_CTX_new(TLS_server_method());
+    if (!next) throw std::runtime_error("cannot create a TLS context: " + lastError());
+
+    auto fail = [next](const std::string &what)
+    {
+        std::string message = what + ": " + lastError();
+        SSL_CTX_free(next);
+        throw std::runtime_error(message);
+    };
+
+    if (SSL_CTX_use_certificate_chain_file(next, config.certFile.c_str()) != 1)
+        fail("cannot load certificate '" + config.certFile + "'");
+    if (SSL_CTX_use_PrivateKey_file(next, config.keyFile.c_str(), SSL_FILETYPE_PEM) != 1)
+        fail("cannot load private key '" + config.keyFile + "'");
+    if (SSL_CTX_check_private_key(next) != 1) fail("private key does not match the certificate");
+
+    SSL_CTX_set_min_proto_version(next, TLS1_2_VERSION);
+    SSL_CTX_set_options(next, SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(next, SSL_OP_ENABLE_KTLS);
+#endif
+    // Output is staged per connection and retried from where it stopped.
+    SSL_CTX_set_mode(next, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                           SSL_MODE_RELEASE_BUFFERS);
+
+    // Resumption: the shared cache answers session IDs (TLS 1.2), tickets
+    // need no server state at all.
+    SSL_CTX_set_session_id_context(next, SESSION_CONTEXT, sizeof(SESSION_CONTEXT) - 1);
+    if (config.sessionCache > 0) {
+        SSL_CTX_set_session_cache_mode(next, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(next, config.sessionCache);
+    } else {
+        SSL_CTX_set_session_cache_mode(next, SSL_SESS_CACHE_OFF);
+    }
+    if (!config.sessionTickets) {
+        SSL_CTX_set_options(next, SSL_OP_NO_TICKET);
+        SSL_CTX_set_num_tickets(next, 0);
+    }
+
+    SSL_CTX_set_alpn_select_cb(next, selectAlpn, nullptr);
+
+    if (ctx) SSL_CTX_free(ctx);
+    ctx = next;
+}
+
+SSL_CTX *Tls::context()
+{
+    return ctx;
+}
+
+SSL *Tls::accept(int fd)
+{
+    SSL *ssl = SSL_new(ctx);
+    if (!ssl) return nullptr;
+    if (SSL_set_fd(ssl, fd) != 1) {
+        SSL_free(ssl);
+        return nullptr;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+bool Tls::kernelSend(SSL *ssl)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    (void) ssl;
+    return false;
+#endif
+}
+
+std::string Tls::lastError()
+{
+    std::string out;
+    char buf[256];
+    while (unsigned long e = ERR_get_error()) {
+        ERR_error_string_n(e, buf, sizeof(buf));
+        if (!out.empty()) out += "; ";
+        out += buf;
+    }
+    return out.empty() ? "unknown error" : out;
+}
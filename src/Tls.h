@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+
+#include <openssl/ssl.h>
+
+
+/// TLS termination for the listener, on the OpenSSL the binary already
+/// links. One server context is shared by every event loop, so its session
+/// cache and ticket keys cover them all and a client resumes wherever its
+/// next connection lands. Kernel TLS is requested: where the kernel and the
+/// OpenSSL build provide it, records are sealed in the kernel and files
+/// keep going out by sendfile().
+class Tls
+{
+public:
+    struct Config
+    {
+        std::string certFile; // PEM, leaf first, then any intermediates
+        std::string keyFile; // PEM
+        long sessionCache = 20480; // server-side sessions kept for resumption; 0 = none
+        bool sessionTickets = true; // stateless resumption
+    };
+
+    // Load the certificate and key; throws std::runtime_error if they
+    // cannot be used. Must run before the loops accept anything.
+    static void configure(const Config &config);
+
+    // The server context, or null when the listener speaks plain HTTP.
+    static SSL_CTX *context();
+
+    // A server-side session over `fd`, waiting for the client's hello.
+    static SSL *accept(int fd);
+
+    // Whether the kernel seals outgoing records, so SSL_sendfile() works.
+    static bool kernelSend(SSL *ssl);
+
+    // The OpenSSL error queue as one line, emptying it.
+    static std::string lastError();
+
+private:
+    static SSL_CTX *ctx;
+};
@@ -0,0 +1,483 @@
+#include "WebSocket.h"
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <cstring>
+
+std::mutex WebSocket::mutex;
+std::unordered_set<std::string> WebSocket::paths;
+std::unordered_map<std::string, std::unordered_map<uint64_t, WebSocket::SessionPtr> > WebSocket::channels;
+std::atomic<uint64_t> WebSocket::nextId{1};
+
+// Lets every request skip the lock while no route is registered.
+static std::atomic<bool> anyRoutes{false};
+
+static constexpr std::string_view ACCEPT_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+
+static bool hasToken(std::string_view list, std::string_view token)
+{
+    while (!list.empty()) {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if (item.size() == token.size() &&
+            std::equal(item.begin(), item.end(), token.begin(),
+                       [](char a, char b) { return std::tolower((unsigned char) a) == b; }))
+            return true;
+    }
+    return false;
+}
+
+// Strict UTF-8: no overlong forms, surrogates or code points past U+10FFFF.
+static bool validUtf8(std::string_view s)
+{
+    const auto *p = reinterpret_cast<const unsigned char *>(s.data());
+    const unsigned char *end = p + s.size();
+    while (p < end) {
+        if (*p < 0x80) {
+            ++p;
+            continue;
+        }
+        int n;
+        uint32_t cp;
+        if ((*p & 0xE0) == 0xC0) n = 1, cp = *p & 0x1F;
+        else if ((*p & 0xF0) == 0xE0) n = 2, cp = *p & 0x0F;
+        else if ((*p & 0xF8) == 0xF0) n = 3, cp = *p & 0x07;
+        else return false;
+        if (end - p <= n) return false;
+        for (int i = 1; i <= n; ++i) {
+            if ((p[i] & 0xC0) != 0x80) return false;
+            cp = cp << 6 | (p[i] & 0x3F);
+        }
+        static constexpr uint32_t MIN[] = {0, 0x80, 0x800, 0x10000};
+        if (cp < MIN[n] || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) return false;
+        p += n + 1;
+    }
+    return true;
+}
+
+// XOR with the 4-byte key, a machine word at a time.
+static void unmask(char *p, size_t n, const unsigned char key[4])
+{
+    unsigned char wide[8];
+    std::memcpy(wide, key, 4);
+    std::memcpy(wide + 4, key, 4);
+    uint64_t k;
+    std::memcpy(&k, wide, 8);
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v;
+        std::memcpy(&v, p + i, 8);
+        v ^= k;
+        std::memcpy(p + i, &v, 8);
+    }
+    for (; i < n; ++i) p[i] = static_cast<char>(p[i] ^ key[i & 3]);
+}
+
+
+void WebSocket::route(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    paths.insert(path);
+    anyRoutes = true;
+}
+
+bool WebSocket::routed(std::string_view path)
+{
+    if (!anyRoutes) return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    return paths.count(std::string(path)) > 0;
+}
+
+std::string WebSocket::handshake(const HttpRequest &req, int &status)
+{
+    status = 400;
+    if (req.method != "GET" || !hasToken(req.header("Upgrade"), "websocket") ||
+        !hasToken(req.header("Connection"), "upgrade"))
+        return {};
+    if (req.header("Sec-WebSocket-Version") != "13") {
+        status = 426;
+        return {};
+    }
+    // base64 of 16 random bytes
+    std::string_view key = req.header("Sec-WebSocket-Key");
+    if (key.size() != 24 || key.substr(22) != "==") return {};
+
+    std::string input(key);
+    input += ACCEPT_GUID;
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(input.data()), input.size(), digest);
+    unsigned char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    int n = EVP_EncodeBlock(encoded, digest, SHA_DIGEST_LENGTH);
+
+    status = 101;
+    return {reinterpret_cast<char *>(encoded), static_cast<size_t>(n)};
+}
+
+WebSocket::SessionPtr WebSocket::open(const ConnectionPtr &conn, const HttpRequest &req)
+{
+    auto session = std::make_shared<Session>();
+    session->id = nextId++;
+    session->conn = conn;
+    session->path.assign(req.path);
+    session->remoteIp = req.remote_ip;
+    subscribe(session, session->path);
+    return session;
+}
+
+void WebSocket::accept(const SessionPtr &session, const std::string &acceptKey, std::string_view fields)
+{
+    auto conn = session->conn.lock();
+    if (!conn) return;
+
+    WireResponse wire;
+    wire.head = "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: ";
+    wire.head += acceptKey;
+    wire.head += "\r\n";
+    wire.head += fields;
+    wire.head += "\r\n";
+
+    auto upgrade = std::make_shared<Upgrade>();
+    upgrade->receive = [session](std::string &in) { receive(*session, in); };
+    upgrade->closed = [session] { closed(session); };
+    wire.upgrade = std::move(upgrade);
+
+    {
+        // Under the lock so no frame can overtake the 101 into the loop.
+        std::lock_guard<std::mutex> lock(session->stateMutex);
+        wire.body = std::move(session->early);
+        wire.keepAlive = !session->earlyClose;
+        conn->loop->complete(conn, std::move(wire));
+        session->accepted = true;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (session->closing) return;
+    for (const std::string &channel: session->channels) channels[channel].emplace(session->id, session);
+}
+
+// —————————————————————————————————————————————
+// Frames
+// —————————————————————————————————————————————
+
+// Server frames are never masked and never fragmented.
+std::string WebSocket::frame(uint8_t opcode, std::string_view payload)
+{
+    std::string out;
+    out.reserve(payload.size() + 10);
+    out += static_cast<char>(0x80 | opcode);
+    size_t n = payload.size();
+    if (n < 126) {
+        out += static_cast<char>(n);
+    } else if (n <= 0xFFFF) {
+        out += static_cast<char>(126);
+        out += static_cast<char>(n >> 8);
+        out += static_cast<char>(n);
+    } else {
+        out += static_cast<char>(127);
+        for (int shift = 56; shift >= 0; shift -= 8) out += static_cast<char>(static_cast<uint64_t>(n) >> shift);
+    }
+    out += payload;
+    return out;
+}
+
+static std::string closePayload(int code, std::string_view reason)
+{
+    std::string payload;
+    payload += static_cast<char>(code >> 8);
+    payload += static_cast<char>(code);
+    payload += reason.substr(0, 123); // control frames carry at most 125 bytes
+    return payload;
+}
+
+// Frames in `in` from the client, all of them masked. Whole frames are
+// consumed; a partial one stays for the next read.
+void WebSocket::receive(Session &s, std::string &in)
+{
+    if (s.closing) {
+        in.clear();
+        return;
+    }
+
+    size_t pos = 0;
+    while (in.size() - pos >= 2) {
+        auto *h = reinterpret_cast<unsigned char *>(in.data() + pos);
+        size_t avail = in.size() - pos;
+        bool fin = h[0] & 0x80;
+        uint8_t opcode = h[0] & 0x0F;
+        if (h[0] & 0x70) return fail(s, 1002, "reserved bits set"), in.clear();
+        if (!(h[1] & 0x80)) return fail(s, 1002, "client frames must be masked"), in.clear();
+
+        size_t header = 2;
+        uint64_t len = h[1] & 0x7F;
+        if (len == 126) {
+            if (avail < 4) break;
+            len = uint64_t(h[2]) << 8 | h[3];
+            header = 4;
+        } else if (len == 127) {
+            if (avail < 10) break;
+            len = 0;
+            for (int i = 2; i < 10; ++i) len = len << 8 | h[i];
+            header = 10;
+        }
+        if (len > MAX_MESSAGE || s.message.size() + len > MAX_MESSAGE)
+            return fail(s, 1009, "message too big"), in.clear();
+        header += 4;
+        if (avail < header + len) break;
+
+        char *payload = in.data() + pos + header;
+        unmask(payload, static_cast<size_t>(len), h + header - 4);
+        std::string_view data(payload, static_cast<size_t>(len));
+        pos += header + static_cast<size_t>(len);
+
+        if (opcode & 0x08) {
+            if (!fin || len > 125) return fail(s, 1002, "bad control frame"), in.clear();
+            if (opcode == Ping) {
+                queue(s, frame(Pong, data), false);
+            } else if (opcode == Close) {
+                int code = 1005; // none given
+                if (len == 1) return fail(s, 1002, "bad close frame"), in.clear();
+                if (len >= 2) {
+                    code = static_cast<unsigned char>(data[0]) << 8 | static_cast<unsigned char>(data[1]);
+                    if (code < 1000 || code == 1004 || code == 1005 || code == 1006 || (code > 1014 && code < 3000) ||
+                        code > 4999 || !validUtf8(data.substr(2)))
+                        return fail(s, 1002, "bad close frame"), in.clear();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(s.stateMutex);
+                    s.closeCode = code;
+                    s.closeReason.assign(len > 2 ? data.substr(2) : std::string_view());
+                }
+                // Echo the code and hang up once it is written.
+                if (!s.closing.exchange(true))
+                    queue(s, frame(Close, len >= 2 ? data.substr(0, 2) : std::string_view()), true);
+                in.clear();
+                return;
+            } else if (opcode != Pong) {
+                return fail(s, 1002, "unknown opcode"), in.clear();
+            }
+            continue;
+        }
+
+        if (opcode == Continuation) {
+            if (!s.opcode) return fail(s, 1002, "continuation without a message"), in.clear();
+            s.message += data;
+        } else if (opcode == Text || opcode == Binary) {
+            if (s.opcode) return fail(s, 1002, "message interleaved with another"), in.clear();
+            s.opcode = opcode;
+            s.message.assign(data);
+        } else {
+            return fail(s, 1002, "unknown opcode"), in.clear();
+        }
+        if (!fin) continue;
+
+        bool binary = s.opcode == Binary;
+        s.opcode = 0;
+        if (!binary && !validUtf8(s.message)) return fail(s, 1007, "text message is not UTF-8"), in.clear();
+        if (s.onMessage) s.onMessage(std::move(s.message), binary);
+        s.message.clear();
+    }
+    in.erase(0, pos);
+}
+
+// Held back until the 101 is queued, straight to the loop after that.
+bool WebSocket::queue(Session &s, std::string &&frame, bool closeAfter)
+{
+    if (!s.accepted) {
+        std::lock_guard<std::mutex> lock(s.stateMutex);
+        if (!s.accepted) {
+            s.early += frame;
+            s.earlyClose |= closeAfter;
+            return true;
+        }
+    }
+    auto conn = s.conn.lock();
+    if (!conn) return false;
+    conn->loop->send(conn, std::move(frame), closeAfter);
+    return true;
+}
+
+// Close with `code` after what is already queued; nothing more is read.
+void WebSocket::fail(Session &s, int code, std::string_view reason)
+{
+    if (s.closing.exchange(true)) return;
+    {
+        std::lock_guard<std::mutex> lock(s.stateMutex);
+        s.closeCode = code;
+        s.closeReason.assign(reason);
+    }
+    queue(s, frame(Close, closePayload(code, reason)), true);
+}
+
+void WebSocket::closed(const SessionPtr &session)
+{
+    session->closing = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::string &channel: session->channels) {
+            auto it = channels.find(channel);
+            if (it == channels.end()) continue;
+            it->second.erase(session->id);
+            if (it->second.empty()) channels.erase(it);
+        }
+        session->channels.clear();
+    }
+
+    int code;
+    std::string reason;
+    {
+        std::lock_guard<std::mutex> lock(session->stateMutex);
+        code = session->closeCode;
+        reason = session->closeReason;
+    }
+    auto onClose = std::move(session->onClose);
+    session->onClose = nullptr;
+    session->onMessage = nullptr;
+    if (onClose) onClose(code, std::move(reason));
+}
+
+// —————————————————————————————————————————————
+// Sending and channels
+// —————————————————————————————————————————————
+
+bool WebSocket::send(const SessionPtr &session, std::string_view data, bool binary)
+{
+    if (session->closing) return false;
+    return queue(*session, frame(binary ? Binary : Text, data), false);
+}
+
+void WebSocket::close(const SessionPtr &session, int code, std::string_view reason)
+{
+    fail(*session, code, reason);
+}
+
+void WebSocket::subscribe(const SessionPtr &session, const std::string &channel)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &mine = session->channels;
+    if (session->closing || std::find(mine.begin(), mine.end(), channel) != mine.end()) return;
+    mine.push_back(channel);
+    if (session->accepted) channels[channel].emplace(session->id, session);
+}
+
+void WebSocket::unsubscribe(const SessionPtr &session, const std::string &channel)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = channels.find(channel);
+    if (it == channels.end()) return;
+    it->second.erase(session->id);
+    if (it->second.empty()) channels.erase(it);
+    auto &mine = session->channels;
+    mine.erase(std::remove(mine.begin(), mine.end(), channel), mine.end());
+}
+
+size_t WebSocket::broadcast(const std::string &channel, std::string_view data, bool binary)
+{
+    std::vector<ConnectionPtr> conns;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = channels.find(channel);
+        if (it == channels.end()) return 0;
+        conns.reserve(it->second.size());
+        for (auto &[id, session]: it->second) {
+            if (session->closing || !session->accepted) continue;
+            if (auto conn = session->conn.lock()) conns.push_back(std::move(conn));
+        }
+    }
+    if (conns.empty()) return 0;
+    EventLoop::send(conns, std::make_shared<const std::string>(frame(binary ? Binary : Text, data)));
+    return conns.size();
+}
+
+// —————————————————————————————————————————————
+// Lua handle
+// —————————————————————————————————————————————
+
+static WebSocket::SessionPtr &check_handle(lua_State *L)
+{
+    return *static_cast<WebSocket::SessionPtr *>(luaL_checkudata(L, 1, WebSocket::HANDLE_METATABLE));
+}
+
+static int ws_send(lua_State *L)
+{
+    auto &session = check_handle(L);
+    size_t len;
+    const char *data = luaL_checklstring(L, 2, &len);
+    lua_pushboolean(L, WebSocket::send(session, {data, len}, lua_toboolean(L, 3)));
+    return 1;
+}
+
+static int ws_close(lua_State *L)
+{
+    auto &session = check_handle(L);
+    auto code = static_cast<int>(luaL_optinteger(L, 2, 1000));
+    luaL_argcheck(L, code == 1000 || (code >= 3000 && code <= 4999), 2, "must be 1000 or 3000-4999");
+    size_t len = 0;
+    const char *reason = luaL_optlstring(L, 3, "", &len);
+    WebSocket::close(session, code, {reason, len});
+    return 0;
+}
+
+static int ws_subscribe(lua_State *L)
+{
+    auto &session = check_handle(L);
+    WebSocket::subscribe(session, luaL_checkstring(L, 2));
+    return 0;
+}
+
+static int ws_unsubscribe(lua_State *L)
+{
+    auto &session = check_handle(L);
+    WebSocket::unsubscribe(session, luaL_checkstring(L, 2));
+    return 0;
+}
+
+static int ws_index(lua_State *L)
+{
+    auto &session = check_handle(L);
+    const char *key = luaL_checkstring(L, 2);
+    if (std::strcmp(key, "id") == 0) lua_pushinteger(L, static_cast<lua_Integer>(session->id));
+    else if (std::strcmp(key, "path") == 0) lua_pushlstring(L, session->path.data(), session->path.size());
+    else if (std::strcmp(key, "remote_ip") == 0) lua_pushstring(L, session->remoteIp.c_str());
+    else if (std::strcmp(key, "open") == 0) lua_pushboolean(L, !session->closing);
+    else {
+        lua_pushvalue(L, 2);
+        lua_rawget(L, lua_upvalueindex(1));
+    }
+    return 1;
+}
+
+static int ws_gc(lua_State *L)
+{
+    check_handle(L).~shared_ptr();
+    return 0;
+}
+
+void WebSocket::pushHandle(lua_State *L, const SessionPtr &session)
+{
+    new(lua_newuserdatauv(L, sizeof(SessionPtr), 0)) SessionPtr(session);
+    if (luaL_newmetatable(L, HANDLE_METATABLE)) {
+        static constexpr luaL_Reg methods[] = {
+            {"send", ws_send},
+            {"close", ws_close},
+            {"subscribe", ws_subscribe},
+            {"unsubscribe", ws_unsubscribe},
+            {nullptr, nullptr}
+        };
+        luaL_newlib(L, methods);
+        lua_pushcclosure(L, ws_index, 1);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, ws_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "EventLoop.h"
+#include "HttpParser.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+extern "C"
+{
+#include "lua.h"
+#include "lauxlib.h"
+}
+
+
+/// WebSocket (RFC 6455) over an upgraded connection. Frames are parsed,
+/// unmasked and reassembled on the event loop, pings and the closing
+/// handshake are answered there too, and only whole messages leave it,
+/// through the session's `onMessage`. Sessions subscribe to channels (each
+/// starts on its own path), and broadcast() frames a message once and fans
+/// it out to every subscriber without a Lua call per socket.
+class WebSocket
+{
+public:
+    static constexpr size_t MAX_MESSAGE = 16 * 1024 * 1024; // larger ones close the socket with 1009
+    static constexpr auto HANDLE_METATABLE = "Lumenite.WebSocket";
+
+    enum Opcode : uint8_t { Continuation = 0x0, Text = 0x1, Binary = 0x2, Close = 0x8, Ping = 0x9, Pong = 0xA };
+
+    struct Session
+    {
+        uint64_t id = 0;
+        std::weak_ptr<Connection> conn;
+        std::string path;
+        std::string remoteIp;
+
+        // Set by whoever accepted the upgrade; called on the loop thread,
+        // in order, and never after onClose.
+        std::function<void(std::string &&message, bool binary)> onMessage;
+        std::function<void(int code, std::string &&reason)> onClose;
+
+        // Kept by the worker state the session lives on.
+        std::string cookieSession; // SessionManager id, restored around each handler
+        int handleRef = LUA_NOREF; // the Lua object, pinned while the socket is open
+
+        std::atomic<bool> closing{false}; // a close frame went out: nothing follows it
+
+    private:
+        friend class WebSocket;
+
+        // Loop thread only: the message being reassembled from fragments.
+        std::string message;
+        uint8_t opcode = 0;
+
+        std::mutex stateMutex;
+        std::atomic<bool> accepted{false}; // the 101 is queued; set under stateMutex
+        std::string early; // frames sent before that, written right behind it
+        bool earlyClose = false;
+        int closeCode = 1006; // no close frame seen
+        std::string closeReason;
+
+        std::vector<std::string> channels; // guarded by WebSocket::mutex
+    };
+
+    using SessionPtr = std::shared_ptr<Session>;
+
+    // Accept upgrades on `path` (exact match).
+    static void route(const std::string &path);
+
+    static bool routed(std::string_view path);
+
+    // Validate the client's opening handshake: the Sec-WebSocket-Accept
+    // value, or empty with `status` set to the error to answer with.
+    static std::string handshake(const HttpRequest &req, int &status);
+
+    // A session for `conn`, not yet answered: what it sends is held back
+    // and its channels only take effect once accept() has run.
+    static SessionPtr open(const ConnectionPtr &conn, const HttpRequest &req);
+
+    // Answer with the 101 (`acceptKey` from handshake(), `fields` as
+    // "Name: value\r\n"...) and hand the connection to the frame parser.
+    static void accept(const SessionPtr &session, const std::string &acceptKey, std::string_view fields);
+
+    // Thread-safe; false once the socket is closing or gone.
+    static bool send(const SessionPtr &session, std::string_view data, bool binary);
+
+    static void close(const SessionPtr &session, int code, std::string_view reason);
+
+    static void subscribe(const SessionPtr &session, const std::string &channel);
+
+    static void unsubscribe(const SessionPtr &session, const std::string &channel);
+
+    // Send `data` to every session subscribed to `channel`; how many that was.
+    static size_t broadcast(const std::string &channel, std::string_view data, bool binary);
+
+    static std::string frame(uint8_t opcode, std::string_view payload);
+
+    // The Lua object for `session`: ws:send, ws:close, ws:subscribe, ...
+    static void pushHandle(lua_State *L, const SessionPtr &session);
+
+private:
+    static void receive(Session &session, std::string &in);
+
+    static bool queue(Session &session, std::string &&frame, bool closeAfter);
+
+    static void fail(Session &session, int code, std::string_view reason);
+
+    static void closed(const SessionPtr &session);
+
+    static std::mutex mutex;
+    static std::unordered_set<std::string> paths;
+    static std::unordered_map<std::string, std::unordered_map<uint64_t, SessionPtr> > channels;
+    static std::atomic<uint64_t> nextId;
+};
@@ -2,8 +2,11 @@
 #include "utils/ProjectScaffolder.h"
 #include "utils/Version.h"
 #include "ErrorHandler.h" // for colors
+#include "Prefork.h"
+#include <algorithm>
 #include <string>
 #include <iostream>
+#include <vector>
 #include "utils/LumenitePackageManager.h"
 
 
@@ -21,6 +24,7 @@ Usage:
 Options:
   -h, --help                Show this help message
   -v, --version             Print Lumenite version
+  -w, --workers <n>         Serve from n worker processes under a master (Linux)
 
 Package Commands:
   lumenite package get <name>       Download a plugin from the registry
@@ -29,16 +33,53 @@ Package Commands:
 
 Examples:
   lumenite app.lua
+  lumenite app.lua --workers 4
   lumenite new mysite
   lumenite package get HelloPlugin
 )" << std::endl;
 }
 
 
+// Take `--workers n` (or `-w n`, `--workers=n`) out of the arguments.
+static bool takeWorkers(int &argc, char *argv[])
+{
+    std::vector<char *> rest{argv[0]};
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if ((arg == "-w" || arg == "--workers") && i + 1 < argc) value = argv[++i];
+        else if (arg.starts_with("--workers=")) value = arg.substr(10);
+        else {
+            rest.push_back(argv[i]);
+            continue;
+        }
+        try {
+            size_t used;
+            long n = std::stol(value, &used);
+            if (used != value.size() || n < 1 || n > 1024) throw std::out_of_range(value);
+            Prefork::processes = static_cast<unsigned>(n);
+        } catch (const std::exception &) {
+            std::cerr << RED << "[Error] --workers expects a count from 1 to 1024, got '" << value << "'" << RESET
+                    << "\n\n";
+            return false;
+        }
+    }
+    argc = static_cast<int>(rest.size());
+    std::copy(rest.begin(), rest.end(), argv);
+    argv[argc] = nullptr;
+    return true;
+}
+
+
 int main(int argc, char *argv[])
 {
     std::string scriptPath = "app.lua";
 
+    if (argc >= 2 && std::string(argv[1]) != "new" && std::string(argv[1]) != "package" && !takeWorkers(argc, argv)) {
+        printHelp();
+        return 1;
+    }
+
     if (argc >= 2) {
         const std::string arg1 = argv[1];
 
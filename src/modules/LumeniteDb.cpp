@@ -14,7 +14,10 @@
 #include <map>
 #include <vector>
 #include <fstream>
+#include <mutex>
+#include <optional>
 
+#include "../Async.h"
 #include "../ErrorHandler.h"
 
 namespace fs = std::filesystem;
@@ -22,16 +25,17 @@ namespace fs = std::filesystem;
 std::string LumeniteDB::db_filename{};
 bool LumeniteDB::sql_log_enabled{};
 std::ofstream LumeniteDB::sql_log_stream{};
+std::mutex LumeniteDB::sql_log_mutex;
+size_t LumeniteDB::sql_log_users = 0;
 
 std::map<std::string, LumeniteDB::Model> LumeniteDB::models;
-LumeniteDB::Session LumeniteDB::session;
-LumeniteDB::DB *LumeniteDB::db_instance = nullptr;
+thread_local LumeniteDB::Session LumeniteDB::session;
+thread_local LumeniteDB::DB *LumeniteDB::db_instance = nullptr;
 
 static int instance_newindex(lua_State *L);
 
-static void bind_filter_args(lua_State *L, sqlite3_stmt *stmt);
-
 static constexpr const char *LM_HIDDEN_TABLE_KEY = "__lm_table__";
+static constexpr const char *CONNECTION_KEY = "lumenite.db.connection";
 
 static std::string current_timestamp()
 {
@@ -44,6 +48,7 @@ static std::string current_timestamp()
 
 static void log_sql(const std::string &sql)
 {
+    std::lock_guard<std::mutex> lock(LumeniteDB::sql_log_mutex);
     if (LumeniteDB::sql_log_stream.is_open()) {
         LumeniteDB::sql_log_stream << "[" << current_timestamp() << "] " << sql << "\n";
         LumeniteDB::sql_log_stream.flush();
@@ -60,76 +65,139 @@ static void run_sql_exec(lua_State *L, const std::string &sql)
 {
     log_sql(sql);
     require_db(L);
+    std::unique_lock<std::mutex> lock(LumeniteDB::db_instance->mutex);
     if (!LumeniteDB::db_instance->exec(sql)) {
-        luaL_error(L, "SQL error: %s", LumeniteDB::db_instance->lastError().c_str());
+        std::string err = LumeniteDB::db_instance->lastError();
+        lock.unlock(); // luaL_error longjmps past destructors
+        luaL_error(L, "SQL error: %s", err.c_str());
     }
 }
 
-static int run_sql_query(lua_State *L, const std::string &sql)
+// A bound parameter copied out of Lua, so the query can run off the Lua thread.
+struct SqlParam
 {
-    log_sql(sql);
-    require_db(L);
-
-    sqlite3_stmt *stmt = nullptr;
-    if (sqlite3_prepare_v2(LumeniteDB::db_instance->handle, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        luaL_error(L, "SQLite prepare failed: %s", sqlite3_errmsg(LumeniteDB::db_instance->handle));
-    }
-
-    // bind any filter args from caller table[__filter_args]
-    bind_filter_args(L, stmt);
-
-    lua_newtable(L);
-    int row = 1;
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        int cols = sqlite3_column_count(stmt);
-
-        lua_newtable(L);
-        for (int c = 0; c < cols; ++c) {
-            const char *col = sqlite3_column_name(stmt, c);
-            const unsigned char *txt = sqlite3_column_text(stmt, c);
-            if (txt) lua_pushstring(L, reinterpret_cast<const char *>(txt));
-            else lua_pushnil(L);
-            lua_setfield(L, -2, col);
-        }
-        lua_rawseti(L, -2, row++);
-    }
+    int type = LUA_TNIL;
+    bool integral = false;
+    sqlite3_int64 integer = 0;
+    double number = 0;
+    std::string text;
+};
 
-    sqlite3_finalize(stmt);
-    return 1;
-}
+using SqlRow = std::vector<std::optional<std::string> >;
 
-static void bind_filter_args(lua_State *L, sqlite3_stmt *stmt)
+static std::vector<SqlParam> collect_filter_args(lua_State *L)
 {
+    std::vector<SqlParam> params;
+
     // Caller’s query table is expected at stack index 1
+    if (!lua_istable(L, 1)) return params;
     lua_getfield(L, 1, "__filter_args");
     if (!lua_istable(L, -1)) {
         lua_pop(L, 1);
-        return;
+        return params;
     }
 
     int n = (int) lua_rawlen(L, -1);
+    params.resize(n);
     for (int i = 1; i <= n; ++i) {
+        SqlParam &p = params[i - 1];
         lua_rawgeti(L, -1, i);
         if (lua_isinteger(L, -1)) {
-            sqlite3_bind_int64(stmt, i, (sqlite3_int64) lua_tointeger(L, -1));
-        } else if (lua_isnumber(L, -1)) {
-            sqlite3_bind_double(stmt, i, lua_tonumber(L, -1));
+            p.type = LUA_TNUMBER;
+            p.integral = true;
+            p.integer = (sqlite3_int64) lua_tointeger(L, -1);
+        } else if (lua_type(L, -1) == LUA_TNUMBER) {
+            p.type = LUA_TNUMBER;
+            p.number = lua_tonumber(L, -1);
         } else if (lua_isstring(L, -1)) {
-            sqlite3_bind_text(stmt, i, lua_tostring(L, -1), -1, SQLITE_TRANSIENT);
-        } else if (lua_isnil(L, -1)) {
-            sqlite3_bind_null(stmt, i);
-        } else {
+            p.type = LUA_TSTRING;
+            p.text = lua_tostring(L, -1);
+        } else if (!lua_isnil(L, -1)) {
             // Fallback: convert to string
-            lua_getglobal(L, "tostring");
-            lua_pushvalue(L, -2);
-            lua_call(L, 1, 1);
-            const char *s = lua_tostring(L, -1);
-            sqlite3_bind_text(stmt, i, s ? s : "", -1, SQLITE_TRANSIENT);
+            p.type = LUA_TSTRING;
+            size_t len = 0;
+            const char *s = luaL_tolstring(L, -1, &len);
+            p.text.assign(s, len);
             lua_pop(L, 1);
         }
         lua_pop(L, 1); // pop value
     }
     lua_pop(L, 1); // pop __filter_args table
+    return params;
+}
+
+static void bind_params(sqlite3_stmt *stmt, const std::vector<SqlParam> &params)
+{
+    for (int i = 1; i <= (int) params.size(); ++i) {
+        const SqlParam &p = params[i - 1];
+        if (p.type == LUA_TSTRING) sqlite3_bind_text(stmt, i, p.text.c_str(), -1, SQLITE_TRANSIENT);
+        else if (p.type != LUA_TNUMBER) sqlite3_bind_null(stmt, i);
+        else if (p.integral) sqlite3_bind_int64(stmt, i, p.integer);
+        else sqlite3_bind_double(stmt, i, p.number);
+    }
+}
+
+// Runs the SELECT and pushes an array of rows. Inside a request coroutine the
+// statement steps on the Async I/O pool while the worker serves others; `k`
+// then continues with the rows on top. The connection stays pinned on the
+// stack meanwhile, and its mutex keeps the pool and the worker apart.
+static int run_sql_query(lua_State *L, const std::string &sql, lua_KFunction k = nullptr)
+{
+    log_sql(sql);
+    require_db(L);
+
+    LumeniteDB::DB *db = LumeniteDB::db_instance;
+    lua_getfield(L, LUA_REGISTRYINDEX, CONNECTION_KEY);
+
+    Async::Work work = [db, sql, params = collect_filter_args(L)]() -> Async::Push
+    {
+        std::lock_guard<std::mutex> lock(db->mutex);
+
+        sqlite3_stmt *stmt = db->prepare(sql);
+        if (!stmt) {
+            std::string err = sqlite3_errmsg(db->handle);
+            return [err](lua_State *L) { return luaL_error(L, "SQLite prepare failed: %s", err.c_str()); };
+        }
+        bind_params(stmt, params);
+
+        auto columns = std::make_shared<std::vector<std::string> >();
+        auto rows = std::make_shared<std::vector<SqlRow> >();
+        int cols = sqlite3_column_count(stmt);
+        for (int c = 0; c < cols; ++c) columns->emplace_back(sqlite3_column_name(stmt, c));
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            SqlRow &row = rows->emplace_back(cols);
+            for (int c = 0; c < cols; ++c) {
+                const unsigned char *txt = sqlite3_column_text(stmt, c);
+                if (txt) row[c].emplace(reinterpret_cast<const char *>(txt), sqlite3_column_bytes(stmt, c));
+            }
+        }
+        sqlite3_reset(stmt);
+
+        return [columns, rows](lua_State *L)
+        {
+            lua_createtable(L, (int) rows->size(), 0);
+            int n = 1;
+            for (auto &row: *rows) {
+                lua_createtable(L, 0, (int) columns->size());
+                for (size_t c = 0; c < columns->size(); ++c) {
+                    if (!row[c]) continue;
+                    lua_pushlstring(L, row[c]->data(), row[c]->size());
+                    lua_setfield(L, -2, (*columns)[c].c_str());
+                }
+                lua_rawseti(L, -2, n++);
+            }
+            return 1;
+        };
+    };
+
+    // Inside an explicit transaction the statement must not interleave with
+    // other requests on this connection, so it runs right here.
+    if (!sqlite3_get_autocommit(db->handle)) {
+        int n = work()(L);
+        return k ? k(L, LUA_OK, 0) : n;
+    }
+    return Async::await(L, std::move(work), k);
 }
 
 static int proxy_index(lua_State *L)
@@ -185,6 +253,50 @@ static void clone_query(lua_State *L)
     lua_replace(L, 1); // replace arg-1 with the clone
 }
 
+// Continuation of get()/first(): the result table on top becomes a proxy for
+// its first row, or nil. The table name is the calling closure's upvalue.
+static int first_row_proxy(lua_State *L, int, lua_KContext)
+{
+    const char *tbl = lua_tostring(L, lua_upvalueindex(1));
+
+    lua_rawgeti(L, -1, 1);
+    bool hasRow = !lua_isnil(L, -1);
+    if (!hasRow) {
+        lua_pop(L, 2); // pop nil row + result-table
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_replace(L, -2); // stack: [ row_table ]
+
+    lua_newtable(L); // proxy
+    lua_pushvalue(L, -2); // row
+    lua_setfield(L, -2, "__data");
+
+    lua_newtable(L); // mt
+    lua_pushcfunction(L, proxy_index);
+    lua_setfield(L, -2, "__index");
+    lua_pushstring(L, tbl);
+    lua_pushcclosure(L, proxy_newindex, 1);
+    lua_setfield(L, -2, "__newindex");
+    lua_setmetatable(L, -2); // set mt on proxy
+
+    lua_remove(L, -2); // remove raw row
+    return 1;
+}
+
+// Continuation of count().
+static int count_result(lua_State *L, int, lua_KContext)
+{
+    lua_rawgeti(L, -1, 1);
+    lua_getfield(L, -1, "c");
+    const char *cs = lua_tostring(L, -1);
+    lua_Integer n = cs ? (lua_Integer) std::strtoll(cs, nullptr, 10) : 0;
+    lua_pop(L, 3); // c, row, result
+    lua_pushinteger(L, n);
+    return 1;
+}
+
 static void register_default_query_methods(lua_State *L, int idx, const std::string &tablename)
 {
     // order_by(expr)
@@ -267,32 +379,7 @@ static void register_default_query_methods(lua_State *L, int idx, const std::str
         lua_setfield(L, 1, "__filter_args");
 
         std::string sql = std::string("SELECT * FROM ") + tbl + " WHERE id = ? LIMIT 1;";
-        run_sql_query(L, sql); // pushes result-table
-
-        lua_rawgeti(L, -1, 1);
-        bool hasRow = !lua_isnil(L, -1);
-        if (!hasRow) {
-            lua_pop(L, 2); // pop nil row + result-table
-            lua_pushnil(L);
-            return 1;
-        }
-
-        lua_replace(L, -2); // stack: [ row_table ]
-
-        lua_newtable(L); // proxy
-        lua_pushvalue(L, -2); // row
-        lua_setfield(L, -2, "__data");
-
-        lua_newtable(L); // mt
-        lua_pushcfunction(L, proxy_index);
-        lua_setfield(L, -2, "__index");
-        lua_pushstring(L, tbl);
-        lua_pushcclosure(L, proxy_newindex, 1);
-        lua_setfield(L, -2, "__newindex");
-        lua_setmetatable(L, -2); // set mt on proxy
-
-        lua_remove(L, -2); // remove raw row
-        return 1;
+        return run_sql_query(L, sql, first_row_proxy); // pushes result-table
     }, 1);
     lua_setfield(L, idx, "get");
 
@@ -313,32 +400,7 @@ static void register_default_query_methods(lua_State *L, int idx, const std::str
         lua_pop(L, 1);
 
         ss << "LIMIT 1;";
-        run_sql_query(L, ss.str());
-
-        lua_rawgeti(L, -1, 1);
-        bool hasRow = !lua_isnil(L, -1);
-        if (!hasRow) {
-            lua_pop(L, 2); // nil + result table
-            lua_pushnil(L);
-            return 1;
-        }
-
-        lua_replace(L, -2); // [ row_table ]
-
-        lua_newtable(L);
-        lua_pushvalue(L, -2);
-        lua_setfield(L, -2, "__data");
-
-        lua_newtable(L);
-        lua_pushcfunction(L, proxy_index);
-        lua_setfield(L, -2, "__index");
-        lua_pushstring(L, tbl);
-        lua_pushcclosure(L, proxy_newindex, 1);
-        lua_setfield(L, -2, "__newindex");
-        lua_setmetatable(L, -2);
-
-        lua_remove(L, -2);
-        return 1;
+        return run_sql_query(L, ss.str(), first_row_proxy);
     }, 1);
     lua_setfield(L, idx, "first");
 
@@ -377,14 +439,7 @@ static void register_default_query_methods(lua_State *L, int idx, const std::str
         if (lua_isstring(L, -1)) ss << lua_tostring(L, -1) << " ";
         lua_pop(L, 1);
         ss << ";";
-        run_sql_query(L, ss.str()); // [{ c = "N" }]
-        lua_rawgeti(L, -1, 1);
-        lua_getfield(L, -1, "c");
-        const char *cs = lua_tostring(L, -1);
-        lua_Integer n = cs ? (lua_Integer) std::strtoll(cs, nullptr, 10) : 0;
-        lua_pop(L, 3); // c, row, result
-        lua_pushinteger(L, n);
-        return 1;
+        return run_sql_query(L, ss.str(), count_result); // [{ c = "N" }]
     }, 1);
     lua_setfield(L, idx, "count");
 }
@@ -504,6 +559,44 @@ bool LumeniteDB::DB::exec(const std::string &sql)
     return true;
 }
 
+sqlite3_stmt *LumeniteDB::DB::prepare(const std::string &sql)
+{
+    auto it = stmtIndex.find(sql);
+    if (it != stmtIndex.end()) {
+        ++stmtHits;
+        stmtLru.splice(stmtLru.begin(), stmtLru, it->second);
+        sqlite3_stmt *stmt = it->second->second;
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+        return stmt;
+    }
+
+    ++stmtMisses;
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(handle, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return nullptr;
+    }
+
+    stmtLru.emplace_front(sql, stmt);
+    stmtIndex.emplace(stmtLru.front().first, stmtLru.begin());
+
+    if (stmtLru.size() > STMT_CACHE_CAPACITY) {
+        auto &[oldSql, oldStmt] = stmtLru.back();
+        sqlite3_finalize(oldStmt);
+        stmtIndex.erase(oldSql);
+        stmtLru.pop_back();
+    }
+    return stmt;
+}
+
+void LumeniteDB::DB::clearStatements()
+{
+    for (auto &[sql, stmt]: stmtLru) sqlite3_finalize(stmt);
+    stmtIndex.clear();
+    stmtLru.clear();
+}
+
 std::string LumeniteDB::DB::lastError() const
 {
     return error;
@@ -511,6 +604,8 @@ std::string LumeniteDB::DB::lastError() const
 
 LumeniteDB::DB::~DB()
 {
+    // sqlite3_close refuses to close while statements are still alive.
+    clearStatements();
     if (handle) sqlite3_close(handle);
 }
 
@@ -546,10 +641,19 @@ int LumeniteDB::db_open(lua_State *L)
 
     // Enable foreign keys
     db_instance = *ud;
+
+    // The script usually keeps the handle in a chunk-local; pin it so the
+    // connection (and its statement cache) lives as long as this state.
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, CONNECTION_KEY);
+
     run_sql_exec(L, "PRAGMA foreign_keys = ON;");
 
     fs::path logfile = logdir / (db_filename + ".log");
-    sql_log_stream.open(logfile, std::ios::app);
+    std::lock_guard<std::mutex> lock(sql_log_mutex);
+    (*ud)->logging = true;
+    ++sql_log_users;
+    if (!sql_log_stream.is_open()) sql_log_stream.open(logfile, std::ios::app);
     if (!sql_log_stream) {
         std::cerr << "Warning: could not open SQL log at " << logfile.string() << "\n";
     }
@@ -561,14 +665,17 @@ int LumeniteDB::db_gc(lua_State *L)
 {
     DB **ud = check(L);
     if (ud && *ud) {
+        if ((*ud)->logging) {
+            std::lock_guard<std::mutex> lock(sql_log_mutex);
+            if (--sql_log_users == 0 && sql_log_stream.is_open()) {
+                sql_log_stream.flush();
+                sql_log_stream.close();
+            }
+        }
         if (db_instance == *ud) db_instance = nullptr;
         delete *ud;
         *ud = nullptr;
     }
-    if (sql_log_stream.is_open()) {
-        sql_log_stream.flush();
-        sql_log_stream.close();
-    }
     return 0;
 }
 
@@ -705,6 +812,7 @@ int LumeniteDB::db_session_add(lua_State *L)
 int LumeniteDB::db_session_commit(lua_State *L)
 {
     require_db(L);
+    std::unique_lock<std::mutex> lock(db_instance->mutex);
 
     // INSERTs (prepared)
     for (auto &r: session.pending_inserts) {
@@ -741,9 +849,11 @@ int LumeniteDB::db_session_commit(lua_State *L)
         std::string sql = ss.str();
         log_sql(sql);
 
-        sqlite3_stmt *stmt = nullptr;
-        if (sqlite3_prepare_v2(db_instance->handle, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            luaL_error(L, "SQLite prepare failed (INSERT): %s", sqlite3_errmsg(db_instance->handle));
+        sqlite3_stmt *stmt = db_instance->prepare(sql);
+        if (!stmt) {
+            std::string err = sqlite3_errmsg(db_instance->handle);
+            lock.unlock();
+            luaL_error(L, "SQLite prepare failed (INSERT): %s", err.c_str());
         }
 
         for (int i = 0; i < (int) vals.size(); ++i) {
@@ -752,10 +862,12 @@ int LumeniteDB::db_session_commit(lua_State *L)
 
         int rc = sqlite3_step(stmt);
         if (rc != SQLITE_DONE) {
-            sqlite3_finalize(stmt);
-            luaL_error(L, "SQLite step failed (INSERT): %s", sqlite3_errmsg(db_instance->handle));
+            std::string err = sqlite3_errmsg(db_instance->handle);
+            sqlite3_reset(stmt);
+            lock.unlock();
+            luaL_error(L, "SQLite step failed (INSERT): %s", err.c_str());
         }
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
     }
     session.pending_inserts.clear();
 
@@ -786,9 +898,11 @@ int LumeniteDB::db_session_commit(lua_State *L)
         std::string sql = ss.str();
         log_sql(sql);
 
-        sqlite3_stmt *stmt = nullptr;
-        if (sqlite3_prepare_v2(db_instance->handle, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-            luaL_error(L, "SQLite prepare failed (UPDATE): %s", sqlite3_errmsg(db_instance->handle));
+        sqlite3_stmt *stmt = db_instance->prepare(sql);
+        if (!stmt) {
+            std::string err = sqlite3_errmsg(db_instance->handle);
+            lock.unlock();
+            luaL_error(L, "SQLite prepare failed (UPDATE): %s", err.c_str());
         }
 
         int idx = 1;
@@ -799,10 +913,12 @@ int LumeniteDB::db_session_commit(lua_State *L)
 
         int rc = sqlite3_step(stmt);
         if (rc != SQLITE_DONE) {
-            sqlite3_finalize(stmt);
-            luaL_error(L, "SQLite step failed (UPDATE): %s", sqlite3_errmsg(db_instance->handle));
+            std::string err = sqlite3_errmsg(db_instance->handle);
+            sqlite3_reset(stmt);
+            lock.unlock();
+            luaL_error(L, "SQLite step failed (UPDATE): %s", err.c_str());
         }
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
     }
     session.pending_updates.clear();
 
@@ -811,30 +927,9 @@ int LumeniteDB::db_session_commit(lua_State *L)
 
 int LumeniteDB::db_select_all(lua_State *L)
 {
-    require_db(L);
     const char *tn = luaL_checkstring(L, 1);
-    std::string q = std::string("SELECT * FROM ") + tn + ";";
-    log_sql(q);
-
-    sqlite3_stmt *s = nullptr;
-    if (sqlite3_prepare_v2(db_instance->handle, q.c_str(), -1, &s, nullptr) != SQLITE_OK)
-        return luaL_error(L, "SQLite prepare failed: %s", sqlite3_errmsg(db_instance->handle));
-
-    lua_newtable(L);
-    int i = 1;
-    while (sqlite3_step(s) == SQLITE_ROW) {
-        lua_newtable(L);
-        for (int c = 0; c < sqlite3_column_count(s); ++c) {
-            const char *col = sqlite3_column_name(s, c);
-            const unsigned char *txt = sqlite3_column_text(s, c);
-            if (txt) lua_pushstring(L, reinterpret_cast<const char *>(txt));
-            else lua_pushnil(L);
-            lua_setfield(L, -2, col);
-        }
-        lua_rawseti(L, -2, i++);
-    }
-    sqlite3_finalize(s);
-    return 1;
+    lua_settop(L, 1); // no filter table at index 1
+    return run_sql_query(L, std::string("SELECT * FROM ") + tn + ";");
 }
 
 // ─────────────────────────────────────────────────────────────────────────────
@@ -872,23 +967,45 @@ int LumeniteDB::db_delete(lua_State *L)
 
     std::string sql = std::string("DELETE FROM ") + tn + " WHERE id = ?;";
     log_sql(sql);
+    std::unique_lock<std::mutex> lock(db_instance->mutex);
 
-    sqlite3_stmt *st = nullptr;
-    if (sqlite3_prepare_v2(db_instance->handle, sql.c_str(), -1, &st, nullptr) != SQLITE_OK)
-        return luaL_error(L, "SQLite prepare failed (DELETE): %s", sqlite3_errmsg(db_instance->handle));
+    sqlite3_stmt *st = db_instance->prepare(sql);
+    if (!st) {
+        std::string err = sqlite3_errmsg(db_instance->handle);
+        lock.unlock();
+        return luaL_error(L, "SQLite prepare failed (DELETE): %s", err.c_str());
+    }
 
     if (lua_isinteger(L, 2)) sqlite3_bind_int64(st, 1, (sqlite3_int64) lua_tointeger(L, 2));
     else sqlite3_bind_text(st, 1, lua_tostring(L, 2), -1, SQLITE_TRANSIENT);
 
     int rc = sqlite3_step(st);
     if (rc != SQLITE_DONE) {
-        sqlite3_finalize(st);
-        return luaL_error(L, "SQLite step failed (DELETE): %s", sqlite3_errmsg(db_instance->handle));
+        std::string err = sqlite3_errmsg(db_instance->handle);
+        sqlite3_reset(st);
+        lock.unlock();
+        return luaL_error(L, "SQLite step failed (DELETE): %s", err.c_str());
     }
-    sqlite3_finalize(st);
+    sqlite3_reset(st);
     return 0;
 }
 
+// Statement cache counters for this worker's connection.
+int LumeniteDB::db_stmt_cache_stats(lua_State *L)
+{
+    DB *db = db_instance;
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, db ? (lua_Integer) db->stmtHits : 0);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, db ? (lua_Integer) db->stmtMisses : 0);
+    lua_setfield(L, -2, "misses");
+    lua_pushinteger(L, db ? (lua_Integer) db->stmtLru.size() : 0);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, (lua_Integer) DB::STMT_CACHE_CAPACITY);
+    lua_setfield(L, -2, "capacity");
+    return 1;
+}
+
 // ─────────────────────────────────────────────────────────────────────────────
 
 extern "C" int luaopen_lumenite_db(lua_State *L)
@@ -932,6 +1049,8 @@ extern "C" int luaopen_lumenite_db(lua_State *L)
     lua_setfield(L, -2, "last_insert_id");
     lua_pushcfunction(L, LumeniteDB::db_delete);
     lua_setfield(L, -2, "delete");
+    lua_pushcfunction(L, LumeniteDB::db_stmt_cache_stats);
+    lua_setfield(L, -2, "stmt_cache_stats");
 
     return 1;
 }
@@ -3,10 +3,15 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
+#include <unordered_map>
+#include <string_view>
+#include <cstdint>
 #include <sqlite3.h>
 #include "lua.hpp"
 #include <fstream>
 #include <chrono>
+#include <mutex>
 
 
 class LumeniteDB
@@ -58,13 +63,32 @@ public:
 
     struct DB
     {
+        static constexpr size_t STMT_CACHE_CAPACITY = 64;
+
         sqlite3 *handle = nullptr;
         std::string error;
+        // Held around every use of the handle: queries may step on the Async
+        // I/O pool while the owning worker runs other requests.
+        std::mutex mutex;
+
+        // Prepared statements keyed by SQL text, most recently used first.
+        std::list<std::pair<std::string, sqlite3_stmt *> > stmtLru;
+        std::unordered_map<std::string_view, decltype(stmtLru)::iterator> stmtIndex;
+        uint64_t stmtHits = 0;
+        uint64_t stmtMisses = 0;
+        bool logging = false; // counted in sql_log_users
 
         bool open(const std::string &file);
 
         bool exec(const std::string &sql);
 
+        // Cached statement for `sql`, reset with no bindings; nullptr if it
+        // fails to compile. Owned by the cache: sqlite3_reset it when done,
+        // never finalize it.
+        sqlite3_stmt *prepare(const std::string &sql);
+
+        void clearStatements();
+
         std::string lastError() const;
 
         ~DB();
@@ -95,6 +119,8 @@ public:
 
     static int db_delete(lua_State *L);
 
+    static int db_stmt_cache_stats(lua_State *L);
+
 
     static int db_gc(lua_State *L);
 
@@ -102,12 +128,18 @@ public:
 
     // Global state
     static std::map<std::string, Model> models;
-    static Session session;
-    static DB *db_instance;
+    // Each worker thread owns its own interpreter, connection and pending session.
+    static thread_local Session session;
+    static thread_local DB *db_instance;
 
     static std::string db_filename;
     static bool sql_log_enabled;
     static std::ofstream sql_log_stream;
+    // Guards the stream. Every state opens its own connection, and states
+    // from before a reload are collected while the new ones log, so the
+    // stream closes with the last connection rather than the first.
+    static std::mutex sql_log_mutex;
+    static size_t sql_log_users;
 };
 
 extern "C" int luaopen_lumenite_db(lua_State *L);
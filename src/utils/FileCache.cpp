@@ -0,0 +1,114 @@
+#include "FileCache.h"
+#include "MimeDetector.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+std::mutex FileCache::mutex;
+std::unordered_map<std::string, FileCache::Entry> FileCache::entries;
+std::list<std::string> FileCache::lru;
+
+// Enough for every signature MimeDetector knows about.
+static constexpr size_t SNIFF_BYTES = 512;
+
+
+OpenFile::~OpenFile()
+{
+#ifdef _WIN32
+    if (fd >= 0) _close(fd);
+#else
+    if (fd >= 0) close(fd);
+#endif
+}
+
+long FileCache::readAt(const OpenFile &file, char *dst, size_t len, uint64_t offset)
+{
+#ifdef _WIN32
+    // No pread; callers on this path serialize access per response.
+    if (_lseeki64(file.fd, static_cast<__int64>(offset), SEEK_SET) < 0) return -1;
+    return _read(file.fd, dst, static_cast<unsigned>(len));
+#else
+    return static_cast<long>(pread(file.fd, dst, len, static_cast<off_t>(offset)));
+#endif
+}
+
+FileHandle FileCache::load(const std::string &path)
+{
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+    if (fd < 0) return nullptr;
+
+    auto file = std::make_shared<OpenFile>();
+    file->fd = fd;
+    file->path = path;
+
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+    file->size = static_cast<uint64_t>(st.st_size);
+    file->mtime = static_cast<int64_t>(st.st_mtime);
+    file->inode = static_cast<uint64_t>(st.st_ino);
+
+    char head[SNIFF_BYTES];
+    long n = readAt(*file, head, sizeof(head), 0);
+    file->mime = MimeDetector::toString(
+        MimeDetector::detect(reinterpret_cast<const uint8_t *>(head), n > 0 ? static_cast<size_t>(n) : 0, path)
+    );
+    return file;
+}
+
+FileHandle FileCache::open(const std::string &path)
+{
+    auto now = Clock::now();
+    FileHandle file;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(path);
+        if (it != entries.end()) {
+            lru.splice(lru.begin(), lru, it->second.lru);
+            if (now - it->second.checked < REVALIDATE_AFTER) return it->second.file;
+            file = it->second.file;
+        }
+    }
+
+    // Stat and open outside the lock; a racing caller at worst loads twice.
+    struct stat st{};
+    bool current = file && stat(path.c_str(), &st) == 0 &&
+                   static_cast<uint64_t>(st.st_size) == file->size &&
+                   static_cast<int64_t>(st.st_mtime) == file->mtime &&
+                   static_cast<uint64_t>(st.st_ino) == file->inode;
+    if (!current) file = load(path);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if (!file) {
+        if (it != entries.end()) {
+            lru.erase(it->second.lru);
+            entries.erase(it);
+        }
+        return nullptr;
+    }
+
+    if (it != entries.end()) {
+        it->second.file = file;
+        it->second.checked = now;
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return file;
+    }
+
+    if (entries.size() >= CAPACITY) {
+        entries.erase(lru.back());
+        lru.pop_back();
+    }
+    lru.push_front(path);
+    entries.emplace(path, Entry{file, now, lru.begin()});
+    return file;
+}
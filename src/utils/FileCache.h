@@ -0,0 +1,64 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+/// A file opened for serving. The descriptor stays valid for as long as any
+/// response holds the handle, even after the cache has replaced the entry.
+struct OpenFile
+{
+    int fd = -1;
+    uint64_t size = 0;
+    int64_t mtime = 0; // seconds since the epoch
+    uint64_t inode = 0;
+    std::string path;
+    std::string mime; // sniffed from the first bytes, then the extension
+
+    OpenFile() = default;
+
+    ~OpenFile();
+
+    OpenFile(const OpenFile &) = delete;
+
+    OpenFile &operator=(const OpenFile &) = delete;
+};
+
+using FileHandle = std::shared_ptr<const OpenFile>;
+
+
+/// Process-wide cache of open descriptors and their stat() results, so hot
+/// downloads skip open/fstat/sniffing. Entries are re-validated against the
+/// file on disk at most once per REVALIDATE_AFTER.
+class FileCache
+{
+public:
+    static constexpr size_t CAPACITY = 256;
+    static constexpr std::chrono::seconds REVALIDATE_AFTER{1};
+
+    // nullptr if the path is missing or not a regular file.
+    static FileHandle open(const std::string &path);
+
+    // Copy up to `len` bytes at `offset` into `dst`; used where sendfile is not available.
+    static long readAt(const OpenFile &file, char *dst, size_t len, uint64_t offset);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        FileHandle file;
+        Clock::time_point checked;
+        std::list<std::string>::iterator lru;
+    };
+
+    static FileHandle load(const std::string &path);
+
+    static std::mutex mutex;
+    static std::unordered_map<std::string, Entry> entries;
+    static std::list<std::string> lru; // most recently used first
+};
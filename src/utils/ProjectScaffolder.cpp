@@ -548,6 +548,12 @@ Lumenite DB — Lua API (EmmyLua annotations)
 ---@field query QueryTable                            @chainable query builder
 ---@field [string] ColumnHelper                       @each column name → helper with :asc()/:desc()
 
+---@class StmtCacheStats
+---@field hits     integer  @queries served by an already-prepared statement
+---@field misses   integer  @queries that had to be prepared
+---@field size     integer  @statements currently cached
+---@field capacity integer  @cache size before least-recently-used statements are finalized
+
 ---@class DB
 ---@field open             fun(filename: string):      DB?, string?  @open/create `./db/<filename>`
 ---@field Column           fun(name: string, type: string, options?: ColumnOptions): ColumnDef
@@ -561,6 +567,7 @@ Lumenite DB — Lua API (EmmyLua annotations)
 ---@field rollback         fun():                      nil            @ROLLBACK transaction
 ---@field last_insert_id   fun():                      integer        @sqlite3_last_insert_rowid()
 ---@field delete           fun(tablename: string, id: string|integer): nil  @DELETE FROM <table> WHERE id=?
+---@field stmt_cache_stats fun():                      StmtCacheStats @prepared-statement cache counters
 
 --- Opens (or creates) a SQLite file under `./db/`.
 --- Also ensures `./db` and `./log` folders exist and enables `PRAGMA foreign_keys = ON`.
@@ -614,6 +621,11 @@ function db.last_insert_id() end
 ---@param id string|integer
 function db.delete(tablename, id) end
 
+--- Prepared statements are cached per connection (one per worker) and keyed
+--- by SQL text. Counters are for the calling worker's connection.
+---@return StmtCacheStats
+function db.stmt_cache_stats() end
+
 return db
 
 
@@ -650,13 +662,15 @@ return db
 ---@field headers Headers
 ---@field query table<string, string|string[]>
 ---@field form table<string, string|string[]>
+---@field cookies table<string, string>
 ---@field body string
 ---@field remote_ip string
 
 ---@class Response
 ---@field status integer
 ---@field headers Headers
----@field body string
+---@field body string|fun(): string?|thread  @a function or coroutine streams the body in chunks
+---@field file? userdata  @file-backed body from app.send_file, streamed by the server
 
 ---@class App
 local app = {}
@@ -685,6 +699,78 @@ function app.session_get(key) end
 ---@param value string
 function app.session_set(key, value) end
 
+---@class SessionConfig
+---@field idle_timeout? integer  @seconds without a request before a session expires (default 1800)
+---@field max_age? integer       @seconds after creation a session expires regardless (default 86400)
+---@field max_sessions? integer  @least recently used sessions are evicted beyond this (default 100000)
+
+---@param options SessionConfig
+function app.session_config(options) end
+
+---@return { live: integer, expired: integer, evicted: integer }
+function app.session_stats() end
+
+---@class LogConfig
+---@field format? "ansi"|"plain"|"json"  @line format (default "ansi")
+---@field file? string             @log file path; stdout when omitted
+---@field max_bytes? integer       @rotate once the file would grow past this size
+---@field rotate_interval? integer @rotate after this many seconds
+---@field buffer? integer          @records buffered per worker before new ones are dropped (default 8192)
+---@field flush_ms? integer        @how often the writer thread drains the buffers (default 50)
+
+---@param options LogConfig
+function app.log_config(options) end
+
+---@return { written: integer, dropped: integer, rotations: integer }
+function app.log_stats() end
+
+---@class CompressionConfig
+---@field enabled? boolean     @gzip/deflate responses for clients that accept it (default true)
+---@field min_size? integer    @bodies smaller than this go out as they are (default 1024)
+---@field level? integer       @zlib level, 1 (fastest) to 9 (smallest) (default 6)
+---@field types? string[]      @Content-Type prefixes worth compressing (default text/, JSON, JS, XML, SVG, wasm)
+---@field cache_bytes? integer @compressed variants of static files and cacheable responses kept (default 32 MiB)
+
+---@param options CompressionConfig
+function app.compression_config(options) end
+
+---@return { compressed: integer, cache_hits: integer, bytes_in: integer, bytes_out: integer, cached_bytes: integer }
+function app.compression_stats() end
+
+---@class WorkerStats
+---@field pid integer
+---@field started integer   @unix time the current process started
+---@field restarts integer
+---@field requests integer
+
+--- Across every worker of a `--workers` master, or this process alone.
+---@return { workers: integer, requests: integer, restarts: integer, [integer]: WorkerStats }
+function app.worker_stats() end
+
+--- This process's connections: how many are open, and how many were closed
+--- for running past a deadline or a limit.
+---@return { open: integer, handshake_timeouts: integer, header_timeouts: integer, body_timeouts: integer, idle_timeouts: integer, write_timeouts: integer, headers_too_large: integer, request_limit: integer }
+function app.connection_stats() end
+
+---@class OverloadConfig
+---@field enabled? boolean      @shed requests that waited too long for a worker (default true)
+---@field target? integer       @milliseconds of queueing that count as too long once a queue stands (default 50)
+---@field interval? integer     @milliseconds the shortest wait must stay above target to call it standing (default 500)
+---@field retry_after? integer  @seconds sent in Retry-After with the 503 (default 1)
+---@field exempt? string[]      @path prefixes never shed, e.g. { "/health" }
+
+---@param options OverloadConfig
+function app.overload_config(options) end
+
+---@return { admitted: integer, shed: integer, overloaded: boolean, min_wait_ms: number }
+function app.overload_stats() end
+
+--- Load app.lua afresh without closing the listeners (as on SIGHUP). New
+--- requests move over once it has loaded; a script that fails to load is
+--- reported and the running code stays.
+---@return boolean started
+function app.reload() end
+
 ---@param name string
 ---@param fn fun(input: string): string
 function app:template_filter(name, fn) end
@@ -704,6 +790,92 @@ function app.render_template_string(template_string, context) end
 ---@return Response
 function app.send_file(path, options) end
 
+---Serve the files under `dir` at `prefix` straight from the server, with
+---caching, ETag and 304s; no route or hook runs for them.
+---@param prefix string
+---@param dir string
+function app.static(prefix, dir) end
+
+---@class WebSocket
+---@field id integer
+---@field path string
+---@field remote_ip string
+---@field open boolean
+local WebSocket = {}
+
+---@param data string
+---@param binary? boolean
+---@return boolean sent  @false once the socket is closing
+function WebSocket:send(data, binary) end
+
+---@param code? integer  @1000 (default) or 3000-4999
+---@param reason? string
+function WebSocket:close(code, reason) end
+
+---Every socket starts subscribed to its own path.
+---@param channel string
+function WebSocket:subscribe(channel) end
+
+---@param channel string
+function WebSocket:unsubscribe(channel) end
+
+---@class WebSocketHandlers
+---@field on_open? fun(ws: WebSocket, req: Request): boolean?  @false refuses the upgrade with 403
+---@field on_message? fun(ws: WebSocket, message: string, binary: boolean): string?  @a returned string is sent back
+---@field on_close? fun(ws: WebSocket, code: integer, reason: string)
+
+---Accept WebSocket upgrades on `path`. Frames are handled by the server;
+---only whole messages reach `on_message`.
+---@param path string
+---@param handlers WebSocketHandlers
+function app.websocket(path, handlers) end
+
+---Send `data` to every socket subscribed to `channel`, framed once.
+---@param channel string
+---@param data string
+---@param binary? boolean
+---@return integer count
+function app.broadcast(channel, data, binary) end
+
+---@class EventOptions
+---@field event? string    @event name; EventSource dispatches it to listeners of that name
+---@field id? string|integer @sent back as Last-Event-ID when the client reconnects
+---@field retry? integer   @reconnection delay in milliseconds
+
+---@class EventStream
+---@field id integer
+---@field path string
+---@field remote_ip string
+---@field open boolean
+local EventStream = {}
+
+---@param data string
+---@param event? string|EventOptions
+---@return boolean sent  @false once the client is gone
+function EventStream:send(data, event) end
+
+function EventStream:close() end
+
+---@param channel string
+function EventStream:subscribe(channel) end
+
+---@param channel string
+function EventStream:unsubscribe(channel) end
+
+---Serve Server-Sent Events on `path`. `handler` runs once per client, to
+---subscribe the stream or send it a first event; the connection then stays
+---open with a heartbeat comment every 15 seconds.
+---@param path string
+---@param handler fun(stream: EventStream, req: Request): boolean?  @false answers 204 and ends it
+function app.sse(path, handler) end
+
+---Send an event to every stream subscribed to `channel`, formatted once.
+---@param channel string
+---@param data string
+---@param event? string|EventOptions
+---@return integer count
+function app.publish(channel, data, event) end
+
 ---@param table table
 ---@return Response
 function app.jsonify(table) end
@@ -726,12 +898,37 @@ function app.after_request(fn) end
 ---@return table
 function app.http_get(url) end
 
+---Pause the handler without blocking the worker.
+---@param seconds number
+function app.sleep(seconds) end
+
 ---@overload fun(status: integer)
 ---@param status integer
 ---@param message? string
 function app.abort(status, message) end
 
----@param port integer
+---@class ListenOptions
+---@field port integer
+---@field cert? string             @PEM certificate chain; with `key`, the listener speaks HTTPS
+---@field key? string              @PEM private key for `cert`
+---@field session_cache? integer   @TLS sessions kept for resumption (default 20480; 0 = none)
+---@field session_tickets? boolean @stateless TLS resumption (default true)
+---@field io? "epoll"|"io_uring"  @socket backend on Linux (default epoll; TLS always uses epoll)
+---@field backlog? integer         @pending connections per listener (default SOMAXCONN)
+---@field reuse_port? boolean      @Linux: one SO_REUSEPORT listener per core (default true)
+---@field affinity? boolean        @Linux: pin loops to cores, accept on the CPU that took the SYN (default false)
+---@field timeouts? Timeouts       @per-connection deadlines; past one the connection is closed
+---@field max_requests? integer    @requests per connection before it is closed (default 1000; 0 = no limit)
+---@field max_header_bytes? integer @request line and headers, larger is answered 431 (default 65536)
+
+---@class Timeouts
+---@field handshake? integer @seconds for the TLS handshake (default 10; 0 = none)
+---@field header? integer    @seconds from a request's first byte to the end of its headers (default 10)
+---@field body? integer      @seconds from the end of the headers to the end of the body (default 30)
+---@field idle? integer      @seconds a kept-alive connection waits for its next request (default 15)
+---@field write? integer     @seconds output may wait with the client reading none of it (default 30)
+
+---@param port integer|ListenOptions
 function app:listen(port) end
 
 ---@type App
@@ -781,6 +978,8 @@ require("app.middleware")
 require("app.routes.web")
 require("app.routes.api")
 
+app.static("/static", "static")
+
 app:listen(8080)
 
 )");
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Hashed timing wheel. Deadlines are rounded up to whole ticks; schedule
+/// and cancel are O(1), and advance() only visits the slots whose ticks have
+/// passed since the last call. Not thread-safe: the owner provides locking.
+template<typename Key, typename Hash = std::hash<Key> >
+class TimerWheel
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerWheel(Clock::duration tick, size_t slots)
+        : tick_(tick), slots_(std::max<size_t>(slots, 1)), origin_(Clock::now())
+    {
+    }
+
+    // Arm `key` for `when`, replacing any deadline it already had.
+    void schedule(const Key &key, Clock::time_point when)
+    {
+        cancel(key);
+        uint64_t t = std::max(tickFor(when), current_ + 1);
+        auto &slot = slots_[t % slots_.size()];
+        slot.push_front({key, t});
+        index_.emplace(key, std::make_pair(t % slots_.size(), slot.begin()));
+    }
+
+    void cancel(const Key &key)
+    {
+        auto it = index_.find(key);
+        if (it == index_.end()) return;
+        slots_[it->second.first].erase(it->second.second);
+        index_.erase(it);
+    }
+
+    // Disarm and hand every key whose deadline has passed to `fire`, which
+    // may schedule() again.
+    template<typename Fn>
+    void advance(Clock::time_point now, Fn &&fire)
+    {
+        uint64_t target = now <= origin_ ? 0 : static_cast<uint64_t>((now - origin_) / tick_);
+        if (target <= current_) return;
+
+        std::vector<Key> due;
+        uint64_t steps = std::min<uint64_t>(target - current_, slots_.size());
+        for (uint64_t i = 1; i <= steps; ++i) {
+            size_t s = (current_ + i) % slots_.size();
+            auto &slot = slots_[s];
+            for (auto it = slot.begin(); it != slot.end();) {
+                if (it->tick <= target) {
+                    due.push_back(it->key);
+                    index_.erase(it->key);
+                    it = slot.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        current_ = target;
+
+        for (const auto &key: due) fire(key);
+    }
+
+    size_t size() const { return index_.size(); }
+
+private:
+    struct Entry
+    {
+        Key key;
+        uint64_t tick;
+    };
+
+    using Slot = std::list<Entry>;
+
+    uint64_t tickFor(Clock::time_point when) const
+    {
+        if (when <= origin_) return 0;
+        return static_cast<uint64_t>((when - origin_ + tick_ - Clock::duration(1)) / tick_);
+    }
+
+    Clock::duration tick_;
+    std::vector<Slot> slots_;
+    Clock::time_point origin_;
+    uint64_t current_ = 0;
+    std::unordered_map<Key, std::pair<size_t, typename Slot::iterator>, Hash> index_;
+};
@@ -0,0 +1,116 @@
+// Regression test: a response finished ahead of a slow pipelined request
+// goes out at once rather than waiting to share a write with the next one.
+// With a 2 s write deadline, `GET /` then `GET /slow` (4 s) on one
+// connection has to get "fast" well before SLOW has passed, then "slow",
+// with no write timeout counted. Build with -DLUMENITE_BUILD_TESTS=ON and
+// run ctest.
+
+#include "../src/EventLoop.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static constexpr auto SLOW = std::chrono::seconds(4);
+// How long the fast response may take; anything near SLOW means it was held.
+static constexpr auto PROMPT = std::chrono::milliseconds(500);
+
+static WireResponse reply(const std::string &body)
+{
+    WireResponse wire;
+    wire.head = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    wire.body = body;
+    return wire;
+}
+
+// A loop on its own thread, listening on a free port; returns the port.
+static int serve(EventLoop::Backend backend)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (sockaddr *) &addr, len) != 0 || listen(fd, 16) != 0) return -1;
+    getsockname(fd, (sockaddr *) &addr, &len);
+
+    ConnectionLimits limits;
+    limits.write = std::chrono::seconds(2);
+    auto *loop = new EventLoop(fd, [](const ConnectionPtr &conn, HttpRequest &&req)
+    {
+        if (req.path != "/slow") {
+            conn->loop->complete(conn, reply("fast"));
+            return;
+        }
+        std::thread([conn]
+        {
+            std::this_thread::sleep_for(SLOW);
+            conn->loop->complete(conn, reply("slow"));
+        }).detach();
+    }, backend, limits);
+    std::thread([loop] { loop->run(); }).detach();
+    return ntohs(addr.sin_port);
+}
+
+static bool pipelined(const char *name, EventLoop::Backend backend)
+{
+    int port = serve(backend);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (port < 0 || connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+        std::printf("%s: cannot connect\n", name);
+        return false;
+    }
+    timeval limit{10, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+
+    const std::string requests = "GET / HTTP/1.1\r\nHost: x\r\n\r\nGET /slow HTTP/1.1\r\nHost: x\r\n\r\n";
+    auto start = std::chrono::steady_clock::now();
+    send(fd, requests.data(), requests.size(), MSG_NOSIGNAL);
+
+    std::string got;
+    std::chrono::steady_clock::duration fastAfter{};
+    char buf[4096];
+    while (got.find("slow") == std::string::npos) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) break;
+        bool hadFast = got.find("fast") != std::string::npos;
+        got.append(buf, (size_t) n);
+        if (!hadFast && got.find("fast") != std::string::npos) fastAfter = std::chrono::steady_clock::now() - start;
+    }
+    close(fd);
+
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(fastAfter).count();
+    if (got.find("fast") == std::string::npos || got.find("slow") == std::string::npos) {
+        std::printf("%s: connection lost a response (%zu bytes)\n", name, got.size());
+        return false;
+    }
+    if (fastAfter > PROMPT) {
+        std::printf("%s: fast response held for %lld ms behind the slow one\n", name, (long long) ms);
+        return false;
+    }
+    std::printf("%s: fast after %lld ms, then slow\n", name, (long long) ms);
+    return true;
+}
+
+int main()
+{
+    bool ok = pipelined("epoll", EventLoop::Backend::Epoll);
+#ifdef LUMENITE_IO_URING
+    ok = pipelined("io_uring", EventLoop::Backend::IoUring) && ok;
+#endif
+
+    uint64_t timeouts = EventLoop::stats().writeTimeouts;
+    std::printf("write timeouts: %llu\n", (unsigned long long) timeouts);
+    return ok && timeouts == 0 ? 0 : 1;
+}